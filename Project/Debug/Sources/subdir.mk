@@ -4,54 +4,84 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
-../Sources/Constants.c \
+../Sources/CRC.c \
+../Sources/Checkpoint.c \
+../Sources/DSP.c \
+../Sources/Demand.c \
 ../Sources/FIFO.c \
 ../Sources/FTM.c \
 ../Sources/FixedPoint.c \
 ../Sources/Flash.c \
+../Sources/Frequency.c \
 ../Sources/HMI.c \
+../Sources/Harmonics.c \
 ../Sources/LED.c \
 ../Sources/LPT.c \
+../Sources/Load.c \
+../Sources/LoadProfile.c \
 ../Sources/Measurements.c \
 ../Sources/PIT.c \
+../Sources/PLL.c \
 ../Sources/RTC.c \
 ../Sources/SelfTest.c \
+../Sources/Tarrifs.c \
+../Sources/Telemetry.c \
 ../Sources/TowerProtocol.c \
 ../Sources/UART.c \
 ../Sources/main.c \
 ../Sources/packet.c 
 
 OBJS += \
-./Sources/Constants.o \
+./Sources/CRC.o \
+./Sources/Checkpoint.o \
+./Sources/DSP.o \
+./Sources/Demand.o \
 ./Sources/FIFO.o \
 ./Sources/FTM.o \
 ./Sources/FixedPoint.o \
 ./Sources/Flash.o \
+./Sources/Frequency.o \
 ./Sources/HMI.o \
+./Sources/Harmonics.o \
 ./Sources/LED.o \
 ./Sources/LPT.o \
+./Sources/Load.o \
+./Sources/LoadProfile.o \
 ./Sources/Measurements.o \
 ./Sources/PIT.o \
+./Sources/PLL.o \
 ./Sources/RTC.o \
 ./Sources/SelfTest.o \
+./Sources/Tarrifs.o \
+./Sources/Telemetry.o \
 ./Sources/TowerProtocol.o \
 ./Sources/UART.o \
 ./Sources/main.o \
 ./Sources/packet.o 
 
 C_DEPS += \
-./Sources/Constants.d \
+./Sources/CRC.d \
+./Sources/Checkpoint.d \
+./Sources/DSP.d \
+./Sources/Demand.d \
 ./Sources/FIFO.d \
 ./Sources/FTM.d \
 ./Sources/FixedPoint.d \
 ./Sources/Flash.d \
+./Sources/Frequency.d \
 ./Sources/HMI.d \
+./Sources/Harmonics.d \
 ./Sources/LED.d \
 ./Sources/LPT.d \
+./Sources/Load.d \
+./Sources/LoadProfile.d \
 ./Sources/Measurements.d \
 ./Sources/PIT.d \
+./Sources/PLL.d \
 ./Sources/RTC.d \
 ./Sources/SelfTest.d \
+./Sources/Tarrifs.d \
+./Sources/Telemetry.d \
 ./Sources/TowerProtocol.d \
 ./Sources/UART.d \
 ./Sources/main.d \
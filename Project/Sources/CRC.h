@@ -0,0 +1,38 @@
+/*
+ * CRC.h
+ *
+ *  Created on: 9 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef CRC_H
+#define CRC_H
+
+#include "types.h"
+
+//CRC-16/CCITT-FALSE, polynomial x^16 + x^12 + x^5 + 1
+#define CRC16_INITIAL 0xFFFF
+
+/*! @brief Works out the CRC-16 of a block of data.
+ *
+ *  Can be chained, pass the result of one block in as the crc of the next.
+ *  @param data The data.
+ *  @param length The number of bytes.
+ *  @param crc CRC16_INITIAL, or the CRC of the data before this block.
+ *  @return uint16_t - the CRC.
+ */
+uint16_t CRC_16(const void * const data, const uint32_t length, uint16_t crc);
+
+//CRC-8, polynomial x^8 + x^2 + x + 1, for records too short to be worth two bytes of check
+#define CRC8_INITIAL 0x00
+
+/*! @brief Works out the CRC-8 of a block of data.
+ *
+ *  @param data The data.
+ *  @param length The number of bytes.
+ *  @param crc CRC8_INITIAL, or the CRC of the data before this block.
+ *  @return uint8_t - the CRC.
+ */
+uint8_t CRC_8(const void * const data, const uint32_t length, uint8_t crc);
+
+#endif
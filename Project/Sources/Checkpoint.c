@@ -0,0 +1,173 @@
+/*
+ * Checkpoint.c
+ *
+ *  Created on: 10 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "Checkpoint.h"
+#include "Measurements.h"
+#include "SelfTest.h"
+#include "CRC.h"
+#include "OS.h"
+#include <string.h>
+
+//records are programmed a phrase at a time, the first phrase last
+typedef char CheckpointIsWholePhrases[(sizeof(TCheckpoint) % FLASH_PHRASE_SIZE) == 0 ? 1 : -1];
+
+//the interval can't be shorter than the flash allows
+typedef char CheckpointIntervalInBudget[(CHECKPOINT_INTERVAL >= CHECKPOINT_MIN_INTERVAL) ? 1 : -1];
+
+static OS_ECB *CheckpointSemaphore;
+
+//the bank being filled, where the next record goes and the sequence of the newest record
+static uint32_t Bank;
+static uint32_t NextAddress;
+static uint16_t Sequence;
+
+//the metering time and active energy, import and export, at the last checkpoint
+static uint64_t LastTime;
+static double LastEnergy;
+
+//only the checkpoint thread uses it, it's too big for the thread's stack
+static TCheckpoint Record;
+
+/*! @brief Works out the CRC of a record.
+ *
+ *  @return uint16_t - the CRC.
+ */
+static uint16_t RecordCRC(const TCheckpoint * const record)
+{
+  return CRC_16((const uint8_t *)record + FLASH_PHRASE_SIZE, sizeof(TCheckpoint) - FLASH_PHRASE_SIZE, CRC16_INITIAL);
+}
+
+/*! @brief Checks every byte of a record slot is erased.
+ *
+ *  @return bool - TRUE if a record can be programmed there.
+ */
+static bool SlotErased(const uint32_t address)
+{
+  for (uint32_t offset = 0; offset < sizeof(TCheckpoint); offset += FLASH_PHRASE_SIZE)
+    if (_FP(address + offset) != UINT64_MAX)
+      return false;
+  return true;
+}
+
+bool Checkpoint_Init()
+{
+  //only the first time, this is retried until everything initialises
+  if (!CheckpointSemaphore)
+    CheckpointSemaphore = OS_SemaphoreCreate(0);
+
+  //the newest good record in either bank, allowing for the sequence wrapping
+  const TCheckpoint *newest = NULL;
+  const uint32_t banks[2] = {CHECKPOINT_BANK_A, CHECKPOINT_BANK_B};
+  for (uint8_t bank = 0; bank < 2; bank++)
+    for (uint8_t slot = 0; slot < CHECKPOINT_RECORDS_PER_BANK; slot++)
+    {
+      const TCheckpoint *record = (const TCheckpoint *)(banks[bank] + slot * sizeof(TCheckpoint));
+      if (record->Magic == CHECKPOINT_MAGIC && record->CRC == RecordCRC(record)
+          && (!newest || (int16_t)(record->Sequence - newest->Sequence) > 0))
+        newest = record;
+    }
+
+  if (newest)
+  {
+    Basic_Measurements.MeteringTime = newest->MeteringTime;
+    Basic_Measurements.TotalEnergy = newest->TotalEnergy;
+    Basic_Measurements.ExportEnergy = newest->ExportEnergy;
+    Basic_Measurements.ImportReactiveEnergy = newest->ImportReactiveEnergy;
+    Basic_Measurements.ExportReactiveEnergy = newest->ExportReactiveEnergy;
+    memcpy(Basic_Measurements.BillingEnergy, newest->BillingEnergy, sizeof(Basic_Measurements.BillingEnergy));
+    Demand_Restore(newest->DemandMax);
+
+    Sequence = newest->Sequence;
+    Bank = ((uint32_t)newest < CHECKPOINT_BANK_B) ? CHECKPOINT_BANK_A : CHECKPOINT_BANK_B;
+    NextAddress = (uint32_t)newest + sizeof(TCheckpoint);
+  }
+  else
+  {
+    Sequence = 0;
+    Bank = CHECKPOINT_BANK_A;
+    NextAddress = CHECKPOINT_BANK_A;
+  }
+
+  //a record cut short by a reset leaves a slot that can't be programmed, the bank's treated as full if there's nothing after it
+  while (NextAddress + sizeof(TCheckpoint) <= Bank + FLASH_SECTOR_SIZE && !SlotErased(NextAddress))
+    NextAddress += sizeof(TCheckpoint);
+
+  LastTime = Basic_Measurements.MeteringTime;
+  LastEnergy = Basic_Measurements.TotalEnergy + Basic_Measurements.ExportEnergy;
+  return true;
+}
+
+void Checkpoint_Tick()
+{
+  //the simulated readings aren't worth keeping
+  if (IsSelfTesting)
+    return;
+
+  uint64_t elapsed = Basic_Measurements.MeteringTime - LastTime;
+  double energy = Basic_Measurements.TotalEnergy + Basic_Measurements.ExportEnergy;
+  if (elapsed >= CHECKPOINT_INTERVAL || (elapsed >= CHECKPOINT_MIN_INTERVAL && energy - LastEnergy >= CHECKPOINT_ENERGY))
+  {
+    LastTime = Basic_Measurements.MeteringTime;
+    LastEnergy = energy;
+    OS_SemaphoreSignal(CheckpointSemaphore);
+  }
+}
+
+/*! @brief Programs the record into the next slot, moving to the other bank when this one is full.
+ *
+ *  @return bool - TRUE if the record was saved.
+ */
+static bool Save()
+{
+  if (NextAddress + sizeof(TCheckpoint) > Bank + FLASH_SECTOR_SIZE)
+  {
+    //the newest records stay in this bank until the other has one, so a reset during the erase loses nothing
+    uint32_t other = (Bank == CHECKPOINT_BANK_A) ? CHECKPOINT_BANK_B : CHECKPOINT_BANK_A;
+    if (!Flash_Erase_Sector(other))
+      return false;
+    Bank = other;
+    NextAddress = other;
+  }
+
+  Record.Magic = CHECKPOINT_MAGIC;
+  Record.Sequence = Sequence + 1;
+  Record.CRC = RecordCRC(&Record);
+
+  //a failed program can leave the slot half written, so it's skipped either way
+  uint32_t address = NextAddress;
+  NextAddress += sizeof(TCheckpoint);
+
+  //the first phrase has the magic in it, so it goes last and the record only counts once everything else is there
+  if (!Flash_Write_Block(address + FLASH_PHRASE_SIZE, (const uint8_t *)&Record + FLASH_PHRASE_SIZE, sizeof(TCheckpoint) - FLASH_PHRASE_SIZE)
+      || !Flash_Write_Block(address, &Record, FLASH_PHRASE_SIZE))
+    return false;
+
+  Sequence++;
+  return true;
+}
+
+void Checkpoint_Thread(void *pData)
+{
+  for (;;)
+  {
+    OS_SemaphoreWait(CheckpointSemaphore, 0);
+
+    //the calculate thread can't get in part way through, so the registers all come from the same window
+    OS_DisableInterrupts();
+    Record.MeteringTime = Basic_Measurements.MeteringTime;
+    Record.TotalEnergy = Basic_Measurements.TotalEnergy;
+    Record.ExportEnergy = Basic_Measurements.ExportEnergy;
+    Record.ImportReactiveEnergy = Basic_Measurements.ImportReactiveEnergy;
+    Record.ExportReactiveEnergy = Basic_Measurements.ExportReactiveEnergy;
+    memcpy(Record.BillingEnergy, Basic_Measurements.BillingEnergy, sizeof(Record.BillingEnergy));
+    OS_EnableInterrupts();
+    //the maximums only change at the end of a demand window, a window closing in between doesn't matter
+    Demand_Get_Registers(Record.DemandMax);
+
+    Save();
+  }
+}
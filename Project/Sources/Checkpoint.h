@@ -0,0 +1,69 @@
+/*
+ * Checkpoint.h
+ *
+ *  Created on: 10 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "types.h"
+#include "Flash.h"
+#include "Tarrifs.h"
+#include "Demand.h"
+
+//the registers are saved to the two sectors after the tariff banks, a record at a time, filling one before erasing the other
+#define CHECKPOINT_BANK_A (TARIFF_BANK_B + FLASH_SECTOR_SIZE)
+#define CHECKPOINT_BANK_B (CHECKPOINT_BANK_A + FLASH_SECTOR_SIZE)
+
+//"CHK" and the record format version, a record with any other magic is ignored
+#define CHECKPOINT_MAGIC 0x43484B02
+
+typedef struct
+{
+  uint32_t Magic;
+  uint16_t Sequence;
+  uint16_t CRC;                //over everything after the first phrase
+  uint64_t MeteringTime;
+  double TotalEnergy;
+  double ExportEnergy;
+  double ImportReactiveEnergy;
+  double ExportReactiveEnergy;
+  uint64_t BillingEnergy[TARIFFS_NB][TARIFF_REGISTERS_NB];
+  TDemandMax DemandMax[DEMAND_PERIODS_NB][DEMAND_REGISTERS_NB];
+} TCheckpoint;
+
+//each program flash sector is only guaranteed this many erases (K70 data sheet), and the meter has to last 20 years
+#define CHECKPOINT_ENDURANCE 10000
+#define CHECKPOINT_LIFE_SECONDS (20ULL * 31557600ULL)
+#define CHECKPOINT_RECORDS_PER_BANK (FLASH_SECTOR_SIZE / sizeof(TCheckpoint))
+
+//the shortest time between checkpoints that keeps both banks inside their erases for the whole life, about 53 minutes
+#define CHECKPOINT_MIN_INTERVAL (CHECKPOINT_LIFE_SECONDS / (2 * CHECKPOINT_ENDURANCE * CHECKPOINT_RECORDS_PER_BANK))
+
+//a checkpoint is taken after this many seconds of metering, or once this many kWh have been metered, but never sooner than the minimum
+#define CHECKPOINT_INTERVAL 3600
+#define CHECKPOINT_ENERGY 1.0
+
+/*! @brief Restores the registers from the newest good checkpoint.
+ *
+ *  @return bool - TRUE if the checkpoints were successfully initialized, whether or not there was one to restore.
+ *  @note Assumes Flash, Measurements and Demand have been initialized, the registers are left at zero if there's no checkpoint.
+ */
+bool Checkpoint_Init();
+
+/*! @brief Decides whether a checkpoint is due and wakes the checkpoint thread if it is.
+ *
+ *  @note Called once a second by the RTC thread.
+ */
+void Checkpoint_Tick();
+
+/*! @brief Saves the registers when signalled by Checkpoint_Tick.
+ *
+ *  @param pData Unused.
+ *  @note Erases busy wait, so it should be below the measurement and protocol threads.
+ */
+void Checkpoint_Thread(void *pData);
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * DSP.c
+ *
+ *  Created on: 3 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "DSP.h"
+#include <string.h>
+
+/*! @brief Dual 16x16 multiply with 64 bit accumulate, acc + x.lo * y.lo + x.hi * y.hi
+ *
+ *  @return int64_t - the new accumulator.
+ */
+static inline int64_t SMLALD(const uint32_t x, const uint32_t y, const int64_t acc)
+{
+#if defined(__ARM_FEATURE_DSP)
+  uint32_t lo = (uint32_t)acc;
+  uint32_t hi = (uint32_t)((uint64_t)acc >> 32);
+  __asm ("smlald %0, %1, %2, %3" : "+r" (lo), "+r" (hi) : "r" (x), "r" (y));
+  return (int64_t)(((uint64_t)hi << 32) | lo);
+#else
+  //what the instruction does, so the same kernel runs on a host
+  int32_t low = (int32_t)(int16_t)x * (int16_t)y;
+  int32_t high = (int32_t)(int16_t)(x >> 16) * (int16_t)(y >> 16);
+  return acc + low + high;
+#endif
+}
+
+void DSP_Accumulate(const int16_t voltage[], const int16_t current[], const uint16_t length, TDSPSums * const sums)
+{
+  int64_t voltageSquared = sums->VoltageSquared;
+  int64_t currentSquared = sums->CurrentSquared;
+  int64_t power = sums->Power;
+  uint16_t pairs = length / 2;
+
+  for (uint16_t i = 0; i < pairs; i++)
+  {
+    uint32_t v, c;
+    //memcpy keeps this legal C, it compiles down to a single LDR
+    memcpy(&v, &voltage[2 * i], sizeof(v));
+    memcpy(&c, &current[2 * i], sizeof(c));
+    voltageSquared = SMLALD(v, v, voltageSquared);
+    currentSquared = SMLALD(c, c, currentSquared);
+    power = SMLALD(v, c, power);
+  }
+
+  sums->VoltageSquared = voltageSquared;
+  sums->CurrentSquared = currentSquared;
+  sums->Power = power;
+
+  //odd sample left over
+  if (length & 1)
+    DSP_Accumulate_C(&voltage[length - 1], &current[length - 1], 1, sums);
+}
+
+void DSP_Accumulate_C(const int16_t voltage[], const int16_t current[], const uint16_t length, TDSPSums * const sums)
+{
+  for (uint16_t i = 0; i < length; i++)
+  {
+    int32_t v = voltage[i];
+    int32_t c = current[i];
+    sums->VoltageSquared += v * v;
+    sums->CurrentSquared += c * c;
+    sums->Power += v * c;
+  }
+}
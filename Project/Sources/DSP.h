@@ -0,0 +1,71 @@
+/*
+ * DSP.h
+ *
+ *  Created on: 3 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef DSP_H
+#define DSP_H
+
+#include "types.h"
+
+/*!
+ * @struct TDSPSums DSP.h
+ */
+typedef struct
+{
+  int64_t VoltageSquared;  /*!< Sum of V^2 */
+  int64_t CurrentSquared;  /*!< Sum of I^2 */
+  int64_t Power;           /*!< Sum of V*I, signed */
+  int64_t Reactive;        /*!< Sum of V*I with V delayed by a quarter cycle, signed */
+} TDSPSums;
+
+/*! @brief Accumulates the sum of V^2, I^2 and V*I of a block of raw samples in one pass, the reactive sum is left alone.
+ *
+ *  Packs two samples of a channel per register and uses SMLALD, so each pair of samples costs three multiply accumulates.
+ *  Without the DSP extension, on a host, SMLALD is done in C so the same kernel can be tested.
+ *  @param voltage The voltage samples, must be 4 byte aligned.
+ *  @param current The current samples, must be 4 byte aligned.
+ *  @param length The number of samples in each array.
+ *  @param sums The sums to add to, these are not cleared first.
+ */
+void DSP_Accumulate(const int16_t voltage[], const int16_t current[], const uint16_t length, TDSPSums * const sums);
+
+/*! @brief Sample by sample version of DSP_Accumulate with bit-identical results, used for the odd sample.
+ *
+ *  @param voltage The voltage samples.
+ *  @param current The current samples.
+ *  @param length The number of samples in each array.
+ *  @param sums The sums to add to, these are not cleared first.
+ */
+void DSP_Accumulate_C(const int16_t voltage[], const int16_t current[], const uint16_t length, TDSPSums * const sums);
+
+/*! @brief Adds a single sample pair to the sums, cheap enough to be done as each sample arrives.
+ *
+ *  @param sums The sums to add to.
+ *  @param voltage The voltage sample.
+ *  @param current The current sample.
+ */
+static inline void DSP_Accumulate_Sample(TDSPSums * const sums, const int16_t voltage, const int16_t current)
+{
+  int32_t v = voltage;
+  int32_t c = current;
+  sums->VoltageSquared += v * v;
+  sums->CurrentSquared += c * c;
+  sums->Power += v * c;
+}
+
+/*! @brief Adds a quarter cycle delayed voltage times current to the reactive sum.
+ *
+ *  Delaying the voltage by 90 degrees turns V*I*cos(phi) into V*I*sin(phi), so the mean is the reactive power, positive for a lagging (inductive) load.
+ *  @param sums The sums to add to.
+ *  @param delayedVoltage The voltage sample from a quarter of a mains cycle ago.
+ *  @param current The current sample.
+ */
+static inline void DSP_Accumulate_Reactive(TDSPSums * const sums, const int16_t delayedVoltage, const int16_t current)
+{
+  sums->Reactive += (int32_t)delayedVoltage * current;
+}
+
+#endif
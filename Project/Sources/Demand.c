@@ -0,0 +1,242 @@
+/*
+ * Demand.c
+ *
+ *  Created on: 12 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "Demand.h"
+#include "SelfTest.h"
+#include "OS.h"
+#include <string.h>
+
+//uWh over a window in seconds to W
+#define UWH_PER_WH 1000000ULL
+#define SECONDS_PER_HOUR 3600
+
+//the window asked for by Demand_Set, sub-interval in the low byte and setting in the high byte, 0 once the calculate thread has it
+static uint16_t volatile Pending;
+static uint8_t SubIntervalSetting;
+static uint8_t Setting;
+
+//the window the calculate thread is using
+static uint32_t SubIntervalSeconds;
+static uint8_t Length;
+static bool Block;
+
+//the sub-interval being added up, only used by the calculate thread
+static bool Started;
+static bool Partial;          //started part way through, so it isn't a whole sub-interval
+static uint64_t SubIntervalNb; //RTC seconds divided by the sub-interval length
+static uint64_t Sum;           //uWh
+static TTariffBand Band;       //of the last energy added
+
+//the last few whole sub-intervals, oldest at Head once the ring is full
+static uint64_t Ring[DEMAND_SUBINTERVALS_MAX];
+static uint8_t Head;
+static uint8_t RingNb;
+static uint64_t Total;
+
+static uint32_t volatile Present;
+static TDemandMax Max[DEMAND_PERIODS_NB][DEMAND_REGISTERS_NB];
+
+/*! @brief Checks a window can be used.
+ *
+ *  @return bool - TRUE if the sub-interval divides an hour and the number of sub-intervals fits the ring.
+ */
+static bool WindowValid(const uint8_t subInterval, const uint8_t setting)
+{
+  uint8_t subIntervalsNb = setting & DEMAND_SUBINTERVALS_MASK;
+  return subInterval >= 1 && subInterval <= 60 && (60 % subInterval) == 0
+      && subIntervalsNb >= 1 && subIntervalsNb <= DEMAND_SUBINTERVALS_MAX;
+}
+
+/*! @brief Empties the ring, the demand is next worked out once it has filled again.
+ */
+static void Restart()
+{
+  Head = 0;
+  RingNb = 0;
+  Total = 0;
+}
+
+/*! @brief Moves the calculate thread over to a window.
+ */
+static void Apply(const uint8_t subInterval, const uint8_t setting)
+{
+  SubIntervalSeconds = subInterval * 60;
+  Length = setting & DEMAND_SUBINTERVALS_MASK;
+  Block = (setting & DEMAND_BLOCK) != 0;
+  Started = false;
+  Restart();
+}
+
+/*! @brief Raises a maximum demand register of the current billing period if the demand is higher.
+ */
+static void UpdateMax(const uint8_t reg, const uint32_t demand, const uint32_t time)
+{
+  //Demand_Reset and the readers are lower priority, keep them from seeing half a register
+  OS_DisableInterrupts();
+  TDemandMax *max = &Max[DEMAND_CURRENT][reg];
+  if (demand > max->Demand)
+  {
+    max->Demand = demand;
+    max->Time = time;
+  }
+  OS_EnableInterrupts();
+}
+
+/*! @brief Adds a whole sub-interval to the ring, and works out the demand if a window has ended.
+ *
+ *  @param end The RTC time at the end of the sub-interval, seconds.
+ */
+static void Close(const uint64_t end)
+{
+  //the oldest sub-interval drops out of the total as the new one goes in
+  if (RingNb == Length)
+    Total -= Ring[Head];
+  else
+    RingNb++;
+  Ring[Head] = Sum;
+  Total += Sum;
+  Head = (Head + 1) % Length;
+
+  if (RingNb < Length)
+    return;
+  //block windows end on a multiple of the window length
+  if (Block && ((end / SubIntervalSeconds) % Length) != 0)
+    return;
+
+  uint64_t windowScale = (uint64_t)Length * SubIntervalSeconds * UWH_PER_WH;
+  uint32_t demand = (Total * SECONDS_PER_HOUR + windowScale / 2) / windowScale;
+  Present = demand;
+
+  //a window that crosses into another band counts towards the band it ends in
+  UpdateMax(Band, demand, end);
+  UpdateMax(DEMAND_TOTAL, demand, end);
+}
+
+bool Demand_Init()
+{
+  Pending = 0;
+  SubIntervalSetting = DEMAND_DEFAULT_SUBINTERVAL;
+  Setting = DEMAND_DEFAULT_SUBINTERVALS;
+  Apply(SubIntervalSetting, Setting);
+
+  Present = 0;
+  for (uint8_t period = 0; period < DEMAND_PERIODS_NB; period++)
+    for (uint8_t reg = 0; reg < DEMAND_REGISTERS_NB; reg++)
+    {
+      Max[period][reg].Demand = 0;
+      Max[period][reg].Time = 0;
+    }
+  return true;
+}
+
+bool Demand_Set(const uint8_t subInterval, const uint8_t setting)
+{
+  if (!WindowValid(subInterval, setting))
+    return false;
+
+  SubIntervalSetting = subInterval;
+  Setting = setting;
+  //a single halfword store, the calculate thread sees either none or all of it
+  Pending = ((uint16_t)setting << 8) | subInterval;
+  return true;
+}
+
+uint8_t Demand_Get_Subinterval()
+{
+  return SubIntervalSetting;
+}
+
+uint8_t Demand_Get_Setting()
+{
+  return Setting;
+}
+
+void Demand_Update(const uint64_t microWattHours, const uint64_t time, const TTariffBand band)
+{
+  uint16_t pending = Pending;
+  if (pending)
+  {
+    Pending = 0;
+    Apply(pending & 0xFF, pending >> 8);
+  }
+
+  //self test runs an hour every second, none of that is real demand
+  if (IsSelfTesting)
+  {
+    Started = false;
+    return;
+  }
+
+  uint64_t subIntervalNb = time / SubIntervalSeconds;
+  if (!Started)
+  {
+    Started = true;
+    Partial = true;
+    SubIntervalNb = subIntervalNb;
+    Sum = 0;
+  }
+
+  if (subIntervalNb != SubIntervalNb)
+  {
+    //anything but the next sub-interval means the clock was set, so the ring no longer lines up
+    bool next = (subIntervalNb == SubIntervalNb + 1);
+    if (!next)
+      Restart();
+    else if (!Partial)
+      Close(subIntervalNb * SubIntervalSeconds);
+
+    Partial = !next;
+    SubIntervalNb = subIntervalNb;
+    Sum = 0;
+  }
+
+  Sum += microWattHours;
+  if (microWattHours)
+    Band = band;
+}
+
+uint32_t Demand_Get_Present()
+{
+  return Present;
+}
+
+bool Demand_Get_Max(const TDemandPeriod period, const uint8_t reg, TDemandMax * const max)
+{
+  if (period >= DEMAND_PERIODS_NB || reg >= DEMAND_REGISTERS_NB)
+    return false;
+
+  OS_DisableInterrupts();
+  *max = Max[period][reg];
+  OS_EnableInterrupts();
+  return true;
+}
+
+void Demand_Reset()
+{
+  OS_DisableInterrupts();
+  for (uint8_t reg = 0; reg < DEMAND_REGISTERS_NB; reg++)
+  {
+    Max[DEMAND_PREVIOUS][reg] = Max[DEMAND_CURRENT][reg];
+    Max[DEMAND_CURRENT][reg].Demand = 0;
+    Max[DEMAND_CURRENT][reg].Time = 0;
+  }
+  OS_EnableInterrupts();
+}
+
+void Demand_Get_Registers(TDemandMax max[DEMAND_PERIODS_NB][DEMAND_REGISTERS_NB])
+{
+  OS_DisableInterrupts();
+  memcpy(max, Max, sizeof(Max));
+  OS_EnableInterrupts();
+}
+
+void Demand_Restore(const TDemandMax max[DEMAND_PERIODS_NB][DEMAND_REGISTERS_NB])
+{
+  OS_DisableInterrupts();
+  memcpy(Max, max, sizeof(Max));
+  OS_EnableInterrupts();
+}
@@ -0,0 +1,111 @@
+/*
+ * Demand.h
+ *
+ *  Created on: 12 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef DEMAND_H
+#define DEMAND_H
+
+#include "types.h"
+#include "Tarrifs.h"
+
+//setting high byte, when this bit is set the demand is only worked out at the end of each whole window
+#define DEMAND_BLOCK 0x80
+#define DEMAND_SUBINTERVALS_MASK 0x7F
+
+//the most sub-intervals a window can be made of, the ring is this long
+#define DEMAND_SUBINTERVALS_MAX 15
+
+//30 minute sliding demand in 5 minute steps
+#define DEMAND_DEFAULT_SUBINTERVAL 5
+#define DEMAND_DEFAULT_SUBINTERVALS 6
+
+//the maximum of all the bands, after the register for each band
+#define DEMAND_TOTAL TARIFF_BANDS_NB
+#define DEMAND_REGISTERS_NB (TARIFF_BANDS_NB + 1)
+
+//the billing period still running and the one before the last reset
+typedef enum
+{
+  DEMAND_CURRENT,
+  DEMAND_PREVIOUS,
+  DEMAND_PERIODS_NB
+} TDemandPeriod;
+
+typedef struct
+{
+  uint32_t Demand;  //W, average import over the window
+  uint32_t Time;    //RTC seconds at the end of the window, 0 if there hasn't been one
+} TDemandMax;
+
+/*! @brief Starts with empty registers and the default window.
+ *
+ *  @return bool - TRUE if demand was successfully initialized.
+ */
+bool Demand_Init();
+
+/*! @brief Sets the window, picked up by the calculate thread at its next window, which starts the ring again.
+ *
+ *  @param subInterval The sub-interval in minutes, 1 to 60 and must divide an hour.
+ *  @param setting The number of sub-intervals in a window, 1 to DEMAND_SUBINTERVALS_MAX, with DEMAND_BLOCK for block demand.
+ *  @return bool - TRUE if the window was valid.
+ */
+bool Demand_Set(const uint8_t subInterval, const uint8_t setting);
+
+/*! @brief Gets the sub-interval.
+ *
+ *  @return uint8_t - the sub-interval in minutes.
+ */
+uint8_t Demand_Get_Subinterval();
+
+/*! @brief Gets the number of sub-intervals in a window.
+ *
+ *  @return uint8_t - the setting as given to Demand_Set.
+ */
+uint8_t Demand_Get_Setting();
+
+/*! @brief Adds the energy imported in a measurement window to the sub-interval, and works out the demand when a sub-interval ends.
+ *
+ *  Only the sums of the last few sub-intervals and their total are kept, so each call is a few adds whatever the window length.
+ *  @param microWattHours The energy imported, uWh.
+ *  @param time The RTC time in seconds.
+ *  @param band The band the energy was billed at.
+ *  @note Must only be called by the calculate thread.
+ */
+void Demand_Update(const uint64_t microWattHours, const uint64_t time, const TTariffBand band);
+
+/*! @brief Gets the demand over the last whole window.
+ *
+ *  @return uint32_t - W, 0 until the first window is complete.
+ */
+uint32_t Demand_Get_Present();
+
+/*! @brief Gets a maximum demand register.
+ *
+ *  @param period The billing period.
+ *  @param reg A band, or DEMAND_TOTAL.
+ *  @param max Set to the register.
+ *  @return bool - TRUE if the register exists.
+ */
+bool Demand_Get_Max(const TDemandPeriod period, const uint8_t reg, TDemandMax * const max);
+
+/*! @brief Ends the billing period, the maximums are kept as the previous period and the current period starts from zero.
+ */
+void Demand_Reset();
+
+/*! @brief Copies every maximum demand register, for saving in a checkpoint.
+ *
+ *  @param max Set to the registers.
+ */
+void Demand_Get_Registers(TDemandMax max[DEMAND_PERIODS_NB][DEMAND_REGISTERS_NB]);
+
+/*! @brief Puts back the maximum demand registers from a checkpoint.
+ *
+ *  @param max The registers.
+ *  @note Assumes Demand has been initialized.
+ */
+void Demand_Restore(const TDemandMax max[DEMAND_PERIODS_NB][DEMAND_REGISTERS_NB]);
+
+#endif
@@ -18,6 +18,83 @@
 
 #include "OS.h"
 
+/*!
+ * Keeps the compiler from moving the buffer copies past the index that publishes them
+ */
+#define FIFO_BARRIER() __asm volatile ("" : : : "memory")
+
+/*! @brief Copies in as many bytes as there is space for and publishes them.
+ *
+ *  @return uint16_t - the number of bytes copied.
+ */
+static uint16_t CopyIn(TFIFO * const FIFO, const uint8_t data[], uint16_t length)
+{
+  uint16_t head = FIFO->Head;
+  uint16_t space = FIFO_SIZE - (uint16_t)(head - FIFO->Tail);
+  if (length > space)
+    length = space;
+
+  //masking each index takes care of the wrap, and packets are too short for memcpy to pay
+  for (uint16_t i = 0; i < length; i++)
+    FIFO->Buffer[(uint16_t)(head + i) & FIFO_MASK] = data[i];
+
+  FIFO_BARRIER();
+  FIFO->Head = head + length;
+  return length;
+}
+
+/*! @brief Copies out as many bytes as there are, up to length, and frees their space.
+ *
+ *  @return uint16_t - the number of bytes copied.
+ */
+static uint16_t CopyOut(TFIFO * const FIFO, uint8_t data[], uint16_t length)
+{
+  uint16_t tail = FIFO->Tail;
+  uint16_t count = (uint16_t)(FIFO->Head - tail);
+  if (length > count)
+    length = count;
+
+  for (uint16_t i = 0; i < length; i++)
+    data[i] = FIFO->Buffer[(uint16_t)(tail + i) & FIFO_MASK];
+
+  FIFO_BARRIER();
+  FIFO->Tail = tail + length;
+  return length;
+}
+
+/*! @brief Wakes a thread blocked on the FIFO, once for the whole batch.
+ *
+ *  @param waiting The flag it set before blocking.
+ *  @param semaphore The semaphore it is blocked on.
+ */
+static void Wake(bool volatile * const waiting, OS_ECB * const semaphore)
+{
+  if (*waiting)
+  {
+    *waiting = false;
+    OS_SemaphoreSignal(semaphore);
+  }
+}
+
+/*! @brief Blocks until the other side has moved on.
+ *
+ *  The flag is set before checking again, so a put or get between the check and the wait still leaves the semaphore signalled.
+ *  A signal left over from a check that didn't need to wait just makes a later check go round once more.
+ *  @param FIFO A pointer to the FIFO.
+ *  @param waiting The flag the other side checks.
+ *  @param semaphore The semaphore the other side signals.
+ *  @param full TRUE to wait for space, FALSE to wait for data.
+ */
+static void Block(const TFIFO * const FIFO, bool volatile * const waiting, OS_ECB * const semaphore, const bool full)
+{
+  *waiting = true;
+  uint16_t count = FIFO_Get_Count(FIFO);
+  if (full ? (count == FIFO_SIZE) : (count == 0))
+    OS_SemaphoreWait(semaphore, 0);
+  else
+    *waiting = false;
+}
+
 /*! @brief Initialize the FIFO before first use.
  *
  *  @param FIFO A pointer to the FIFO that needs initializing.
@@ -25,11 +102,11 @@
  */
 void FIFO_Init(TFIFO * const FIFO)
 {
-  FIFO->Start=0;
-  FIFO->End=0;
-  FIFO->NbBytes=0;
-  FIFO->BufferAccess = OS_SemaphoreCreate(1);
-  FIFO->SpaceAvailable = OS_SemaphoreCreate(FIFO_SIZE);
+  FIFO->Head = 0;
+  FIFO->Tail = 0;
+  FIFO->PutWaiting = false;
+  FIFO->GetWaiting = false;
+  FIFO->SpaceAvailable = OS_SemaphoreCreate(0);
   FIFO->ItemsAvailable = OS_SemaphoreCreate(0);
 }
 
@@ -42,23 +119,7 @@ void FIFO_Init(TFIFO * const FIFO)
  */
 bool FIFO_Put(TFIFO * const FIFO, const uint8_t data)
 {
-	OS_SemaphoreWait(FIFO->SpaceAvailable, 0);
-	OS_SemaphoreWait(FIFO->BufferAccess, 0);
-
-//	EnterCritical();
-	OS_DisableInterrupts();
-	FIFO->Buffer[FIFO->End] = data;//write to the end of FIFO
-	FIFO->End++;//increment the end
-	if (FIFO->End == FIFO_SIZE - 1)
-			FIFO->End = 0;
-	FIFO->NbBytes++;//increment the size of the buffer.
-	OS_EnableInterrupts();
-	//	ExitCritical();
-
-	OS_SemaphoreSignal(FIFO->BufferAccess);
-	OS_SemaphoreSignal(FIFO->ItemsAvailable);
-
-	return true;
+  return FIFO_Put_Block(FIFO, &data, 1) == 1;
 }
 
 /*! @brief Get one character from the FIFO.
@@ -70,23 +131,58 @@ bool FIFO_Put(TFIFO * const FIFO, const uint8_t data)
  */
 bool FIFO_Get(TFIFO * const FIFO, uint8_t * const dataPtr)
 {
-	OS_SemaphoreWait(FIFO->ItemsAvailable, 0);
-	OS_SemaphoreWait(FIFO->BufferAccess, 0);
-
-//	EnterCritical();
-	OS_DisableInterrupts();
-	*dataPtr = FIFO->Buffer[FIFO->Start];//get value of the first index
-	FIFO->Start++;//increment the start pointer of the buffer
-	if (FIFO->Start == FIFO_SIZE - 1)
-		FIFO->Start = 0;//go back to zero index after end of buffer
-	FIFO->NbBytes--; //decrement size of buffer
-//	ExitCritical();
-	OS_EnableInterrupts();
-
-	OS_SemaphoreSignal(FIFO->BufferAccess);
-	OS_SemaphoreSignal(FIFO->SpaceAvailable);
-
-	return true;
+  return FIFO_Get_Block(FIFO, dataPtr, 1) == 1;
+}
+
+uint16_t FIFO_Put_Block(TFIFO * const FIFO, const uint8_t data[], const uint16_t length)
+{
+  uint16_t nb = 0;
+  while (nb < length)
+  {
+    uint16_t put = CopyIn(FIFO, &data[nb], length - nb);
+    if (put)
+    {
+      nb += put;
+      Wake(&FIFO->GetWaiting, FIFO->ItemsAvailable);
+    }
+    else
+      Block(FIFO, &FIFO->PutWaiting, FIFO->SpaceAvailable, true);
+  }
+  return nb;
+}
+
+uint16_t FIFO_Get_Block(TFIFO * const FIFO, uint8_t data[], const uint16_t length)
+{
+  if (length == 0)
+    return 0;
+
+  uint16_t got;
+  while ((got = CopyOut(FIFO, data, length)) == 0)
+    Block(FIFO, &FIFO->GetWaiting, FIFO->ItemsAvailable, false);
+
+  Wake(&FIFO->PutWaiting, FIFO->SpaceAvailable);
+  return got;
+}
+
+uint16_t FIFO_Try_Put(TFIFO * const FIFO, const uint8_t data[], const uint16_t length)
+{
+  uint16_t put = CopyIn(FIFO, data, length);
+  if (put)
+    Wake(&FIFO->GetWaiting, FIFO->ItemsAvailable);
+  return put;
+}
+
+uint16_t FIFO_Try_Get(TFIFO * const FIFO, uint8_t data[], const uint16_t length)
+{
+  uint16_t got = CopyOut(FIFO, data, length);
+  if (got)
+    Wake(&FIFO->PutWaiting, FIFO->SpaceAvailable);
+  return got;
+}
+
+uint16_t FIFO_Get_Count(const TFIFO * const FIFO)
+{
+  return (uint16_t)(FIFO->Head - FIFO->Tail);
 }
 /*!
 * @}
@@ -22,22 +22,28 @@
 
 // Number of bytes in a FIFO
 /*!
- * The size of the FIFO buffer
+ * The size of the FIFO buffer, must be a power of two so the free running indices wrap with it
  */
 #define FIFO_SIZE 256
+/*!
+ * Masks a free running index to a position in the buffer
+ */
+#define FIFO_MASK (FIFO_SIZE - 1)
 
 /*!
  * @struct TFIFO FIFO.h
+ * Safe for one producer and one consumer without locking, either of which can be an ISR as long as it only uses the FIFO_Try functions.
+ * Head and Tail count every byte ever put and got, so all FIFO_SIZE bytes can be used and the number stored is just their difference.
  */
 typedef struct
 {
-  uint16_t Start;		/*!< The index of the position of the oldest data in the FIFO */
-  uint16_t End; 		/*!< The index of the next available empty position in the FIFO */
-  uint16_t volatile NbBytes;	/*!< The number of bytes currently stored in the FIFO */
+  uint16_t volatile Head;	/*!< Bytes put, only written by the producer */
+  uint16_t volatile Tail;	/*!< Bytes got, only written by the consumer */
   uint8_t Buffer[FIFO_SIZE];	/*!< The actual array of bytes to store the data */
-  OS_ECB *BufferAccess;
-  OS_ECB *SpaceAvailable;
-  OS_ECB *ItemsAvailable;
+  bool volatile PutWaiting;	/*!< The producer is blocked until there is space */
+  bool volatile GetWaiting;	/*!< The consumer is blocked until there is data */
+  OS_ECB *SpaceAvailable;	/*!< Only signalled when the producer is waiting */
+  OS_ECB *ItemsAvailable;	/*!< Only signalled when the consumer is waiting */
 } TFIFO;
 
 /*! @brief Initialize the FIFO before first use.
@@ -64,6 +70,54 @@ bool FIFO_Put(TFIFO * const FIFO, const uint8_t data);
  *  @note Assumes that FIFO_Init has been called.
  */
 bool FIFO_Get(TFIFO * const FIFO, uint8_t * const dataPtr);
+
+/*! @brief Put a block of bytes into the FIFO, waiting for space as needed.
+ *
+ *  The consumer is woken at most once for each batch of bytes copied in.
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data The bytes to store.
+ *  @param length The number of bytes.
+ *  @return uint16_t - the number of bytes stored, always length.
+ *  @note Assumes that FIFO_Init has been called.
+ */
+uint16_t FIFO_Put_Block(TFIFO * const FIFO, const uint8_t data[], const uint16_t length);
+
+/*! @brief Get a block of bytes from the FIFO, waiting until there is at least one.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data Where to place the retrieved bytes.
+ *  @param length The most bytes to retrieve.
+ *  @return uint16_t - the number of bytes retrieved, between 1 and length.
+ *  @note Assumes that FIFO_Init has been called.
+ */
+uint16_t FIFO_Get_Block(TFIFO * const FIFO, uint8_t data[], const uint16_t length);
+
+/*! @brief Put as many bytes as there is space for without waiting, safe to call from an ISR.
+ *
+ *  @param FIFO A pointer to a FIFO struct where data is to be stored.
+ *  @param data The bytes to store.
+ *  @param length The number of bytes.
+ *  @return uint16_t - the number of bytes stored, 0 if the FIFO is full.
+ *  @note Assumes that FIFO_Init has been called.
+ */
+uint16_t FIFO_Try_Put(TFIFO * const FIFO, const uint8_t data[], const uint16_t length);
+
+/*! @brief Get as many bytes as there are, up to length, without waiting, safe to call from an ISR.
+ *
+ *  @param FIFO A pointer to a FIFO struct with data to be retrieved.
+ *  @param data Where to place the retrieved bytes.
+ *  @param length The most bytes to retrieve.
+ *  @return uint16_t - the number of bytes retrieved, 0 if the FIFO is empty.
+ *  @note Assumes that FIFO_Init has been called.
+ */
+uint16_t FIFO_Try_Get(TFIFO * const FIFO, uint8_t data[], const uint16_t length);
+
+/*! @brief Get the number of bytes stored in the FIFO.
+ *
+ *  @param FIFO A pointer to a FIFO struct.
+ *  @return uint16_t - the number of bytes, 0 to FIFO_SIZE.
+ */
+uint16_t FIFO_Get_Count(const TFIFO * const FIFO);
 /*!
 * @}
 */
@@ -17,3 +17,67 @@ Fixed32Q24 FloatToFixed(float value) {
   fixed.fixed.f = round(value *  pow(2,24));
   return fixed;
 }
+
+float FixedToFloat(const Fixed32Q24 value)
+{
+  return (float)value.fixed.f / (float)(1 << FIXED_Q24_SHIFT);
+}
+
+//builds the result of an arithmetic operation, keeping original in step with the fixed value
+static Fixed32Q24 FromRaw(const uint32_t raw)
+{
+  Fixed32Q24 result;
+  result.fixed.f = raw;
+  result.original = FixedToFloat(result);
+  return result;
+}
+
+Fixed32Q24 FixedPoint_Add(const Fixed32Q24 a, const Fixed32Q24 b)
+{
+  return FromRaw(a.fixed.f + b.fixed.f);
+}
+
+Fixed32Q24 FixedPoint_Subtract(const Fixed32Q24 a, const Fixed32Q24 b)
+{
+  return FromRaw(a.fixed.f - b.fixed.f);
+}
+
+Fixed32Q24 FixedPoint_Multiply(const Fixed32Q24 a, const Fixed32Q24 b)
+{
+  return FromRaw(((uint64_t)a.fixed.f * b.fixed.f) >> FIXED_Q24_SHIFT);
+}
+
+Fixed32Q24 FixedPoint_Divide(const Fixed32Q24 a, const Fixed32Q24 b)
+{
+  if (b.fixed.f == 0)
+    return FromRaw(0);
+  return FromRaw(((uint64_t)a.fixed.f << FIXED_Q24_SHIFT) / b.fixed.f);
+}
+
+int64_t FixedPoint_Scale(const int64_t value, const Fixed32Q24 scale)
+{
+  return (value * (int64_t)scale.fixed.f) >> FIXED_Q24_SHIFT;
+}
+
+uint32_t FixedPoint_Sqrt64(uint64_t value)
+{
+  //bit by bit square root, one result bit per iteration
+  uint64_t result = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+
+  while (bit > value)
+    bit >>= 2;
+
+  while (bit != 0)
+  {
+    if (value >= result + bit)
+    {
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    }
+    else
+      result >>= 1;
+    bit >>= 2;
+  }
+  return (uint32_t)result;
+}
@@ -21,6 +21,59 @@ typedef struct {
   float original;
 } Fixed32Q24;
 
+//number of fractional bits in a Fixed32Q24
+#define FIXED_Q24_SHIFT 24
+
+//builds a Fixed32Q24 constant from its raw Q24 value, i.e. value * 2^24
+#define FIXED_Q24(raw) {.fixed = {.f = (raw)}, .original = (float)(raw) / (1 << FIXED_Q24_SHIFT)}
+
 Fixed32Q24 FloatToFixed(float value);
 
+/*! @brief Converts a Q24 number back to a float.
+ *
+ *  @param value The fixed point number to convert.
+ *  @return float - the value as a float.
+ */
+float FixedToFloat(const Fixed32Q24 value);
+
+/*! @brief Adds two Q24 numbers.
+ *
+ *  @return Fixed32Q24 - a + b, wraps if the result exceeds 256.
+ */
+Fixed32Q24 FixedPoint_Add(const Fixed32Q24 a, const Fixed32Q24 b);
+
+/*! @brief Subtracts two Q24 numbers.
+ *
+ *  @return Fixed32Q24 - a - b, wraps if b is larger than a.
+ */
+Fixed32Q24 FixedPoint_Subtract(const Fixed32Q24 a, const Fixed32Q24 b);
+
+/*! @brief Multiplies two Q24 numbers using a 64-bit intermediate.
+ *
+ *  @return Fixed32Q24 - a * b truncated to Q24.
+ */
+Fixed32Q24 FixedPoint_Multiply(const Fixed32Q24 a, const Fixed32Q24 b);
+
+/*! @brief Divides two Q24 numbers using a 64-bit intermediate.
+ *
+ *  @return Fixed32Q24 - a / b truncated to Q24, 0 if b is 0.
+ */
+Fixed32Q24 FixedPoint_Divide(const Fixed32Q24 a, const Fixed32Q24 b);
+
+/*! @brief Multiplies an integer (of any Q format) by a Q24 scale factor.
+ *
+ *  @param value The value to scale, the result keeps the same number of fractional bits.
+ *  @param scale The Q24 scale factor.
+ *  @return int64_t - (value * scale) >> 24.
+ *  @note value * scale must fit in 63 bits.
+ */
+int64_t FixedPoint_Scale(const int64_t value, const Fixed32Q24 scale);
+
+/*! @brief Integer square root of a 64-bit number.
+ *
+ *  @param value The value to take the square root of.
+ *  @return uint32_t - floor(sqrt(value)).
+ */
+uint32_t FixedPoint_Sqrt64(uint64_t value);
+
 #endif
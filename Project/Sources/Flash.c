@@ -10,14 +10,225 @@
  *  @{
  */
 #include "Flash.h"
+#include "CRC.h"
 #include "MK70F12.h"
+#include "OS.h"
 #include <string.h>
+#include <stddef.h>
 #include <stdlib.h>
 
+//headers and records are programmed a phrase at a time
+typedef char FlashRecordIsAPhrase[(sizeof(TFlashRecord) == FLASH_PHRASE_SIZE && sizeof(TFlashSectorHeader) == FLASH_PHRASE_SIZE) ? 1 : -1];
+
+/*!
+ * The start of a log sector
+ */
+#define LOG_SECTOR(sector) (FLASH_DATA_START + (sector) * FLASH_SECTOR_SIZE)
+/*!
+ * The header of a log sector
+ */
+#define LOG_HEADER(sector) ((const TFlashSectorHeader *)LOG_SECTOR(sector))
 
 static uint8_t MemoryMap[FLASH_SIZE] =
   {CLEAR}; //set it to be clear.
 
+//the last value written to every variable, words so the 32-bit variables are aligned
+static uint32_t Variables[FLASH_SIZE / 4];
+
+//the sector records are being added to and where the next one goes
+static uint8_t ActiveSector;
+static uint16_t ActiveSequence;
+static uint32_t NextRecord;
+
+//one flash command at a time, and one writer to the log
+static OS_ECB *AccessSemaphore;
+
+//signalled when a write is queued
+static OS_ECB *PendingSemaphore;
+
+//queued writes, a later write to a byte replaces an earlier one
+static uint8_t Pending[FLASH_SIZE];
+static uint8_t PendingBytes[FLASH_SIZE / 4]; //a bit for each byte of a word with a write waiting
+static bool EraseRequested;                  //done before the writes queued with it
+
+//the word of an erase's callback, past the last word of the variables
+#define ERASE_WORD (FLASH_SIZE / 4)
+
+//a sector outside the log to erase and program, Data is NULL when there isn't one
+static struct
+{
+  uint32_t Address;
+  const uint8_t *Data;
+  uint32_t Length;
+} SectorRequest;
+
+//the word of a sector write's callback
+#define SECTOR_WORD (ERASE_WORD + 1)
+
+//the writes waiting to call back, and the word each is in
+typedef struct
+{
+  TFlashCallback Callback;
+  uint32_t Argument;
+  uint8_t Word;
+} TFlashCallbackEntry;
+
+static TFlashCallbackEntry Callbacks[FLASH_CALLBACKS_NB];
+static uint8_t CallbacksNb;
+
+/*! @brief Works out the CRC of a sector header.
+ *
+ *  @return uint16_t - the CRC.
+ */
+static uint16_t HeaderCRC(const TFlashSectorHeader * const header)
+{
+  return CRC_16(header, offsetof(TFlashSectorHeader, CRC), CRC16_INITIAL);
+}
+
+/*! @brief Works out the CRC of a record, which covers either side of the CRC field.
+ *
+ *  @return uint16_t - the CRC.
+ */
+static uint16_t RecordCRC(const TFlashRecord * const record)
+{
+  uint16_t crc = CRC_16(record, offsetof(TFlashRecord, CRC), CRC16_INITIAL);
+  return CRC_16(record->Data, sizeof(record->Data), crc);
+}
+
+/*! @brief Checks a log sector has been started.
+ *
+ *  @return bool - TRUE if the sector has a good header.
+ */
+static bool SectorValid(const uint8_t sector)
+{
+  const TFlashSectorHeader *header = LOG_HEADER(sector);
+  return header->Magic == FLASH_LOG_MAGIC && header->CRC == HeaderCRC(header);
+}
+
+/*! @brief Applies every record in a sector to the variables, oldest first.
+ *
+ *  @return uint32_t - the address after the last record.
+ */
+static uint32_t ReplaySector(const uint8_t sector)
+{
+  uint32_t address = LOG_SECTOR(sector) + FLASH_PHRASE_SIZE;
+
+  //records are only ever appended, so the first erased phrase is the end
+  for (; address < LOG_SECTOR(sector + 1) && _FP(address) != UINT64_MAX; address += FLASH_PHRASE_SIZE)
+  {
+    const TFlashRecord *record = (const TFlashRecord *)address;
+
+    //a record cut short by a reset fails its CRC and is skipped
+    if (record->CRC == RecordCRC(record) && record->Length <= FLASH_RECORD_DATA_SIZE
+        && record->Key + record->Length <= FLASH_SIZE)
+      memcpy((uint8_t *)Variables + record->Key, record->Data, record->Length);
+  }
+  return address;
+}
+
+/*! @brief Makes an erased sector the one records are added to.
+ *
+ *  @return bool - TRUE if the header was programmed.
+ */
+static bool StartSector(const uint8_t sector, const uint16_t sequence)
+{
+  TFlashSectorHeader header = {.Magic = FLASH_LOG_MAGIC, .Sequence = sequence};
+  header.CRC = HeaderCRC(&header);
+
+  uint64union_t phrase;
+  memcpy(&phrase, &header, sizeof(phrase));
+  if (!WritePhrase(LOG_SECTOR(sector), phrase))
+    return false;
+
+  ActiveSector = sector;
+  ActiveSequence = sequence;
+  NextRecord = LOG_SECTOR(sector) + FLASH_PHRASE_SIZE;
+  return true;
+}
+
+/*! @brief Programs a record into the next free phrase.
+ *
+ *  @return bool - TRUE if the record was programmed.
+ */
+static bool AppendRecord(const uint8_t key, const void * const data, const uint8_t length)
+{
+  TFlashRecord record;
+  memset(&record, CLEAR_DATA1, sizeof(record));
+  record.Key = key;
+  record.Length = length;
+  memcpy(record.Data, data, length);
+  record.CRC = RecordCRC(&record);
+
+  uint64union_t phrase;
+  memcpy(&phrase, &record, sizeof(phrase));
+
+  //a failed program can leave the phrase half written, so it's skipped either way
+  uint32_t address = NextRecord;
+  NextRecord += FLASH_PHRASE_SIZE;
+  return WritePhrase(address, phrase);
+}
+
+/*! @brief Moves the log on to the next sector, which is the oldest, and starts it with a copy of every variable.
+ *
+ *  The sectors are used in turn so they wear evenly, and after the copy nothing in the oldest sector is needed.
+ *  @return bool - TRUE if the new sector was started.
+ */
+static bool NextSector()
+{
+  uint8_t sector = (ActiveSector + 1) % FLASH_LOG_SECTORS;
+  if (!EraseSector(LOG_SECTOR(sector)) || !StartSector(sector, ActiveSequence + 1))
+    return false;
+
+  for (uint8_t key = 0; key < FLASH_SIZE; key += FLASH_RECORD_DATA_SIZE)
+    if (Variables[key / 4] != CLEAR_DATA4)
+      if (!AppendRecord(key, &Variables[key / 4], FLASH_RECORD_DATA_SIZE))
+        return false;
+  return true;
+}
+
+static bool WriteRecord(const uint8_t key, const void * const data, const uint8_t length)
+{
+  //unchanged, no need to use up a phrase
+  if (!memcmp((uint8_t *)Variables + key, data, length))
+    return true;
+
+  if (NextRecord >= LOG_SECTOR(ActiveSector + 1))
+    if (!NextSector())
+      return false;
+
+  if (!AppendRecord(key, data, length))
+    return false;
+
+  memcpy((uint8_t *)Variables + key, data, length);
+  return true;
+}
+
+/*! @brief Writes a record for a thread that hasn't got access to the flash yet.
+ *
+ *  @return bool - TRUE if the record was written.
+ */
+static bool WriteRecordLocked(const uint8_t key, const void * const data, const uint8_t length)
+{
+  OS_SemaphoreWait(AccessSemaphore, 0);
+  bool success = WriteRecord(key, data, length);
+  OS_SemaphoreSignal(AccessSemaphore);
+  return success;
+}
+
+/*! @brief Finds the variable an address belongs to.
+ *
+ *  @return bool - TRUE if the address is a variable aligned to its size.
+ */
+static bool VariableKey(volatile const void * const address, const uint8_t size, uint8_t * const key)
+{
+  uintptr_t offset = (uintptr_t)address - (uintptr_t)Variables;
+  if (offset + size > FLASH_SIZE || offset % size)
+    return false;
+
+  *key = offset;
+  return true;
+}
+
 /*! @brief Enables the Flash module.
  *
  *  @return bool - TRUE if the Flash was setup successfully.
@@ -25,6 +236,36 @@ static uint8_t MemoryMap[FLASH_SIZE] =
 bool Flash_Init(void)
 {
   //SIM_SCGC3 |= SIM_SCGC3_NFC_MASK; //enable NFC clock
+  //only the first time, this is retried until everything initialises
+  if (!AccessSemaphore)
+  {
+    AccessSemaphore = OS_SemaphoreCreate(1);
+    PendingSemaphore = OS_SemaphoreCreate(0);
+  }
+
+  memset(Variables, CLEAR_DATA1, sizeof(Variables));
+
+  //the newest sector, allowing for the sequence wrapping
+  int8_t newest = -1;
+  for (uint8_t sector = 0; sector < FLASH_LOG_SECTORS; sector++)
+    if (SectorValid(sector)
+        && (newest < 0 || (int16_t)(LOG_HEADER(sector)->Sequence - LOG_HEADER(newest)->Sequence) > 0))
+      newest = sector;
+
+  //nothing has been written yet
+  if (newest < 0)
+    return EraseSector(LOG_SECTOR(0)) && StartSector(0, 0);
+
+  //the sectors are used in turn, so the one after the newest is the oldest
+  for (uint8_t i = 1; i <= FLASH_LOG_SECTORS; i++)
+  {
+    uint8_t sector = (newest + i) % FLASH_LOG_SECTORS;
+    if (SectorValid(sector))
+      NextRecord = ReplaySector(sector);
+  }
+
+  ActiveSector = newest;
+  ActiveSequence = LOG_HEADER(newest)->Sequence;
   return true;
 }
 
@@ -43,48 +284,20 @@ bool Flash_Init(void)
  */
 bool Flash_AllocateVar(volatile void** variable, const uint8_t size)
 {
-  //allocate some space and return address variable
-  //provides offset for next available address space
-  //FIXME
-  //https://stackoverflow.com/questions/6938219/how-to-check-whether-all-bytes-in-a-memory-block-are-zero
-  //for 1 byte
-  int i;
-  char clearBlock[4]; //a block of memory thats set to 0 to compare with memory map.
-  //Convert this to a function
-  switch (size)
+  static const uint8_t clearBlock[4] = {CLEAR}; //a block of memory thats set to 0 to compare with memory map.
+
+  if (size != 1 && size != 2 && size != 4)
+    return false;
+
+  //the first free space aligned to the size
+  for (uint8_t i = 0; i + size <= FLASH_SIZE; i += size)
   {
-    case 1:
-      for (i = 0; i < FLASH_SIZE; i++)
-      {
-        if (MemoryMap[i] == 0)
-        {
-          //found a byte that has not been allocated yet.
-          MemoryMap[i] = 1;
-          *variable = (void *)FLASH_DATA_START + i;
-          return true;
-          break;
-        }
-      }
-      break;
-    case 2:
-    case 4:
-      memset(clearBlock, 0, sizeof(clearBlock));
-      for (i = 0; i < FLASH_SIZE; i++)
-      {
-        if (MemoryMap[i] == 0)
-        {
-          //found a byte that has not been allocated yet.
-          //compare clear block with this block of memory found
-          if (!memcmp(clearBlock, (void *)&MemoryMap[i], size))
-          {
-            //all 0,return true
-            memset(&MemoryMap[i], 1, size);					//set this space as taken
-            *variable = (void *)FLASH_DATA_START + i;
-            return true;
-          }
-        }
-      }
-      break;
+    if (!memcmp(clearBlock, &MemoryMap[i], size))
+    {
+      memset(&MemoryMap[i], SETBIT, size); //set this space as taken
+      *variable = (uint8_t *)Variables + i;
+      return true;
+    }
   }
   return false;
 }
@@ -98,29 +311,10 @@ bool Flash_AllocateVar(volatile void** variable, const uint8_t size)
  */
 bool Flash_Write32(volatile uint32_t* const address, const uint32_t data)
 {
-  // we have to check that the address is 8 byte aligned, probably by using modulo.
-  // this gets the word and the next word and calls Modify_Phrase to write data
-  uint32_t index = (uint32_t)address-(uint32_t)FLASH_DATA_START;
-  uint32_t divby4 = (uint32_t)address%4;
-  uint64union_t bit64;
-  if(divby4 == 0)
-  {
-    if(index > 3)
-    {
-      bit64.s32.Hi = data;
-      bit64.s32.Lo = *(address-1);
-    }
-    else
-    {
-      bit64.s32.Hi = *(address+1);
-      bit64.s32.Lo = data;
-    }
-  }
-  else
-  {
+  uint8_t key;
+  if (!VariableKey(address, sizeof(data), &key))
     return false;
-  }
-  return ModifyPhrase((uint32_t)FLASH_DATA_START, bit64);
+  return WriteRecordLocked(key, &data, sizeof(data));
 }
 
 /*! @brief Writes a 16-bit number to Flash.
@@ -132,34 +326,10 @@ bool Flash_Write32(volatile uint32_t* const address, const uint32_t data)
  */
 bool Flash_Write16(volatile uint16_t* const address, const uint16_t data)
 {
-  //combine the passed 16 bit (half-word) with the next 16 bit block to call _Write32
-  uint32_t index = (uint32_t)address-(uint32_t)FLASH_DATA_START;
-  uint32_t odd = (uint32_t)address%2;
-  uint32union_t bit32;
-  if(!odd)
-  {
-    if(index == 2 || index == 6)
-    {
-      bit32.s.Lo = *(address-1);
-      bit32.s.Hi = data;
-      return Flash_Write32((uint32_t *)(address-1), bit32.l);
-    }
-    else
-    {
-      bit32.s.Lo = data;
-      bit32.s.Hi = *(address+1);
-      return Flash_Write32((uint32_t *)(address), bit32.l);
-    }
-  }
-  else
-  {
+  uint8_t key;
+  if (!VariableKey(address, sizeof(data), &key))
     return false;
-  }
-
-  //uint64union_t tempData;
-  //tempData.s32.Hi = 0;
-  //tempData.s32.Lo = bit32.l;
-  //ModifyPhrase((uint32_t)BLOCK2_SECT0_ABSOLUTE_ADDRESS, tempData);
+  return WriteRecordLocked(key, &data, sizeof(data));
 }
 
 /*! @brief Writes an 8-bit number to Flash.
@@ -171,43 +341,270 @@ bool Flash_Write16(volatile uint16_t* const address, const uint16_t data)
  */
 bool Flash_Write8(volatile uint8_t* const address, const uint8_t data)
 {
-  // combine the passed 8 bit (byte) with the next byte to call _Write16
-  uint32_t odd = (uint32_t)address%2;
-  uint16union_t bit16;
-  if(!odd)
+  uint8_t key;
+  if (!VariableKey(address, sizeof(data), &key))
+    return false;
+  return WriteRecordLocked(key, &data, sizeof(data));
+}
+
+/*! @brief Drops every queued write.
+ *
+ *  @note Must be called with interrupts off.
+ */
+static void DropPending()
+{
+  memset(PendingBytes, 0, sizeof(PendingBytes));
+}
+
+/*! @brief Queues a callback for the flash thread.
+ *
+ *  @return bool - TRUE if there was room.
+ *  @note Must be called with interrupts off.
+ */
+static bool QueueCallback(const TFlashCallback callback, const uint32_t argument, const uint8_t word)
+{
+  if (!callback)
+    return true;
+  if (CallbacksNb == FLASH_CALLBACKS_NB)
+    return false;
+
+  Callbacks[CallbacksNb].Callback = callback;
+  Callbacks[CallbacksNb].Argument = argument;
+  Callbacks[CallbacksNb].Word = word;
+  CallbacksNb++;
+  return true;
+}
+
+bool Flash_Write_Async(volatile void * const address, const uint32_t data, const uint8_t size, const TFlashCallback callback, const uint32_t argument)
+{
+  uint8_t key;
+  if ((size != 1 && size != 2 && size != 4) || !VariableKey(address, size, &key))
+    return false;
+
+  OS_DisableInterrupts();
+  if (!QueueCallback(callback, argument, key / 4))
   {
-    bit16.s.Lo = data;
-    bit16.s.Hi = *(address+1);
-    return Flash_Write16((uint16_t *)(address), bit16.l);
+    OS_EnableInterrupts();
+    return false;
   }
-  else
+
+  memcpy(&Pending[key], &data, size);
+  PendingBytes[key / 4] |= ((1 << size) - 1) << (key % 4);
+  OS_EnableInterrupts();
+
+  OS_SemaphoreSignal(PendingSemaphore);
+  return true;
+}
+
+bool Flash_Erase_Async(const TFlashCallback callback, const uint32_t argument)
+{
+  OS_DisableInterrupts();
+  if (!QueueCallback(callback, argument, ERASE_WORD))
   {
-    bit16.s.Lo = *(address-1);
-    bit16.s.Hi = data;
-    return Flash_Write16((uint16_t *)(address-1), bit16.l);
+    OS_EnableInterrupts();
+    return false;
   }
+  //in the same critical section as the request, so the thread can't pick up a write from before the erase
+  DropPending();
+  EraseRequested = true;
+  OS_EnableInterrupts();
+
+  OS_SemaphoreSignal(PendingSemaphore);
+  return true;
 }
 
-/*! @brief Erases the entire Flash sector.
+bool Flash_Write_Sector_Async(const uint32_t address, const void * const data, const uint32_t length, const TFlashCallback callback,
+    const uint32_t argument)
+{
+  if (address % FLASH_SECTOR_SIZE || address <= FLASH_DATA_END || length % FLASH_PHRASE_SIZE || length == 0 || length > FLASH_SECTOR_SIZE)
+    return false;
+
+  OS_DisableInterrupts();
+  if (SectorRequest.Data || !QueueCallback(callback, argument, SECTOR_WORD))
+  {
+    OS_EnableInterrupts();
+    return false;
+  }
+  SectorRequest.Address = address;
+  SectorRequest.Data = data;
+  SectorRequest.Length = length;
+  OS_EnableInterrupts();
+
+  OS_SemaphoreSignal(PendingSemaphore);
+  return true;
+}
+
+/*! @brief Erases the log sectors and starts the log again.
  *
- *  @return bool - TRUE if the Flash "data" sector was erased successfully.
- *  @note Assumes Flash has been initialized.
+ *  @return bool - TRUE if the Flash "data" sectors were erased successfully.
+ *  @note Must be called holding AccessSemaphore.
  */
-bool Flash_Erase(void)
+static bool EraseLog()
 {
-  return EraseSector(FLASH_DATA_START);
+  bool success = true;
+  for (uint8_t sector = 0; success && sector < FLASH_LOG_SECTORS; sector++)
+    success = EraseSector(LOG_SECTOR(sector));
+
+  if (success)
+  {
+    memset(Variables, CLEAR_DATA1, sizeof(Variables));
+
+    //carry on from the next sector so the wear stays even
+    success = StartSector((ActiveSector + 1) % FLASH_LOG_SECTORS, ActiveSequence + 1);
+  }
+  return success;
 }
 
-/*! @brief Higher level function which calls erase and write.
+void Flash_Thread(void *pData)
+{
+  for (;;)
+  {
+    OS_SemaphoreWait(PendingSemaphore, 0);
+
+    //take everything queued so far, anything queued while this lot is programmed waits for the next time round
+    uint8_t data[FLASH_SIZE];
+    uint8_t bytes[FLASH_SIZE / 4];
+    TFlashCallbackEntry callbacks[FLASH_CALLBACKS_NB];
+    OS_DisableInterrupts();
+    memcpy(data, Pending, sizeof(data));
+    memcpy(bytes, PendingBytes, sizeof(bytes));
+    DropPending();
+    bool erase = EraseRequested;
+    EraseRequested = false;
+    uint8_t callbacksNb = CallbacksNb;
+    memcpy(callbacks, Callbacks, callbacksNb * sizeof(TFlashCallbackEntry));
+    CallbacksNb = 0;
+    uint32_t sectorAddress = SectorRequest.Address;
+    const uint8_t *sectorData = SectorRequest.Data;
+    uint32_t sectorLength = SectorRequest.Length;
+    OS_EnableInterrupts();
+
+    //the erase goes first, every write taken with it was queued after it
+    //a write dropped by the erase reports the erase's result, its value was wiped either way
+    bool failed[SECTOR_WORD + 1] = {false};
+    OS_SemaphoreWait(AccessSemaphore, 0);
+    if (erase)
+    {
+      bool erased = EraseLog();
+      for (uint8_t word = 0; word <= ERASE_WORD; word++)
+        failed[word] = !erased;
+    }
+
+    //a record per word, so writes to neighbouring variables share a program and at most one sector change
+    for (uint8_t word = 0; word < FLASH_SIZE / 4; word++)
+    {
+      if (!bytes[word])
+        continue;
+
+      uint8_t record[FLASH_RECORD_DATA_SIZE];
+      memcpy(record, &Variables[word], sizeof(record));
+      for (uint8_t i = 0; i < FLASH_RECORD_DATA_SIZE; i++)
+        if (bytes[word] & (1 << i))
+          record[i] = data[word * 4 + i];
+      failed[word] = !WriteRecord(word * 4, record, sizeof(record));
+    }
+
+    //the first phrase goes in last, so the sector only looks valid once the rest is there
+    if (sectorData)
+      failed[SECTOR_WORD] = !EraseSector(sectorAddress)
+          || !WriteBlock(sectorAddress + FLASH_PHRASE_SIZE, sectorData + FLASH_PHRASE_SIZE, sectorLength - FLASH_PHRASE_SIZE)
+          || !WriteBlock(sectorAddress, sectorData, FLASH_PHRASE_SIZE);
+    OS_SemaphoreSignal(AccessSemaphore);
+
+    //done with the data, the callback can queue another sector
+    if (sectorData)
+    {
+      OS_DisableInterrupts();
+      SectorRequest.Data = NULL;
+      OS_EnableInterrupts();
+    }
+
+    for (uint8_t i = 0; i < callbacksNb; i++)
+      callbacks[i].Callback(callbacks[i].Argument, !failed[callbacks[i].Word]);
+  }
+}
+
+/*! @brief Erases every variable.
  *
- *  @return bool returns true if everything has been successfully executed.
+ *  @return bool - TRUE if the Flash "data" sectors were erased successfully.
+ *  @note Assumes Flash has been initialized.
  */
-static bool ModifyPhrase(const uint32_t address, const uint64union_t phrase)
+bool Flash_Erase(void)
+{
+  //a write queued before the erase mustn't be written back after it
+  OS_DisableInterrupts();
+  DropPending();
+  OS_EnableInterrupts();
+
+  OS_SemaphoreWait(AccessSemaphore, 0);
+  bool success = EraseLog();
+  OS_SemaphoreSignal(AccessSemaphore);
+  return success;
+}
+
+volatile uint8_t *Flash_Get_Variable(const uint8_t offset)
 {
-  //this calls EraseSector and writePhrase. We don't care about mismatched size cos only writing to one phrase.
-  if (!EraseSector(FLASH_DATA_START))
+  if (offset >= FLASH_SIZE)
+    return NULL;
+  return (uint8_t *)Variables + offset;
+}
+
+void Flash_Lock(void)
+{
+  OS_SemaphoreWait(AccessSemaphore, 0);
+}
+
+void Flash_Unlock(void)
+{
+  OS_SemaphoreSignal(AccessSemaphore);
+}
+
+bool Flash_Erase_Sector(const uint32_t address)
+{
+  if (address % FLASH_SECTOR_SIZE)
     return false;
-  return WritePhrase(address, phrase);
+
+  OS_SemaphoreWait(AccessSemaphore, 0);
+  bool success = EraseSector(address);
+  OS_SemaphoreSignal(AccessSemaphore);
+  return success;
+}
+
+bool Flash_Write_Phrase(const uint32_t address, const uint64_t data)
+{
+  if (address % FLASH_PHRASE_SIZE)
+    return false;
+  uint64union_t phrase;
+  phrase.l = data;
+
+  OS_SemaphoreWait(AccessSemaphore, 0);
+  bool success = WritePhrase(address, phrase);
+  OS_SemaphoreSignal(AccessSemaphore);
+  return success;
+}
+
+bool Flash_Write_Block(const uint32_t address, const void * const data, const uint32_t length)
+{
+  if (address % FLASH_PHRASE_SIZE || length % FLASH_PHRASE_SIZE)
+    return false;
+
+  OS_SemaphoreWait(AccessSemaphore, 0);
+  bool success = WriteBlock(address, data, length);
+  OS_SemaphoreSignal(AccessSemaphore);
+  return success;
+}
+
+static bool WriteBlock(const uint32_t address, const uint8_t * const bytes, const uint32_t length)
+{
+  bool success = true;
+  for (uint32_t offset = 0; success && offset < length; offset += FLASH_PHRASE_SIZE)
+  {
+    uint64union_t phrase;
+    //the source doesn't have to be aligned
+    memcpy(&phrase, &bytes[offset], sizeof(phrase));
+    success = WritePhrase(address + offset, phrase);
+  }
+  return success;
 }
 
 /*! @brief Private function which writes the phrase when called by Flash_Write32
@@ -40,9 +40,9 @@
  */
 #define _FP(flashAddress)  *(uint64_t volatile *)(flashAddress)//phrase
 /*!
- * The length of the flash
+ * The number of bytes Flash_AllocateVar can hand out
  */
-#define FLASH_SIZE 8
+#define FLASH_SIZE 64
 /*!
  * the command to write a phrase to flash
  */
@@ -62,6 +62,32 @@
 
 #define SECTOR_SIZE 8
 
+/*!
+ * The size of an erasable sector of program flash
+ */
+#define FLASH_SECTOR_SIZE 0x1000LU
+/*!
+ * The size of the smallest unit that can be programmed
+ */
+#define FLASH_PHRASE_SIZE 8
+
+/*!
+ * The variables are kept as a log of records across these sectors, the first sectors of the data flash
+ */
+#define FLASH_LOG_SECTORS 4
+/*!
+ * Marks a log sector header
+ */
+#define FLASH_LOG_MAGIC 0x464C4F47LU
+/*!
+ * The biggest variable a record can hold
+ */
+#define FLASH_RECORD_DATA_SIZE 4
+/*!
+ * The number of queued writes that can be waiting to call back
+ */
+#define FLASH_CALLBACKS_NB 8
+
 
 //all flash commands we'll need
 //0x09 = clear sector
@@ -88,6 +114,34 @@ typedef struct
 	uint64union_t data;
 } TFCCOB;
 
+/*!
+ * @struct TFlashSectorHeader Flash.h
+ * The first phrase of a log sector, the sequence orders the sectors oldest to newest
+ */
+typedef struct
+{
+  uint32_t Magic;
+  uint16_t Sequence;
+  uint16_t CRC;
+} TFlashSectorHeader;
+
+/*!
+ * @struct TFlashRecord Flash.h
+ * One phrase of the log, a new value for a variable
+ */
+typedef struct
+{
+  uint8_t Key;      //offset of the variable
+  uint8_t Length;   //1, 2 or 4
+  uint16_t CRC;     //over everything else in the record
+  uint8_t Data[FLASH_RECORD_DATA_SIZE];
+} TFlashRecord;
+
+/*!
+ * Called by the flash thread once a queued write is in flash, or has failed
+ */
+typedef void (*TFlashCallback)(const uint32_t argument, const bool success);
+
 
 //sector is 64 bits
 
@@ -104,9 +158,9 @@ typedef struct
 #define FLASH_DATA_START 0x00080000LU
 //
 /*!
- * The End address of flash memory
+ * The End address of the variable log, other modules keep their records in the sectors after it
  */
-#define FLASH_DATA_END   0x00080023LU
+#define FLASH_DATA_END   (FLASH_DATA_START + FLASH_LOG_SECTORS * FLASH_SECTOR_SIZE - 1)
 //This is the value of the flash if there is no data.
 /*!
  *	The value of a clear byte of Flash
@@ -119,12 +173,15 @@ typedef struct
 
 /*! @brief Enables the Flash module.
  *
+ *  Replays the variable log into RAM, so every variable reads back its last written value.
  *  @return bool - TRUE if the Flash was setup successfully.
  */
 bool Flash_Init(void);
  
 /*! @brief Allocates space for a non-volatile variable in the Flash memory.
  *
+ *  The pointer is to a RAM copy kept in step with the log, it reads as erased (all 0xFF) until first written.
+ *  Variables must be allocated in the same order on every boot, the offset is how the log finds them.
  *  @param variable is the address of a pointer to a variable that is to be allocated space in Flash memory.
  *         The pointer will be allocated to a relevant address:
  *         If the variable is a byte, then any address.
@@ -165,19 +222,107 @@ bool Flash_Write16(volatile uint16_t* const address, const uint16_t data);
  */
 bool Flash_Write8(volatile uint8_t* const address, const uint8_t data);
 
-/*! @brief Erases the entire Flash sector.
+/*! @brief Queues a write for the flash thread, so the caller doesn't wait on the programming.
+ *
+ *  Writes queued before the thread gets to them are combined, a later value for a byte replaces an earlier one
+ *  and every pending byte of a word goes in the one record.
+ *  The variable keeps its old value until the write is done.
+ *  @param address The address of the variable, aligned to its size.
+ *  @param data The new value, in the low bytes for an 8 or 16-bit variable.
+ *  @param size The size of the variable, 1, 2 or 4.
+ *  @param callback Called from the flash thread once the value is in flash, can be NULL.
+ *  @param argument Passed to the callback.
+ *  @return bool - TRUE if the write was queued, FALSE if the address is bad or too many callbacks are waiting.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Write_Async(volatile void * const address, const uint32_t data, const uint8_t size, const TFlashCallback callback, const uint32_t argument);
+
+/*! @brief Queues an erase of every variable for the flash thread, so the caller doesn't wait on four sector erases.
  *
- *  @return bool - TRUE if the Flash "data" sector was erased successfully.
+ *  Writes still queued are dropped, so none of them can be written back after the erase.
+ *  Writes queued after this go in once the erase is done.
+ *  @param callback Called from the flash thread once the variables are erased, can be NULL.
+ *  @param argument Passed to the callback.
+ *  @return bool - TRUE if the erase was queued, FALSE if too many callbacks are waiting.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Erase_Async(const TFlashCallback callback, const uint32_t argument);
+
+/*! @brief Queues an erase of a sector after the variable log and a block to program into it, for the flash thread.
+ *
+ *  The first phrase of the block is programmed last, so a record that starts with its magic is only valid once the rest is in.
+ *  Only one sector can be waiting at a time.
+ *  @param address The start of the sector, must be aligned to FLASH_SECTOR_SIZE and past FLASH_DATA_END.
+ *  @param data The block, must stay as it is until the callback.
+ *  @param length The number of bytes, a multiple of FLASH_PHRASE_SIZE no bigger than the sector.
+ *  @param callback Called from the flash thread once the sector is written, can be NULL.
+ *  @param argument Passed to the callback.
+ *  @return bool - TRUE if the sector was queued, FALSE if a parameter is bad, another sector is waiting or too many callbacks are.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Write_Sector_Async(const uint32_t address, const void * const data, const uint32_t length, const TFlashCallback callback,
+    const uint32_t argument);
+
+/*! @brief Programs the queued writes, should be just above the idle thread since erases busy wait.
+ *
+ *  @param pData is not used but is required by the OS to create a thread.
+ */
+void Flash_Thread(void *pData);
+
+/*! @brief Erases every variable, and drops any queued writes.
+ *
+ *  @return bool - TRUE if the Flash "data" sectors were erased successfully.
  *  @note Assumes Flash has been initialized.
  */
 bool Flash_Erase(void);
 
-//higher level function that calls erase & write
-/*! @brief Higher level function which calls erase and write.
+/*! @brief Gets the address of a byte of the variables, for reading and writing them by offset.
+ *
+ *  @param offset The offset from the first variable.
+ *  @return volatile uint8_t* - the byte, NULL if the offset is past the end.
+ */
+volatile uint8_t *Flash_Get_Variable(const uint8_t offset);
+
+/*! @brief Holds off every flash command, for modules reading their own records back while another thread could be programming.
+ *
+ *  Reading the block while a command is running on it is a read collision, so the reads go between this and Flash_Unlock.
+ *  @note Don't wait on anything else while holding it, every flash command waits on it.
+ */
+void Flash_Lock(void);
+
+/*! @brief Lets flash commands run again after Flash_Lock.
+ */
+void Flash_Unlock(void);
+
+/*! @brief Erases any sector of the data flash, for modules keeping their own records outside the variable sector.
+ *  @param address The start of the sector, must be aligned to FLASH_SECTOR_SIZE.
+ *  @return bool - TRUE if the sector was erased successfully.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Erase_Sector(const uint32_t address);
+
+/*! @brief Programs a single phrase without erasing first.
+ *  @param address The address of the phrase, must be aligned to FLASH_PHRASE_SIZE and already erased.
+ *  @param data The phrase, as it should read back from memory.
+ *  @return bool - TRUE if the phrase was programmed successfully.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Write_Phrase(const uint32_t address, const uint64_t data);
+
+/*! @brief Programs a block of data, a phrase at a time, without erasing first.
+ *  @param address The start of the block, must be aligned to FLASH_PHRASE_SIZE and already erased.
+ *  @param data The data to program.
+ *  @param length The number of bytes, must be a multiple of FLASH_PHRASE_SIZE.
+ *  @return bool - TRUE if every phrase was programmed successfully.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Flash_Write_Block(const uint32_t address, const void * const data, const uint32_t length);
+
+/*! @brief Appends a record with the new value of a variable, starting a new sector when this one is full.
  *
  *  @return bool returns true if everything has been successfully executed.
  */
-static bool ModifyPhrase(const uint32_t address, const uint64union_t phrase);
+static bool WriteRecord(const uint8_t key, const void * const data, const uint8_t length);
 
 //these following functions call launch command with appropriate params
 //private write phrase which will be called by write32
@@ -187,6 +332,13 @@ static bool ModifyPhrase(const uint32_t address, const uint64union_t phrase);
  */
 static bool WritePhrase(const uint32_t address, const uint64union_t phrase);
 
+/*! @brief Programs a block a phrase at a time, for Flash_Write_Block and the flash thread.
+ *
+ *  @return bool returns true if every phrase was programmed.
+ *  @note Must be called holding AccessSemaphore.
+ */
+static bool WriteBlock(const uint32_t address, const uint8_t * const bytes, const uint32_t length);
+
 //Erase Sector (only 1 sector to erase)
 /*! @brief Private function which erases 1 sector of flash memory
  *
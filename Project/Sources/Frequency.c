@@ -0,0 +1,133 @@
+/*
+ * Frequency.c
+ *
+ *  Created on: 4 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "Frequency.h"
+
+//periods are kept in samples with this many fractional bits
+#define PERIOD_Q 16
+
+//the ISR side, only touched by the PIT ISR
+static int16_t PreviousSample;
+static bool Armed;                  //true once the voltage has gone negative since the last crossing
+static bool HaveCrossing;           //true once the first crossing has been seen, so periods can be measured
+static uint32_t SamplesSinceCrossing;
+static uint32_t CrossingFraction;   //where between its two samples the last crossing was, Q16
+static uint32_t PeriodSum;          //sum of the periods in this average, Q16 samples
+static uint8_t CyclesNb;
+
+//published by the ISR, a single word so the calculate thread always sees a whole value
+static uint32_t volatile AveragePeriod;
+static uint32_t volatile Updates;
+static uint32_t volatile ResetRequest;
+
+//the thread side
+static uint32_t SampleInterval;
+static uint32_t LastUpdates;
+
+bool Frequency_Init(const uint32_t sampleInterval)
+{
+  PreviousSample = 0;
+  Armed = false;
+  HaveCrossing = false;
+  SamplesSinceCrossing = 0;
+  CrossingFraction = 0;
+  PeriodSum = 0;
+  CyclesNb = 0;
+
+  AveragePeriod = 0;
+  Updates = 0;
+  ResetRequest = 0;
+
+  SampleInterval = sampleInterval;
+  LastUpdates = 0;
+  return true;
+}
+
+void Frequency_Set_Interval(const uint32_t sampleInterval)
+{
+  SampleInterval = sampleInterval;
+  //the ISR notices this and starts again at the next crossing
+  ResetRequest++;
+}
+
+void Frequency_Track(const int16_t voltage)
+{
+  static uint32_t resetsSeen;
+
+  if (resetsSeen != ResetRequest)
+  {
+    resetsSeen = ResetRequest;
+    HaveCrossing = false;
+    PeriodSum = 0;
+    CyclesNb = 0;
+  }
+
+  SamplesSinceCrossing++;
+
+  if (voltage < -FREQUENCY_HYSTERESIS)
+    Armed = true;
+
+  if (Armed && PreviousSample < 0 && voltage >= 0)
+  {
+    //straight line between the two samples, crossing is -prev / (voltage - prev) of a sample after the previous one
+    uint32_t fraction = ((uint32_t)(-PreviousSample) << PERIOD_Q) / (uint32_t)(voltage - PreviousSample);
+
+    if (HaveCrossing)
+    {
+      PeriodSum += (SamplesSinceCrossing << PERIOD_Q) + fraction - CrossingFraction;
+      if (++CyclesNb >= FREQUENCY_AVERAGE_CYCLES)
+      {
+        AveragePeriod = PeriodSum / FREQUENCY_AVERAGE_CYCLES;
+        Updates++;
+        PeriodSum = 0;
+        CyclesNb = 0;
+      }
+    }
+
+    HaveCrossing = true;
+    Armed = false;
+    CrossingFraction = fraction;
+    SamplesSinceCrossing = 0;
+  }
+  else if (SamplesSinceCrossing > FREQUENCY_TIMEOUT_SAMPLES)
+  {
+    //no mains, say so and start again when it comes back
+    if (AveragePeriod != 0 || HaveCrossing)
+    {
+      AveragePeriod = 0;
+      Updates++;
+    }
+    HaveCrossing = false;
+    PeriodSum = 0;
+    CyclesNb = 0;
+    SamplesSinceCrossing = 0;
+  }
+
+  PreviousSample = voltage;
+}
+
+bool Frequency_Get(float * const frequency)
+{
+  uint32_t updates = Updates;
+  uint32_t period = AveragePeriod;
+
+  if (updates == LastUpdates)
+    return false;
+  LastUpdates = updates;
+
+  if (period == 0)
+    *frequency = 0;
+  else
+    //f = 1 / (period * interval), with the period in Q16 samples and the interval in ns
+    *frequency = ((float)(1 << PERIOD_Q) * 1e9f) / ((float)period * (float)SampleInterval);
+  return true;
+}
+
+uint32_t Frequency_Get_Period()
+{
+  return AveragePeriod;
+}
@@ -0,0 +1,56 @@
+/*
+ * Frequency.h
+ *
+ *  Created on: 4 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef FREQUENCY_H
+#define FREQUENCY_H
+
+#include "types.h"
+
+//number of mains cycles averaged for each frequency estimate
+#define FREQUENCY_AVERAGE_CYCLES 8
+
+//the voltage has to drop below -FREQUENCY_HYSTERESIS counts before the next rising crossing counts, about 3V at the input
+#define FREQUENCY_HYSTERESIS 100
+
+//if there is no crossing for this many samples the signal is treated as lost
+#define FREQUENCY_TIMEOUT_SAMPLES 4096
+
+/*! @brief Sets up the frequency tracker before first use.
+ *
+ *  @param sampleInterval The time between samples in nanoseconds.
+ *  @return bool - TRUE if the tracker was successfully initialized.
+ */
+bool Frequency_Init(const uint32_t sampleInterval);
+
+/*! @brief Changes the sample interval used to convert periods to a frequency.
+ *
+ *  Any partially averaged period is thrown away, as it was measured at the old rate.
+ *  @param sampleInterval The time between samples in nanoseconds.
+ */
+void Frequency_Set_Interval(const uint32_t sampleInterval);
+
+/*! @brief Looks for a rising zero crossing, interpolating where it happened between the samples.
+ *
+ *  @param voltage The raw voltage sample.
+ *  @note Must be called for every sample, from the PIT ISR.
+ */
+void Frequency_Track(const int16_t voltage);
+
+/*! @brief Gets the latest averaged frequency.
+ *
+ *  @param frequency Where to place the frequency in Hz, 0 if the signal has been lost.
+ *  @return bool - TRUE if there is a new estimate since the last call.
+ */
+bool Frequency_Get(float * const frequency);
+
+/*! @brief Gets the latest averaged period of the mains.
+ *
+ *  @return uint32_t - the period in samples, with 16 fractional bits. 0 if there is no signal.
+ */
+uint32_t Frequency_Get_Period();
+
+#endif
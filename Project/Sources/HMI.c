@@ -112,6 +112,7 @@ void HMI_Output()
   uint8_t days, hours, minutes, seconds, outBuff[256];
   int real, frac;
   float power, energy;
+  double cost;
   switch (DisplayState)
   {
     case METERING_TIME:
@@ -140,8 +141,9 @@ void HMI_Output()
       UART_OutString(outBuff);
       break;
     case TOTAL_COST:
-      real = Basic_Measurements.TotalCost;
-      frac = trunc((Basic_Measurements.TotalCost - real) * 100);
+      cost = Measurements_Get_Cost();
+      real = cost;
+      frac = trunc((cost - real) * 100);
       frac = roundTo3Decimal(frac);
       if (!(real > 9999))
         sprintf(outBuff, "Total Cost: $%d.%02d\n", real, frac);
@@ -0,0 +1,285 @@
+/*
+ * Harmonics.c
+ *
+ *  Created on: 7 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "Harmonics.h"
+#include "Load.h"
+#include "DSP.h"
+#include <math.h>
+
+//samples are shifted up before the FFT so the scaling at each stage doesn't throw away resolution
+#define HARMONICS_INPUT_SHIFT 8
+
+//twiddle factors are Q15
+#define TWIDDLE_Q 15
+
+//the ADC is +-10V over +-32768 counts, and the input conditioning scales voltage by 100
+static const float VOLTS_PER_COUNT = 1000.0f / 32768.0f;
+static const float AMPS_PER_COUNT = 10.0f / 32768.0f;
+
+static const float RADIANS_TO_DEGREES = 180.0f / 3.14159265f;
+
+//cos(2 pi k / HARMONICS_FFT_SIZE), smaller FFTs step through it
+static const int16_t TWIDDLE_COS[HARMONICS_FFT_SIZE / 2] =
+{
+   32767,  32729,  32610,  32413,  32138,  31786,  31357,  30853,
+   30274,  29622,  28899,  28106,  27246,  26320,  25330,  24279,
+   23170,  22006,  20788,  19520,  18205,  16846,  15447,  14010,
+   12540,  11039,   9512,   7962,   6393,   4808,   3212,   1608,
+       0,  -1608,  -3212,  -4808,  -6393,  -7962,  -9512, -11039,
+  -12540, -14010, -15447, -16846, -18205, -19520, -20788, -22006,
+  -23170, -24279, -25330, -26320, -27246, -28106, -28899, -29622,
+  -30274, -30853, -31357, -31786, -32138, -32413, -32610, -32729,
+};
+
+//sin(2 pi k / HARMONICS_FFT_SIZE)
+static const int16_t TWIDDLE_SIN[HARMONICS_FFT_SIZE / 2] =
+{
+       0,   1608,   3212,   4808,   6393,   7962,   9512,  11039,
+   12540,  14010,  15447,  16846,  18205,  19520,  20788,  22006,
+   23170,  24279,  25330,  26320,  27246,  28106,  28899,  29622,
+   30274,  30853,  31357,  31786,  32138,  32413,  32610,  32729,
+   32767,  32729,  32610,  32413,  32138,  31786,  31357,  30853,
+   30274,  29622,  28899,  28106,  27246,  26320,  25330,  24279,
+   23170,  22006,  20788,  19520,  18205,  16846,  15447,  14010,
+   12540,  11039,   9512,   7962,   6393,   4808,   3212,   1608,
+};
+
+OS_ECB *HarmonicsSemaphore;
+
+//the raw capture, word aligned so DSP_Accumulate can load sample pairs
+static int16_t Voltage[HARMONICS_FFT_SIZE] __attribute__ ((aligned(0x04)));
+static int16_t Current[HARMONICS_FFT_SIZE] __attribute__ ((aligned(0x04)));
+
+//the voltage goes in the real part and the current in the imaginary part, so one complex FFT does both channels
+static int32_t Real[HARMONICS_FFT_SIZE];
+static int32_t Imag[HARMONICS_FFT_SIZE];
+
+//the capture, CaptureLength is 0 when the ISR has nothing to do
+static uint16_t volatile CaptureLength;
+static uint16_t CaptureIndex;
+static bool volatile Capturing;
+
+//double buffered so readers never see a half written analysis
+static THarmonics Results[2];
+static THarmonics * volatile Latest;
+static uint32_t Cycles;
+
+bool Harmonics_Init()
+{
+  HarmonicsSemaphore = OS_SemaphoreCreate(0);
+  CaptureLength = 0;
+  CaptureIndex = 0;
+  Capturing = false;
+  Results[0].HarmonicsNb = 0;
+  Latest = &Results[0];
+  Cycles = 0;
+  return true;
+}
+
+bool Harmonics_Start_Capture(const uint16_t samplesPerCycle)
+{
+  //the thread still has the last capture
+  if (Capturing)
+    return false;
+
+  //radix-2 only
+  if (samplesPerCycle < 8 || samplesPerCycle > HARMONICS_FFT_SIZE || (samplesPerCycle & (samplesPerCycle - 1)))
+    return false;
+
+  Capturing = true;
+  CaptureIndex = 0;
+  //the ISR starts filling as soon as it sees the length
+  CaptureLength = samplesPerCycle;
+  return true;
+}
+
+void Harmonics_Add_Sample(const int16_t voltage, const int16_t current)
+{
+  uint16_t length = CaptureLength;
+  if (length == 0)
+    return;
+
+  Voltage[CaptureIndex] = voltage;
+  Current[CaptureIndex] = current;
+
+  if (++CaptureIndex < length)
+    return;
+
+  //hand the buffers over to the thread
+  CaptureLength = 0;
+  OS_SemaphoreSignal(HarmonicsSemaphore);
+}
+
+/*! @brief Works out the rms of the whole cycle for each channel, every harmonic included.
+ *
+ *  @param length The number of samples in the capture.
+ *  @param results Magnitude[0] of each channel is set to the rms.
+ */
+static void CycleRMS(const uint16_t length, THarmonics * const results)
+{
+  TDSPSums sums = {0};
+  DSP_Accumulate(Voltage, Current, length, &sums);
+  results->Channels[HARMONICS_VOLTAGE].Magnitude[0] = sqrtf((float)sums.VoltageSquared / length) * VOLTS_PER_COUNT;
+  results->Channels[HARMONICS_CURRENT].Magnitude[0] = sqrtf((float)sums.CurrentSquared / length) * AMPS_PER_COUNT;
+}
+
+/*! @brief In place radix-2 decimation in time FFT, scaled by 1/2 each stage so the result is X[k] / N.
+ *
+ *  @param length The number of points, a power of two no bigger than HARMONICS_FFT_SIZE.
+ */
+static void FFT(const uint16_t length)
+{
+  //bit reversed reordering
+  for (uint16_t i = 1, j = 0; i < length; i++)
+  {
+    uint16_t bit = length >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j)
+    {
+      int32_t temp = Real[i];
+      Real[i] = Real[j];
+      Real[j] = temp;
+      temp = Imag[i];
+      Imag[i] = Imag[j];
+      Imag[j] = temp;
+    }
+  }
+
+  for (uint16_t size = 2; size <= length; size <<= 1)
+  {
+    uint16_t half = size >> 1;
+    uint16_t stride = HARMONICS_FFT_SIZE / size;
+
+    for (uint16_t start = 0; start < length; start += size)
+    {
+      for (uint16_t k = 0; k < half; k++)
+      {
+        int32_t c = TWIDDLE_COS[k * stride];
+        int32_t s = TWIDDLE_SIN[k * stride];
+        uint16_t a = start + k;
+        uint16_t b = a + half;
+
+        //b * (cos - j sin)
+        int32_t tr = (int32_t)(((int64_t)Real[b] * c + (int64_t)Imag[b] * s) >> TWIDDLE_Q);
+        int32_t ti = (int32_t)(((int64_t)Imag[b] * c - (int64_t)Real[b] * s) >> TWIDDLE_Q);
+
+        Real[b] = (Real[a] - tr) >> 1;
+        Imag[b] = (Imag[a] - ti) >> 1;
+        Real[a] = (Real[a] + tr) >> 1;
+        Imag[a] = (Imag[a] + ti) >> 1;
+      }
+    }
+  }
+}
+
+/*! @brief Wraps an angle in degrees into -180 to 180.
+ *
+ *  @param degrees The angle.
+ *  @return float - the wrapped angle.
+ */
+static float WrapDegrees(float degrees)
+{
+  while (degrees > 180.0f)
+    degrees -= 360.0f;
+  while (degrees <= -180.0f)
+    degrees += 360.0f;
+  return degrees;
+}
+
+/*! @brief Works out the harmonics of both channels from the FFT of a single cycle.
+ *
+ *  @param length The number of points in the FFT.
+ *  @param results Where to put the results.
+ */
+static void Analyse(const uint16_t length, THarmonics * const results)
+{
+  uint8_t harmonicsNb = length / 2 - 1;
+  if (harmonicsNb > HARMONICS_MAX)
+    harmonicsNb = HARMONICS_MAX;
+
+  float fundamentalPhase = 0.0f;
+  float distortion[2] = {0.0f, 0.0f};
+
+  for (uint8_t h = 1; h <= harmonicsNb; h++)
+  {
+    //separate the two real channels, V = (Z[k] + conj(Z[N-k])) / 2 and I = (Z[k] - conj(Z[N-k])) / 2j
+    int32_t zr = Real[h], zi = Imag[h];
+    int32_t nr = Real[length - h], ni = Imag[length - h];
+    float vr = (float)(zr + nr) / 2, vi = (float)(zi - ni) / 2;
+    float ir = (float)(zi + ni) / 2, ii = (float)(nr - zr) / 2;
+
+    //a cosine of amplitude A puts A / 2 in the bin, so the rms is sqrt(2) * |X[k] / N|
+    float scale = 1.41421356f / (1 << HARMONICS_INPUT_SHIFT);
+    float voltage = sqrtf(vr * vr + vi * vi) * scale * VOLTS_PER_COUNT;
+    float current = sqrtf(ir * ir + ii * ii) * scale * AMPS_PER_COUNT;
+    float voltagePhase = atan2f(vi, vr) * RADIANS_TO_DEGREES;
+    float currentPhase = atan2f(ii, ir) * RADIANS_TO_DEGREES;
+
+    //phases are relative to the voltage fundamental, which moves h times as fast at harmonic h
+    if (h == 1)
+      fundamentalPhase = voltagePhase;
+
+    results->Channels[HARMONICS_VOLTAGE].Magnitude[h] = voltage;
+    results->Channels[HARMONICS_VOLTAGE].Phase[h] = WrapDegrees(voltagePhase - h * fundamentalPhase);
+    results->Channels[HARMONICS_CURRENT].Magnitude[h] = current;
+    results->Channels[HARMONICS_CURRENT].Phase[h] = WrapDegrees(currentPhase - h * fundamentalPhase);
+
+    if (h > 1)
+    {
+      distortion[HARMONICS_VOLTAGE] += voltage * voltage;
+      distortion[HARMONICS_CURRENT] += current * current;
+    }
+  }
+
+  for (uint8_t channel = 0; channel < 2; channel++)
+  {
+    float fundamental = results->Channels[channel].Magnitude[1];
+    results->Channels[channel].THD = fundamental > 0 ? sqrtf(distortion[channel]) / fundamental : 0.0f;
+  }
+  results->HarmonicsNb = harmonicsNb;
+}
+
+void Harmonics_Thread(void *pData)
+{
+  for (;;)
+  {
+    OS_SemaphoreWait(HarmonicsSemaphore, 0);
+
+    //the ISR has finished with the buffers, and won't start again until Capturing is cleared
+    uint16_t length = CaptureIndex;
+    uint32_t start = Load_Get_Cycle_Count();
+
+    //fill whichever set isn't the latest, then swap
+    THarmonics *results = (Latest == &Results[0]) ? &Results[1] : &Results[0];
+    CycleRMS(length, results);
+    for (uint16_t i = 0; i < length; i++)
+    {
+      Real[i] = (int32_t)Voltage[i] << HARMONICS_INPUT_SHIFT;
+      Imag[i] = (int32_t)Current[i] << HARMONICS_INPUT_SHIFT;
+    }
+
+    FFT(length);
+    Analyse(length, results);
+    Latest = results;
+
+    Cycles = Load_Get_Cycle_Count() - start;
+    Capturing = false;
+  }
+}
+
+const THarmonics *Harmonics_Get()
+{
+  return Latest;
+}
+
+uint32_t Harmonics_Get_Cycles()
+{
+  return Cycles;
+}
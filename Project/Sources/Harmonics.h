@@ -0,0 +1,79 @@
+/*
+ * Harmonics.h
+ *
+ *  Created on: 7 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef HARMONICS_H
+#define HARMONICS_H
+
+#include "types.h"
+#include "OS.h"
+
+//largest capture, one cycle at MAX_SAMPLES_PER_CYCLE, the twiddle table is built for this size
+#define HARMONICS_FFT_SIZE 128
+
+//highest harmonic reported, lower if the sample rate can't resolve it
+#define HARMONICS_MAX 31
+
+#define HARMONICS_VOLTAGE 0
+#define HARMONICS_CURRENT 1
+
+//the results for one channel
+typedef struct
+{
+  float Magnitude[HARMONICS_MAX + 1]; /*!< RMS of each harmonic in V or A, [0] is the rms of the whole cycle */
+  float Phase[HARMONICS_MAX + 1];     /*!< Phase of each harmonic in degrees, relative to the voltage fundamental */
+  float THD;                          /*!< Total harmonic distortion as a ratio of the fundamental */
+} THarmonicsChannel;
+
+typedef struct
+{
+  THarmonicsChannel Channels[2];      /*!< Indexed by HARMONICS_VOLTAGE and HARMONICS_CURRENT */
+  uint8_t HarmonicsNb;                /*!< The highest harmonic in this analysis, 0 if there hasn't been one */
+} THarmonics;
+
+extern OS_ECB *HarmonicsSemaphore;
+
+/*! @brief Sets up the harmonic analysis before first use.
+ *
+ *  @return bool - TRUE if harmonics was successfully initialized.
+ */
+bool Harmonics_Init();
+
+/*! @brief Asks the PIT ISR to capture the next full cycle of both channels.
+ *
+ *  @param samplesPerCycle The current number of samples in each mains cycle.
+ *  @return bool - TRUE if a capture was started, FALSE if one is still in progress or the rate isn't a power of two.
+ */
+bool Harmonics_Start_Capture(const uint16_t samplesPerCycle);
+
+/*! @brief Adds a sample pair to the capture if one has been asked for.
+ *
+ *  @param voltage The raw voltage sample.
+ *  @param current The raw current sample.
+ *  @note Must only be called from the PIT ISR.
+ */
+void Harmonics_Add_Sample(const int16_t voltage, const int16_t current);
+
+/*! @brief Analyses each capture as it completes.
+ *
+ *  @param pData Unused.
+ *  @note Runs at a low priority, the FFT takes far longer than a sample interval.
+ */
+void Harmonics_Thread(void *pData);
+
+/*! @brief Gets the latest complete analysis.
+ *
+ *  @return const THarmonics * - the results, these are never written to while they are the latest.
+ */
+const THarmonics *Harmonics_Get();
+
+/*! @brief Gets how long the last analysis took.
+ *
+ *  @return uint32_t - the time in core clock cycles.
+ */
+uint32_t Harmonics_Get_Cycles();
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * Load.c
+ *
+ *  Created on: 6 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "Load.h"
+#include "MK70F12.h"
+#include "OS.h"
+
+//not in the IO map, from the ARMv7-M architecture reference manual
+#define DEMCR_TRCENA_MASK 0x01000000
+#define DWT_CTRL_CYCCNTENA_MASK 0x00000001
+
+//written by the ISR, read and cleared by Load_Update with interrupts off
+static uint32_t volatile ISRCycles;
+static uint32_t volatile ISRCount;
+static uint32_t volatile ISRMax;
+
+//free running and only written by the idle thread, so Load_Update never has to clear it
+static uint32_t volatile IdleCycles;
+
+//the results for the last period
+static uint32_t LastUpdate;
+static uint32_t LastIdle;
+static uint8_t CPU;
+static uint32_t LastISRMax;
+static uint32_t LastISRAverage;
+
+bool Load_Init()
+{
+  //the cycle counter is part of the debug unit, it has to be turned on first
+  DEMCR |= DEMCR_TRCENA_MASK;
+  DWT_CYCCNT = 0;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
+  ISRCycles = 0;
+  ISRCount = 0;
+  ISRMax = 0;
+  IdleCycles = 0;
+  LastUpdate = 0;
+  LastIdle = 0;
+  CPU = 0;
+  LastISRMax = 0;
+  LastISRAverage = 0;
+  return true;
+}
+
+uint32_t Load_ISR_Start()
+{
+  return DWT_CYCCNT;
+}
+
+void Load_ISR_End(const uint32_t start)
+{
+  //unsigned subtraction copes with the counter wrapping
+  uint32_t cycles = DWT_CYCCNT - start;
+  ISRCycles += cycles;
+  ISRCount++;
+  if (cycles > ISRMax)
+    ISRMax = cycles;
+}
+
+uint32_t Load_Get_Cycle_Count()
+{
+  return DWT_CYCCNT;
+}
+
+void Load_Idle_Thread(void *pData)
+{
+  uint32_t last = DWT_CYCCNT;
+  for (;;)
+  {
+    uint32_t now = DWT_CYCCNT;
+    uint32_t gap = now - last;
+    //only count the gap if nothing preempted us
+    if (gap < LOAD_IDLE_GAP)
+      IdleCycles += gap;
+    last = now;
+  }
+}
+
+void Load_Update()
+{
+  OS_DisableInterrupts();
+  uint32_t now = DWT_CYCCNT;
+  uint32_t idleCycles = IdleCycles;
+  uint32_t isrCycles = ISRCycles;
+  uint32_t isrCount = ISRCount;
+  uint32_t isrMax = ISRMax;
+  ISRCycles = 0;
+  ISRCount = 0;
+  ISRMax = 0;
+  OS_EnableInterrupts();
+
+  uint32_t elapsed = now - LastUpdate;
+  uint32_t idle = idleCycles - LastIdle;
+  LastUpdate = now;
+  LastIdle = idleCycles;
+
+  if (elapsed > 0 && idle <= elapsed)
+    CPU = 100 - (uint8_t)(((uint64_t)idle * 100) / elapsed);
+  LastISRMax = isrMax;
+  LastISRAverage = isrCount ? isrCycles / isrCount : 0;
+}
+
+uint8_t Load_Get_CPU()
+{
+  return CPU;
+}
+
+uint32_t Load_Get_ISR_Max()
+{
+  return LastISRMax;
+}
+
+uint32_t Load_Get_ISR_Average()
+{
+  return LastISRAverage;
+}
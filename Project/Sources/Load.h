@@ -0,0 +1,79 @@
+/*
+ * Load.h
+ *
+ *  Created on: 6 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include "types.h"
+
+//the sampling ISR may take this percentage of a sample interval before the sample rate is decimated
+#define LOAD_ISR_BUDGET_PERCENT 50
+
+//a decimated rate is doubled again once the ISR has stayed under this percentage for this many seconds in a row
+//doubling the rate halves the interval, so this has to be well under half the budget or the rate would just flip back
+#define LOAD_ISR_RECOVER_PERCENT 20
+#define LOAD_RECOVER_SECONDS 10
+
+//a gap longer than this many cycles between two idle thread reads means something else ran in between
+#define LOAD_IDLE_GAP 64
+
+/*! @brief Starts the cycle counter used for all the timing.
+ *
+ *  @return bool - TRUE if the load monitor was successfully initialized.
+ */
+bool Load_Init();
+
+/*! @brief Marks the start of the sampling ISR.
+ *
+ *  @return uint32_t - the cycle count to hand back to Load_ISR_End.
+ */
+uint32_t Load_ISR_Start();
+
+/*! @brief Marks the end of the sampling ISR and records how long it took.
+ *
+ *  @param start The cycle count returned by Load_ISR_Start.
+ */
+void Load_ISR_End(const uint32_t start);
+
+/*! @brief Gets the free running core cycle count, for timing anything else.
+ *
+ *  @return uint32_t - the cycle count, wraps every 2^32 cycles.
+ */
+uint32_t Load_Get_Cycle_Count();
+
+/*! @brief Counts the cycles that no other thread or interrupt wants.
+ *
+ *  @param pData Unused.
+ *  @note Must be created at a lower priority than every other thread, it never blocks.
+ */
+void Load_Idle_Thread(void *pData);
+
+/*! @brief Works out the utilisation and ISR times for the period since the last update.
+ *
+ *  @note Called once a second by the RTC thread.
+ */
+void Load_Update();
+
+/*! @brief Gets the CPU utilisation over the last period.
+ *
+ *  @return uint8_t - the percentage of time not spent idle.
+ */
+uint8_t Load_Get_CPU();
+
+/*! @brief Gets the longest sampling ISR over the last period.
+ *
+ *  @return uint32_t - the time in core clock cycles.
+ */
+uint32_t Load_Get_ISR_Max();
+
+/*! @brief Gets the average sampling ISR over the last period.
+ *
+ *  @return uint32_t - the time in core clock cycles.
+ */
+uint32_t Load_Get_ISR_Average();
+
+#endif
@@ -0,0 +1,510 @@
+/*
+ * LoadProfile.c
+ *
+ *  Created on: 11 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "LoadProfile.h"
+#include "Measurements.h"
+#include "SelfTest.h"
+#include "RTC.h"
+#include "CRC.h"
+#include "OS.h"
+#include <stddef.h>
+#include <string.h>
+
+/*!
+ * The start of a log sector
+ */
+#define PROFILE_SECTOR(sector) (LOADPROFILE_START + (sector) * FLASH_SECTOR_SIZE)
+/*!
+ * The header of a log sector
+ */
+#define PROFILE_HEADER(sector) ((const TFlashSectorHeader *)PROFILE_SECTOR(sector))
+
+//what a keyframe is a delta from
+static const TProfileRecord ZERO_RECORD;
+
+//the log sectors belong to either the load profile thread or a reader
+static OS_ECB *LogSemaphore;
+
+//signalled by the RTC thread when an interval's record is ready
+static OS_ECB *RecordSemaphore;
+
+//the interval asked for, and the one the RTC thread is using, minutes
+static uint8_t volatile Interval;
+static uint8_t TickInterval;
+
+//the interval being added up, only used by the RTC thread
+static uint32_t IntervalNb;   //RTC seconds divided by the interval length
+static uint32_t SecondsNb;
+static float VoltageSum;
+static float CurrentSum;
+static float FrequencySum;
+static uint64_t ImportStart;  //the registers at the start of the interval, Wh
+static uint64_t ExportStart;
+
+//the last finished interval, written by the RTC thread and read by the load profile thread with interrupts off
+static TProfileRecord Ready;
+
+//the sector being appended to, the next phrase to program and the bytes waiting to fill it
+static uint8_t ActiveSector;
+static uint16_t ActiveSequence;
+static uint32_t WriteAddress;
+static uint8_t Buffer[FLASH_PHRASE_SIZE];
+static uint8_t BufferNb;
+
+//the record the next one is a delta from, unless it has to be a keyframe
+static TProfileRecord Last;
+static bool NeedKeyframe;
+
+/*! @brief Checks the interval divides an hour, so intervals always start on the hour.
+ *
+ *  @return bool - TRUE if the interval can be used.
+ */
+static bool IntervalValid(const uint8_t interval)
+{
+  return interval >= 1 && interval <= 60 && (60 % interval) == 0;
+}
+
+/*! @brief Works out the CRC of a sector header.
+ *
+ *  @return uint16_t - the CRC.
+ */
+static uint16_t HeaderCRC(const TFlashSectorHeader * const header)
+{
+  return CRC_16(header, offsetof(TFlashSectorHeader, CRC), CRC16_INITIAL);
+}
+
+/*! @brief Checks a log sector has been started.
+ *
+ *  @return bool - TRUE if the sector has a good header.
+ */
+static bool SectorValid(const uint8_t sector)
+{
+  const TFlashSectorHeader *header = PROFILE_HEADER(sector);
+  return header->Magic == LOADPROFILE_MAGIC && header->CRC == HeaderCRC(header);
+}
+
+/*! @brief Gets a byte of the log, including the bytes still waiting for a whole phrase.
+ *
+ *  @return uint8_t - the byte.
+ */
+static uint8_t ReadByte(const uint32_t address)
+{
+  if (address >= WriteAddress && address < WriteAddress + BufferNb)
+    return Buffer[address - WriteAddress];
+  return _FB(address);
+}
+
+/*! @brief Writes a value 7 bits at a time, low bits first, with the top bit set on every byte but the last.
+ *
+ *  @return uint8_t - the number of bytes written.
+ */
+static uint8_t PutVarint(uint8_t * const bytes, uint32_t value)
+{
+  uint8_t length = 0;
+  while (value >= 0x80)
+  {
+    bytes[length++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  bytes[length++] = value;
+  return length;
+}
+
+/*! @brief Reads a value written by PutVarint.
+ *
+ *  @return bool - TRUE if the value ended before the end of the bytes.
+ */
+static bool GetVarint(const uint8_t * const bytes, const uint8_t length, uint8_t * const position, uint32_t * const value)
+{
+  *value = 0;
+  for (uint8_t shift = 0; *position < length && shift < 32; shift += 7)
+  {
+    uint8_t byte = bytes[(*position)++];
+    *value |= (uint32_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/*! @brief Maps a signed delta to unsigned so small changes either way stay small, 0, -1, 1, -2 becomes 0, 1, 2, 3.
+ *
+ *  @return uint32_t - the zigzag value.
+ */
+static uint32_t Zigzag(const int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+/*! @brief Undoes Zigzag.
+ *
+ *  @return int32_t - the signed value.
+ */
+static int32_t Unzigzag(const uint32_t value)
+{
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/*! @brief Encodes a record as a header byte, the fields and a CRC-8.
+ *
+ *  The energies are already per interval so they're written as they are, everything else is a delta from the last record,
+ *  or from zero for a keyframe.
+ *  @return uint8_t - the length of the encoded record.
+ */
+static uint8_t Encode(const TProfileRecord * const record, const bool keyframe, uint8_t bytes[LOADPROFILE_RECORD_MAX])
+{
+  const TProfileRecord *base = keyframe ? &ZERO_RECORD : &Last;
+
+  uint8_t length = 1;
+  length += PutVarint(&bytes[length], Zigzag(record->Time - base->Time));
+  length += PutVarint(&bytes[length], record->ImportEnergy);
+  length += PutVarint(&bytes[length], record->ExportEnergy);
+  length += PutVarint(&bytes[length], Zigzag(record->AveragePower - base->AveragePower));
+  length += PutVarint(&bytes[length], Zigzag(record->Voltage - base->Voltage));
+  length += PutVarint(&bytes[length], Zigzag(record->Current - base->Current));
+  length += PutVarint(&bytes[length], Zigzag(record->Frequency - base->Frequency));
+
+  bytes[0] = (keyframe ? LOADPROFILE_KEYFRAME : 0) | (length - 1);
+  bytes[length] = CRC_8(bytes, length, CRC8_INITIAL);
+  return length + 1;
+}
+
+/*! @brief Decodes a record written by Encode.
+ *
+ *  @return bool - TRUE if the fields filled the record exactly.
+ */
+static bool Decode(const uint8_t * const bytes, const TProfileRecord * const base, TProfileRecord * const record)
+{
+  uint8_t length = (bytes[0] & LOADPROFILE_LENGTH_MASK) + 1;
+  uint8_t position = 1;
+  uint32_t fields[7];
+  for (uint8_t field = 0; field < 7; field++)
+    if (!GetVarint(bytes, length, &position, &fields[field]))
+      return false;
+
+  record->Time = base->Time + Unzigzag(fields[0]);
+  record->ImportEnergy = fields[1];
+  record->ExportEnergy = fields[2];
+  record->AveragePower = base->AveragePower + Unzigzag(fields[3]);
+  record->Voltage = base->Voltage + Unzigzag(fields[4]);
+  record->Current = base->Current + Unzigzag(fields[5]);
+  record->Frequency = base->Frequency + Unzigzag(fields[6]);
+  return position == length;
+}
+
+/*! @brief Makes an erased sector the one records are appended to.
+ *
+ *  @return bool - TRUE if the header was programmed.
+ */
+static bool StartSector(const uint8_t sector, const uint16_t sequence)
+{
+  TFlashSectorHeader header = {.Magic = LOADPROFILE_MAGIC, .Sequence = sequence};
+  header.CRC = HeaderCRC(&header);
+
+  uint64_t phrase;
+  memcpy(&phrase, &header, sizeof(phrase));
+  if (!Flash_Write_Phrase(PROFILE_SECTOR(sector), phrase))
+    return false;
+
+  ActiveSector = sector;
+  ActiveSequence = sequence;
+  WriteAddress = PROFILE_SECTOR(sector) + FLASH_PHRASE_SIZE;
+  BufferNb = 0;
+  NeedKeyframe = true;
+  return true;
+}
+
+/*! @brief Moves on to the next sector, which is the oldest, the only erase the log ever does.
+ *
+ *  @return bool - TRUE if the new sector was started.
+ */
+static bool NextSector()
+{
+  uint8_t sector = (ActiveSector + 1) % LOADPROFILE_SECTORS;
+  return Flash_Erase_Sector(PROFILE_SECTOR(sector)) && StartSector(sector, ActiveSequence + 1);
+}
+
+/*! @brief Adds a byte to the phrase being filled, programming it once it's full.
+ *
+ *  @return bool - TRUE if the phrase didn't need programming or was programmed.
+ */
+static bool PutByte(const uint8_t byte)
+{
+  Buffer[BufferNb++] = byte;
+  if (BufferNb < FLASH_PHRASE_SIZE)
+    return true;
+
+  uint64_t phrase;
+  memcpy(&phrase, Buffer, sizeof(phrase));
+  uint32_t address = WriteAddress;
+  WriteAddress += FLASH_PHRASE_SIZE;
+  BufferNb = 0;
+  return Flash_Write_Phrase(address, phrase);
+}
+
+/*! @brief Encodes a record onto the end of the log.
+ *
+ *  @return bool - TRUE if the record was appended.
+ */
+static bool Append(const TProfileRecord * const record)
+{
+  uint8_t bytes[LOADPROFILE_RECORD_MAX];
+  uint8_t length = Encode(record, NeedKeyframe, bytes);
+
+  //records don't cross sectors, what's left of this one is padded and every sector starts with a keyframe
+  if (WriteAddress + BufferNb + length > PROFILE_SECTOR(ActiveSector + 1))
+  {
+    while (BufferNb)
+      PutByte(LOADPROFILE_PADDING);
+    if (!NextSector())
+      return false;
+    length = Encode(record, true, bytes);
+  }
+
+  bool success = true;
+  for (uint8_t i = 0; i < length; i++)
+    success = PutByte(bytes[i]) && success;
+
+  //a bad phrase can't be fixed, so start again from the next phrase like after a reset
+  if (!success)
+  {
+    while (BufferNb)
+      PutByte(LOADPROFILE_PADDING);
+    NeedKeyframe = true;
+    return false;
+  }
+
+  Last = *record;
+  NeedKeyframe = false;
+  return true;
+}
+
+/*! @brief Starts adding up a new interval.
+ */
+static void StartInterval(const uint32_t intervalNb)
+{
+  IntervalNb = intervalNb;
+  SecondsNb = 0;
+  VoltageSum = 0.0f;
+  CurrentSum = 0.0f;
+  FrequencySum = 0.0f;
+
+  //whole Wh of the registers, so the records always add up to the registers
+  ImportStart = Basic_Measurements.TotalEnergy * 1000.0;
+  ExportStart = Basic_Measurements.ExportEnergy * 1000.0;
+}
+
+/*! @brief Works out the record for the interval and hands it to the load profile thread.
+ */
+static void FinishInterval()
+{
+  uint32_t intervalSeconds = TickInterval * 60;
+  uint64_t importEnd = Basic_Measurements.TotalEnergy * 1000.0;
+  uint64_t exportEnd = Basic_Measurements.ExportEnergy * 1000.0;
+
+  TProfileRecord record;
+  record.Time = (IntervalNb + 1) * intervalSeconds;
+  record.ImportEnergy = importEnd - ImportStart;
+  record.ExportEnergy = exportEnd - ExportStart;
+  //Wh over the seconds actually metered, which is short for the first interval after a reset
+  record.AveragePower = ((int64_t)record.ImportEnergy - (int64_t)record.ExportEnergy) * 3600 / (int64_t)SecondsNb;
+  record.Voltage = VoltageSum * 10.0f / SecondsNb + 0.5f;
+  record.Current = CurrentSum * 1000.0f / SecondsNb + 0.5f;
+  record.Frequency = FrequencySum * 1000.0f / SecondsNb + 0.5f;
+
+  Ready = record;
+  OS_SemaphoreSignal(RecordSemaphore);
+}
+
+bool LoadProfile_Init()
+{
+  //only the first time, this is retried until everything initialises
+  if (!LogSemaphore)
+  {
+    LogSemaphore = OS_SemaphoreCreate(1);
+    RecordSemaphore = OS_SemaphoreCreate(0);
+  }
+
+  Interval = LOADPROFILE_DEFAULT_INTERVAL;
+  TickInterval = LOADPROFILE_DEFAULT_INTERVAL;
+  uint32_t seconds;
+  RTC_Get_Raw_Seconds(&seconds);
+  StartInterval(seconds / (TickInterval * 60));
+
+  //the newest sector, allowing for the sequence wrapping
+  int8_t newest = -1;
+  for (uint8_t sector = 0; sector < LOADPROFILE_SECTORS; sector++)
+    if (SectorValid(sector)
+        && (newest < 0 || (int16_t)(PROFILE_HEADER(sector)->Sequence - PROFILE_HEADER(newest)->Sequence) > 0))
+      newest = sector;
+
+  //nothing logged yet
+  if (newest < 0)
+    return Flash_Erase_Sector(PROFILE_SECTOR(0)) && StartSector(0, 0);
+
+  ActiveSector = newest;
+  ActiveSequence = PROFILE_HEADER(newest)->Sequence;
+  BufferNb = 0;
+
+  //the bytes that were waiting for a whole phrase are lost, so carry on after the last programmed phrase with a keyframe
+  WriteAddress = PROFILE_SECTOR(newest) + FLASH_PHRASE_SIZE;
+  while (WriteAddress < PROFILE_SECTOR(newest + 1) && _FP(WriteAddress) != UINT64_MAX)
+    WriteAddress += FLASH_PHRASE_SIZE;
+  NeedKeyframe = true;
+  return true;
+}
+
+bool LoadProfile_Set_Interval(const uint8_t interval)
+{
+  if (!IntervalValid(interval))
+    return false;
+  Interval = interval;
+  return true;
+}
+
+uint8_t LoadProfile_Get_Interval()
+{
+  return Interval;
+}
+
+void LoadProfile_Tick()
+{
+  uint32_t seconds;
+  RTC_Get_Raw_Seconds(&seconds);
+
+  //a new interval length finishes the interval in progress early
+  uint8_t interval = Interval;
+  uint32_t intervalNb = seconds / (interval * 60);
+  if (interval != TickInterval || intervalNb != IntervalNb)
+  {
+    if (SecondsNb)
+      FinishInterval();
+    TickInterval = interval;
+    StartInterval(intervalNb);
+  }
+
+  //the simulated readings aren't worth keeping, the interval starts again once the self test is over
+  if (IsSelfTesting)
+  {
+    StartInterval(intervalNb);
+    return;
+  }
+
+  VoltageSum += Intermediate_Measurements.RMSVoltage;
+  CurrentSum += Intermediate_Measurements.RMSCurrent;
+  FrequencySum += Intermediate_Measurements.Frequency;
+  SecondsNb++;
+}
+
+void LoadProfile_Thread(void *pData)
+{
+  for (;;)
+  {
+    OS_SemaphoreWait(RecordSemaphore, 0);
+
+    OS_DisableInterrupts();
+    TProfileRecord record = Ready;
+    OS_EnableInterrupts();
+
+    OS_SemaphoreWait(LogSemaphore, 0);
+    Append(&record);
+    OS_SemaphoreSignal(LogSemaphore);
+  }
+}
+
+/*! @brief Checks a whole phrase is erased.
+ *
+ *  @return bool - TRUE if nothing has been programmed there.
+ */
+static bool PhraseErased(const uint32_t address)
+{
+  for (uint8_t i = 0; i < FLASH_PHRASE_SIZE; i++)
+    if (ReadByte(address + i) != LOADPROFILE_ERASED)
+      return false;
+  return true;
+}
+
+/*! @brief Decodes a sector, passing on the records in the range.
+ *
+ *  @return uint16_t - the number of records in the range.
+ *  @note Must be called holding the flash lock, it's let go while the callback runs.
+ */
+static uint16_t ReadSector(const uint8_t sector, const uint32_t from, const uint32_t to, void (*callback)(const TProfileRecord * const record))
+{
+  uint32_t address = PROFILE_SECTOR(sector) + FLASH_PHRASE_SIZE;
+  uint32_t end = (sector == ActiveSector) ? WriteAddress + BufferNb : PROFILE_SECTOR(sector + 1);
+  TProfileRecord last = ZERO_RECORD;
+  bool synced = false;
+  uint16_t count = 0;
+
+  while (address < end)
+  {
+    uint8_t header = ReadByte(address);
+
+    //in step a record never starts with an erased byte, out of step it could be part of a varint
+    if ((synced && header == LOADPROFILE_ERASED) || (!synced && !(address % FLASH_PHRASE_SIZE) && PhraseErased(address)))
+      break;
+
+    if (synced && header == LOADPROFILE_PADDING)
+    {
+      address++;
+      continue;
+    }
+
+    uint8_t length = (header & LOADPROFILE_LENGTH_MASK) + 2;
+    if (length <= LOADPROFILE_RECORD_MAX && address + length <= end && (synced || (header & LOADPROFILE_KEYFRAME)))
+    {
+      uint8_t bytes[LOADPROFILE_RECORD_MAX];
+      for (uint8_t i = 0; i < length; i++)
+        bytes[i] = ReadByte(address + i);
+
+      TProfileRecord record;
+      if (CRC_8(bytes, length - 1, CRC8_INITIAL) == bytes[length - 1]
+          && Decode(bytes, (header & LOADPROFILE_KEYFRAME) ? &ZERO_RECORD : &last, &record))
+      {
+        if (record.Time >= from && record.Time <= to)
+        {
+          //the callback waits on the UART, flash commands shouldn't wait on it too
+          Flash_Unlock();
+          callback(&record);
+          Flash_Lock();
+          count++;
+        }
+        last = record;
+        synced = true;
+        address += length;
+        continue;
+      }
+    }
+
+    //a record cut short by a reset, the writer started again at a phrase with a keyframe
+    synced = false;
+    address = (address / FLASH_PHRASE_SIZE + 1) * FLASH_PHRASE_SIZE;
+  }
+  return count;
+}
+
+uint16_t LoadProfile_Read(const uint32_t from, const uint32_t to, void (*callback)(const TProfileRecord * const record))
+{
+  uint16_t count = 0;
+  OS_SemaphoreWait(LogSemaphore, 0);
+
+  //the log semaphore only keeps the writer out, the flash thread and checkpoints can still be programming the block
+  Flash_Lock();
+
+  //the sectors are used in turn, so the one after the active sector is the oldest
+  for (uint8_t i = 1; i <= LOADPROFILE_SECTORS; i++)
+  {
+    uint8_t sector = (ActiveSector + i) % LOADPROFILE_SECTORS;
+    if (SectorValid(sector))
+      count += ReadSector(sector, from, to, callback);
+  }
+
+  Flash_Unlock();
+  OS_SemaphoreSignal(LogSemaphore);
+  return count;
+}
@@ -0,0 +1,88 @@
+/*
+ * LoadProfile.h
+ *
+ *  Created on: 11 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef LOADPROFILE_H
+#define LOADPROFILE_H
+
+#include "types.h"
+#include "Flash.h"
+#include "Checkpoint.h"
+
+//the log is kept in the sectors after the checkpoint banks, used in turn, about 3 months of 15 minute intervals
+#define LOADPROFILE_START (CHECKPOINT_BANK_B + FLASH_SECTOR_SIZE)
+#define LOADPROFILE_SECTORS 32
+
+//"LPR" and the record format version, a sector with any other magic is ignored
+#define LOADPROFILE_MAGIC 0x4C505201
+
+//the interval in minutes, must divide an hour
+#define LOADPROFILE_DEFAULT_INTERVAL 15
+
+//the first byte of a record, the length of the fields after it and whether they're deltas
+#define LOADPROFILE_KEYFRAME 0x80
+#define LOADPROFILE_LENGTH_MASK 0x7F
+#define LOADPROFILE_PADDING 0x00
+#define LOADPROFILE_ERASED 0xFF
+
+//a header byte, 7 varints at most 5 bytes each and the CRC-8
+#define LOADPROFILE_RECORD_MAX 37
+
+typedef struct
+{
+  uint32_t Time;          //RTC seconds at the end of the interval
+  uint32_t ImportEnergy;  //Wh
+  uint32_t ExportEnergy;  //Wh
+  int32_t AveragePower;   //W, negative when exporting
+  uint16_t Voltage;       //average Vrms, 0.1 V
+  uint16_t Current;       //average Irms, mA
+  uint16_t Frequency;     //average, mHz
+} TProfileRecord;
+
+/*! @brief Finds the end of the log and starts the first interval at the default length.
+ *
+ *  @return bool - TRUE if the load profile was successfully initialized.
+ *  @note Assumes Flash has been initialized.
+ */
+bool LoadProfile_Init();
+
+/*! @brief Sets the interval, the interval in progress is recorded and a new one starts on the next tick.
+ *
+ *  @param interval The interval in minutes, 1 to 60 and must divide an hour.
+ *  @return bool - TRUE if the interval was valid and applied.
+ */
+bool LoadProfile_Set_Interval(const uint8_t interval);
+
+/*! @brief Gets the interval.
+ *
+ *  @return uint8_t - the interval in minutes.
+ */
+uint8_t LoadProfile_Get_Interval();
+
+/*! @brief Adds this second's readings to the interval, and hands the record to the load profile thread at the end of it.
+ *
+ *  @note Called once a second by the RTC thread.
+ */
+void LoadProfile_Tick();
+
+/*! @brief Appends the records handed over by LoadProfile_Tick to the log.
+ *
+ *  @param pData Unused.
+ *  @note Erases busy wait, so it should be below the measurement and protocol threads.
+ */
+void LoadProfile_Thread(void *pData);
+
+/*! @brief Reads back every record in a time range, oldest first.
+ *
+ *  @param from The start of the range, RTC seconds.
+ *  @param to The end of the range, RTC seconds, inclusive.
+ *  @param callback Called with each record in the range.
+ *  @return uint16_t - the number of records in the range.
+ *  @note The log can't be appended to until this returns.
+ */
+uint16_t LoadProfile_Read(const uint32_t from, const uint32_t to, void (*callback)(const TProfileRecord * const record));
+
+#endif
@@ -12,181 +12,546 @@
 #include "main.h"
 #include "SelfTest.h"
 #include "main.h"
-#include "Constants.h"
+#include "Tarrifs.h"
 #include <math.h>
 #include "RTC.h"
+#include "FixedPoint.h"
+#include "DSP.h"
+#include "Frequency.h"
+#include "PLL.h"
+#include "PIT.h"
+#include "Load.h"
+#include "Cpu.h"
+#include "Demand.h"
+#include "Telemetry.h"
 
 static const double PI = 3.14159265358979323846;
 
-TSample Samples;
+//The ADC is +-10V over +-32768 counts, so one count is 10/32768 of the input.
+//The input conditioning scales voltage up by 100, so a voltage count is 1000/32768 V and a current count is 10/32768 A.
+//Both are exact in Q24.
+static const Fixed32Q24 VOLTAGE_PER_COUNT = FIXED_Q24(512000);
+static const Fixed32Q24 CURRENT_PER_COUNT = FIXED_Q24(5120);
+
+//number of fractional bits kept in the RMS and power results before they are converted to floats
+#define MEASUREMENT_Q 16
+
+//window energy is worked out in W.ns with MEASUREMENT_Q fractional bits, this many of those make a uWh
+static const uint64_t ENERGY_PER_UWH = 3600000ULL << MEASUREMENT_Q;
+
+//energy left over from previous windows that hasn't made a whole uWh yet
+static uint64_t BillingResidual;
+
+//odd while the calculate thread is updating the registers, see Measurements_Get_Snapshot
+static uint32_t volatile UpdateSequence;
+
+/*!
+ * Keeps the compiler from moving register accesses across the sequence count, or sample frame reads past handing the frame back
+ */
+#define MEASUREMENTS_BARRIER() __asm volatile ("" : : : "memory")
+
+
+TSampleFrames Samples;
 TMeasurementsBasic Basic_Measurements;
 TMeasurementsIntermediate Intermediate_Measurements;
 
 OS_ECB *CalculateSemaphore;
 
-float GetTimeofUseTariff();
+//number of samples accumulated into the frame being filled, only touched by the PIT ISR
+static uint16_t WindowSamplesNb;
 
-double CalculateCost(double periodEnergy, uint8_t tariffIndex);
+//the runtime settings, the ISR reads WindowLength once per sample
+static uint16_t volatile WindowLength;
+static uint8_t WindowSetting;
+static uint16_t SamplesPerCycle;
+static uint8_t Decimation;        //how many times the rate has been halved to stay within the ISR budget
+static uint8_t volatile QuarterCycle; //samples in a quarter of a mains cycle, the reactive power delay
 
 float MaxVoltage(float array[], int length);
 int MaxVoltageIndex(float array[], int length);
 
 bool Measurements_Init()
 {
-  Samples.SamplesNb = 0;
+  WindowSamplesNb = 0;
+  Samples.Head = 0;
+  Samples.Tail = 0;
+  Samples.Overruns = 0;
   Samples.SamplesRawNb = 0;
 
   uint32_t seconds;
   RTC_Get_Raw_Seconds(&seconds);
 
   Basic_Measurements.AveragePower = 0.0f;
-  Basic_Measurements.TotalCost = 0.0f;
+  for (uint8_t tariff = 0; tariff < TARIFFS_NB; tariff++)
+    for (uint8_t reg = 0; reg < TARIFF_REGISTERS_NB; reg++)
+      Basic_Measurements.BillingEnergy[tariff][reg] = 0;
+  BillingResidual = 0;
+  UpdateSequence = 0;
   Basic_Measurements.TotalEnergy = 0.0f;
   Basic_Measurements.MeteringTime = 0;
+  Basic_Measurements.ExportEnergy = 0.0;
+  Basic_Measurements.ImportReactiveEnergy = 0.0;
+  Basic_Measurements.ExportReactiveEnergy = 0.0;
   Basic_Measurements.Time = seconds;
 
   Intermediate_Measurements.Frequency = 0.0f;
   Intermediate_Measurements.RMSVoltage = 0.0f;
   Intermediate_Measurements.RMSCurrent = 0.0f;
+  Intermediate_Measurements.ApparentPower = 0.0f;
+  Intermediate_Measurements.ReactivePower = 0.0f;
+  Intermediate_Measurements.DisplacementPowerFactor = 0.0f;
   Intermediate_Measurements.PowerFactor = 0.0f;
 
 
   CalculateSemaphore = OS_SemaphoreCreate(0);
 
+  //flash isn't allocated yet, start on the defaults until the saved settings are applied
+  SamplesPerCycle = ANALOG_SAMPLES_PER_CYCLE;
+  QuarterCycle = ANALOG_SAMPLES_PER_CYCLE / 4;
+  Decimation = 1;
+  WindowSetting = DEFAULT_WINDOW;
+  WindowLength = DEFAULT_WINDOW;
+
+  uint32_t interval = MAINS_NOMINAL_PERIOD / ANALOG_SAMPLES_PER_CYCLE;
+  return Frequency_Init(interval) && PLL_Init(interval, ANALOG_SAMPLES_PER_CYCLE);
+}
+
+/*! @brief Works out the window length in samples for a window setting at the current sample rate.
+ *
+ *  @param setting The window setting.
+ *  @return uint16_t - the number of samples, 0 if the setting is invalid.
+ */
+static uint16_t WindowSamples(const uint8_t setting)
+{
+  uint16_t count = setting & WINDOW_COUNT_MASK;
+  if (setting & WINDOW_IN_CYCLES)
+    return count * SamplesPerCycle;
+  return count;
+}
+
+bool Measurements_Set_Window(const uint8_t setting)
+{
+  uint16_t length = WindowSamples(setting);
+  if (length == 0)
+    return false;
+
+  WindowSetting = setting;
+  //a single halfword store, the ISR sees either the old or the new length
+  WindowLength = length;
+  return true;
+}
+
+uint8_t Measurements_Get_Window()
+{
+  return WindowSetting;
+}
+
+/*! @brief Moves the PIT, the frequency tracker and the PLL over to a new rate.
+ *
+ *  @param samplesPerCycle The number of samples in each nominal mains cycle.
+ */
+static void ApplySamplesPerCycle(const uint16_t samplesPerCycle)
+{
+  uint32_t interval = MAINS_NOMINAL_PERIOD / samplesPerCycle;
+
+  //the calculate thread retunes the PLL too, so it must not run until all of this is consistent
+  OS_DisableInterrupts();
+  SamplesPerCycle = samplesPerCycle;
+  //rounded to the nearest sample when the rate isn't a multiple of 4
+  QuarterCycle = (samplesPerCycle + 2) / 4;
+  WindowLength = WindowSamples(WindowSetting);
+  PLL_Init(interval, samplesPerCycle);
+  Frequency_Set_Interval(interval);
+  PIT_Set(interval, false);
+  OS_EnableInterrupts();
+}
+
+bool Measurements_Set_Samples_Per_Cycle(const uint16_t samplesPerCycle)
+{
+  if (samplesPerCycle < MIN_SAMPLES_PER_CYCLE || samplesPerCycle > MAX_SAMPLES_PER_CYCLE)
+    return false;
+
+  //a new rate gets a fresh chance at running undecimated
+  Decimation = 1;
+  ApplySamplesPerCycle(samplesPerCycle);
   return true;
 }
 
+uint8_t Measurements_Get_Decimation()
+{
+  return Decimation;
+}
+
+void Measurements_Check_Load()
+{
+  static uint32_t overrunsSeen;
+  static uint8_t quietSeconds;  //seconds in a row the ISR has been well under budget
+
+  //the interval in core clock cycles, and the ISR budget for it
+  uint32_t intervalCycles = (uint32_t)((uint64_t)PLL_Get_Interval() * (CPU_CORE_CLK_HZ / 1000000) / 1000);
+  uint32_t budget = intervalCycles * LOAD_ISR_BUDGET_PERCENT / 100;
+  uint32_t overruns = Samples.Overruns;
+  bool overrun = (overruns != overrunsSeen);
+  overrunsSeen = overruns;
+  uint32_t isrMax = Load_Get_ISR_Max();
+
+  if (isrMax > budget || overrun)
+  {
+    quietSeconds = 0;
+    //halve the rate rather than let the PIT or the calculate thread quietly lose samples
+    if (SamplesPerCycle / 2 < MIN_SAMPLES_PER_CYCLE)
+      return;
+    Decimation *= 2;
+    ApplySamplesPerCycle(SamplesPerCycle / 2);
+    return;
+  }
+
+  //a single long ISR or overrun shouldn't cost the rate for good, so step back up once it has been quiet for a while
+  if (Decimation == 1 || isrMax > intervalCycles * LOAD_ISR_RECOVER_PERCENT / 100)
+  {
+    quietSeconds = 0;
+    return;
+  }
+  if (++quietSeconds < LOAD_RECOVER_SECONDS)
+    return;
+
+  quietSeconds = 0;
+  Decimation /= 2;
+  ApplySamplesPerCycle(SamplesPerCycle * 2);
+}
+
+uint16_t Measurements_Get_Samples_Per_Cycle()
+{
+  return SamplesPerCycle;
+}
+
+/*! @brief Divides a window sum by the number of samples in the window.
+ *
+ *  A 64 bit divide is a library call on the M4, so the usual power of two windows are done with a shift.
+ *  @param sum The window sum.
+ *  @param samplesNb The number of samples in the window.
+ *  @return uint64_t - the mean.
+ */
+static inline uint64_t WindowMean(const uint64_t sum, const uint16_t samplesNb)
+{
+  switch (samplesNb)
+  {
+    case 16:
+      return sum >> 4;
+    case 32:
+      return sum >> 5;
+    case 64:
+      return sum >> 6;
+    case 128:
+      return sum >> 7;
+    case 256:
+      return sum >> 8;
+    case 512:
+      return sum >> 9;
+    case 1024:
+      return sum >> 10;
+    case 2048:
+      return sum >> 11;
+    default:
+      return sum / samplesNb;
+  }
+}
+
+/*! @brief Converts the magnitude of a window sum of raw voltage times current samples into watts (or vars).
+ *
+ *  @param sum The signed window sum.
+ *  @param samplesNb The number of samples in the window.
+ *  @return uint64_t - the magnitude of the mean power, with MEASUREMENT_Q fractional bits.
+ */
+static uint64_t WindowPowerQ(const int64_t sum, const uint16_t samplesNb)
+{
+  //work on the magnitude, shifting negative numbers isn't portable
+  uint64_t magnitude = sum < 0 ? -(uint64_t)sum : (uint64_t)sum;
+  int64_t powerQ = (int64_t)WindowMean(magnitude, samplesNb) << MEASUREMENT_Q;
+  //scale by the smaller current factor first so the intermediate can't overflow
+  return FixedPoint_Scale(FixedPoint_Scale(powerQ, CURRENT_PER_COUNT), VOLTAGE_PER_COUNT);
+}
+
+/*! @brief Converts a window sum of raw voltage times current samples into watts (or vars).
+ *
+ *  @param sum The signed window sum.
+ *  @param samplesNb The number of samples in the window.
+ *  @return float - the mean power, with the sign of the sum.
+ */
+static float WindowPower(const int64_t sum, const uint16_t samplesNb)
+{
+  float power = (float)WindowPowerQ(sum, samplesNb) / (1 << MEASUREMENT_Q);
+  return sum < 0 ? -power : power;
+}
+
+/*! @brief Adds a window of imported energy to the billing register for the rate being charged now.
+ *
+ *  @param powerQ The average power over the window, with MEASUREMENT_Q fractional bits.
+ *  @param windowNs The length of the window in nanoseconds.
+ *  @return uint64_t - the whole uWh taken from the window, for the demand.
+ */
+static uint64_t AddBillingEnergy(const uint64_t powerQ, const uint64_t windowNs)
+{
+  //carry the part of a uWh that's left so nothing is lost to rounding
+  BillingResidual += powerQ * windowNs;
+  uint64_t microWattHours = BillingResidual / ENERGY_PER_UWH;
+  BillingResidual -= microWattHours * ENERGY_PER_UWH;
+
+  if (IsSelfTesting)
+    microWattHours *= 3600; //self test runs an hour every second
+
+  uint8_t tariff = *Tariff_Loaded;
+  //cached by the tariff engine, only recomputed when a slot boundary or block threshold is crossed
+  uint8_t reg = Tariff_Get_Register(tariff, Basic_Measurements.Time, Basic_Measurements.TotalEnergy);
+  if (reg == TARIFF_NO_REGISTER)
+    return microWattHours;
+
+  //a 64 bit store is two words, keep the readers in Measurements_Get_Cost from seeing half of it
+  OS_DisableInterrupts();
+  Basic_Measurements.BillingEnergy[tariff - 1][reg] += microWattHours;
+  OS_EnableInterrupts();
+  return microWattHours;
+}
+
+void Measurements_Add_Sample(const int16_t voltage, const int16_t current)
+{
+  TSample *frame = &Samples.Frames[Samples.Head % NB_SAMPLE_FRAMES];
+  uint16_t sample = WindowSamplesNb;
+
+  //the voltage history doubles as the delay line for the reactive power
+  uint8_t raw = Samples.SamplesRawNb;
+  Samples.RawSamples[raw] = voltage;
+  int16_t delayedVoltage = Samples.RawSamples[(uint8_t)(raw - QuarterCycle) % RAW_SAMPLES_NB];
+  Samples.SamplesRawNb = (raw + 1) % RAW_SAMPLES_NB;
+
+  if (sample == 0)
+  {
+    //first sample of a new window
+    frame->Sums.VoltageSquared = 0;
+    frame->Sums.CurrentSquared = 0;
+    frame->Sums.Power = 0;
+    frame->Sums.Reactive = 0;
+    frame->VoltageMax = frame->VoltageMin = voltage;
+    frame->CurrentMax = frame->CurrentMin = current;
+  }
+  else
+  {
+    if (voltage > frame->VoltageMax)
+      frame->VoltageMax = voltage;
+    if (voltage < frame->VoltageMin)
+      frame->VoltageMin = voltage;
+    if (current > frame->CurrentMax)
+      frame->CurrentMax = current;
+    if (current < frame->CurrentMin)
+      frame->CurrentMin = current;
+  }
+
+  DSP_Accumulate_Sample(&frame->Sums, voltage, current);
+  DSP_Accumulate_Reactive(&frame->Sums, delayedVoltage, current);
+  WindowSamplesNb = ++sample;
+
+  if (sample < WindowLength)
+    return;
+
+  //window complete, start the next one from scratch
+  frame->SamplesNb = sample;
+  WindowSamplesNb = 0;
+
+  //the next frame to fill must not be one the calculate thread still holds
+  if ((uint8_t)(Samples.Head - Samples.Tail) >= NB_SAMPLE_FRAMES - 1)
+  {
+    //drop this window and refill the same frame
+    Samples.Overruns++;
+    return;
+  }
+
+  Samples.Head++;
+  OS_SemaphoreSignal(CalculateSemaphore); //signal the calculate thread
+}
+
 void calculateBasic(void *pData)
 {
 //    Packet_Put('d', (uint8_t) averagePower, (uint8_t) periodEnergy, analogDataArray[0].samples[8]);
   for (;;)
   {
-    float powerSum = 0.0;
-    float periodEnergy = 0.0, periodCost = 0.0;
-    float powerFactor;
-    float frequency, VRMS = 0, CRMS = 0;
+    float periodEnergy = 0.0;
+    float averagePower, powerFactor;
+    float apparentPower, reactivePower, displacementPowerFactor;
+    float VRMS, CRMS;
     OS_SemaphoreWait(CalculateSemaphore, 0);
 
-    //because we access the Samples struct we need sure we avoid corrupt data from PIT
-    OS_DisableInterrupts();
-
-    //Energy
-    for (int i=0; i < ANALOG_SAMPLE_SIZE; i++)
-    {
-      powerSum += Samples.PowerBuffer[i];
-      VRMS += pow(Samples.VoltageBuffer[i], 2);
-      CRMS += pow(Samples.CurrentBuffer[i], 2);
-    }
-
+    //the ISR has moved on to the other frame, so this one can't change underneath us
+    //sums of V^2, I^2 and V*I were accumulated by the ISR as the samples arrived
+    const TSample *frame = &Samples.Frames[Samples.Tail % NB_SAMPLE_FRAMES];
+    const TDSPSums sums = frame->Sums;
+    //the window length can be changed at any time, so use the length this window actually had
+    const uint16_t samplesNb = frame->SamplesNb;
+    //done with the frame, give it back to the ISR once the reads above are done
+    MEASUREMENTS_BARRIER();
+    Samples.Tail++;
+
+    //only now convert to engineering units, keeping MEASUREMENT_Q fractional bits until the very end
+    //rms for any type of wave, sqrt(mean(x^2))
+    uint32_t voltageRMSCounts = FixedPoint_Sqrt64(WindowMean(sums.VoltageSquared, samplesNb) << (2 * MEASUREMENT_Q));
+    uint32_t currentRMSCounts = FixedPoint_Sqrt64(WindowMean(sums.CurrentSquared, samplesNb) << (2 * MEASUREMENT_Q));
+    VRMS = (float)FixedPoint_Scale(voltageRMSCounts, VOLTAGE_PER_COUNT) / (1 << MEASUREMENT_Q);
+    CRMS = (float)FixedPoint_Scale(currentRMSCounts, CURRENT_PER_COUNT) / (1 << MEASUREMENT_Q);
+
+    //average power is the mean of the instantaneous power over the window, negative when exporting
+    averagePower = WindowPower(sums.Power, samplesNb);
+    uint64_t windowNs = (uint64_t)samplesNb * PLL_Get_Interval();
+    //reactive power is the same mean with the voltage delayed by a quarter cycle
+    reactivePower = WindowPower(sums.Reactive, samplesNb);
+    apparentPower = VRMS * CRMS;
 
     //correct way to do this is to get the power for each sample, then using his formula of integrate(p*Ts) we first convert Ts from ms to S for use in the formula.
     //then we have energy and accumulate it.
     //then we do: total energy / total time = Power(Watt or Joule).
     //then we convert watt to Kwh using established formulas
-
-
-    periodEnergy = (powerSum * (ANALOG_SAMPLE_INTERVAL / 1000)) / 3.6e+6f; //convert to hours.
-
-    //rms for any type of wave
-    VRMS = sqrt(VRMS / ANALOG_SAMPLE_INTERVAL);
-    CRMS = sqrt(CRMS / ANALOG_SAMPLE_INTERVAL);
+    //the PLL moves the sample interval with the mains, so the window length isn't fixed
+    float windowSeconds = (float)windowNs * 1e-9f;
+    float windowHours = windowSeconds / 3.6e+6f; //convert to hours, and W to kW
+    periodEnergy = averagePower * windowHours;
+    float periodReactiveEnergy = reactivePower * windowHours;
 
     //power factor, P = VI * Cos(theta), where power is average power for period and V,I are respective RMS values
-    powerFactor = powerSum / (VRMS * CRMS);
+    if (apparentPower > 0)
+      powerFactor = averagePower / apparentPower;
+    else
+      powerFactor = 0;
+
+    //displacement power factor only sees the fundamental, the quarter cycle delay is only exact at the fundamental
+    float fundamentalPower = sqrtf(averagePower * averagePower + reactivePower * reactivePower);
+    if (fundamentalPower > 0)
+      displacementPowerFactor = averagePower / fundamentalPower;
+    else
+      displacementPowerFactor = 0;
 
 
 //    uint8_t hours, minutes, seconds;
 //    RTC_Format_Seconds_Hours(basicMeasurements.MeteringTime, &hours, &minutes, &seconds);
 
-    //Cost
-    //calculate cost for these samples and add to total
-    //cost of period
-    periodCost = CalculateCost(periodEnergy, *Tariff_Loaded);
-
-
-    //to work out frequency, get time period (approximate from samples), F = 1/p
-    //to get the time period all I have to do is get the time between the positive and negative peaks (which gives me half a period)
-    //then double that to get the whole period.
-    //This works !!!!!!!!
-    // However we need more accuracy by sampling more times
-    //this is only ever as accurate as the number of samples between the peaks
-    int positivePeakIndex, negativePeakIndex;
-    float maxPositive = Samples.VoltageBuffer[0], maxNegative = Samples.VoltageBuffer[0];
-    for(int i = 1; i < ANALOG_SAMPLE_SIZE;i++)
-    {
-      float elem = Samples.VoltageBuffer[i];
-      if (elem > maxPositive) {
-        maxPositive = elem;
-        positivePeakIndex = i;
-      }
-      if (elem < maxNegative) {
-        maxNegative = elem;
-        negativePeakIndex = i;
-      }
-    }
-    if (negativePeakIndex < positivePeakIndex) {
-      //bad data set, try again next time
-      frequency = Intermediate_Measurements.Frequency;
-    }
-    else {
-      //try to dertmine frquency
-      int peakDiff = negativePeakIndex - positivePeakIndex;
-      float timeDiff = peakDiff * ANALOG_SAMPLE_INTERVAL;
-      float period = (timeDiff * 2) / 1000; //should be the period of the whole wave. Period in ms, convert to seconds
-      frequency = 1 / period;
-    }
+    //registers are changing, snapshots taken from here on are retried
+    UpdateSequence++;
+    MEASUREMENTS_BARRIER();
+
+    //only imported energy is billed, in whole uWh, the cost is only worked out when it's asked for
+    uint64_t importedEnergy = 0;
+    if (sums.Power > 0)
+      importedEnergy = AddBillingEnergy(WindowPowerQ(sums.Power, samplesNb), windowNs);
+    //windows that export still move the demand on to its next sub-interval
+    Demand_Update(importedEnergy, Basic_Measurements.Time, Tariff_Get_Band());
 
 
-    powerSum /= ANALOG_SAMPLE_SIZE;
+    //the frequency is tracked sample by sample from the zero crossings, independent of the window
+    //keep the last estimate until a new one is ready
+    float frequency = Intermediate_Measurements.Frequency;
+    if (Frequency_Get(&frequency))
+      PLL_Update(Frequency_Get_Period()); //keep the sampling locked to the mains
+
     //save to basic measurements
-    Basic_Measurements.TotalEnergy += periodEnergy;
-    Basic_Measurements.AveragePower = powerSum;
-    Basic_Measurements.TotalCost += periodCost;
+    //four quadrant registers, each only ever counts up
+    if (periodEnergy >= 0)
+      Basic_Measurements.TotalEnergy += periodEnergy;
+    else
+      Basic_Measurements.ExportEnergy -= periodEnergy;
+    if (periodReactiveEnergy >= 0)
+      Basic_Measurements.ImportReactiveEnergy += periodReactiveEnergy;
+    else
+      Basic_Measurements.ExportReactiveEnergy -= periodReactiveEnergy;
+    Basic_Measurements.AveragePower = averagePower;
     //save to intermediate measurements
     Intermediate_Measurements.RMSVoltage = VRMS;
     Intermediate_Measurements.RMSCurrent = CRMS;
     Intermediate_Measurements.Frequency = frequency;
     Intermediate_Measurements.PowerFactor = powerFactor;
+    Intermediate_Measurements.ApparentPower = apparentPower;
+    Intermediate_Measurements.ReactivePower = reactivePower;
+    Intermediate_Measurements.DisplacementPowerFactor = displacementPowerFactor;
+
+    MEASUREMENTS_BARRIER();
+    UpdateSequence++;
+
+    //only flags the streams that are due, they're sent by the telemetry thread
+    Telemetry_Window();
   }
+}
 
-  OS_EnableInterrupts();
+/*! @brief Charges each billing register at its rate.
+ *
+ *  @param billingEnergy The registers, uWh.
+ *  @return double - the cost in billionths of a cent.
+ */
+static double BillingCost(const uint64_t billingEnergy[TARIFFS_NB][TARIFF_REGISTERS_NB])
+{
+  double cents = 0.0;
+  for (uint8_t tariff = 1; tariff <= TARIFFS_NB; tariff++)
+    for (uint8_t reg = 0; reg < TARIFF_REGISTERS_NB; reg++)
+      if (billingEnergy[tariff - 1][reg])
+        cents += (double)billingEnergy[tariff - 1][reg] * Tariff_Get_Register_Rate(tariff, reg);
+  return cents;
 }
 
-double CalculateCost(double periodEnergy, uint8_t tariffIndex)
+double Measurements_Get_Cost()
 {
-  double tariff = 0.0f;
-  switch (tariffIndex)
-  {
-    case 1:
-      tariff = GetTimeofUseTariff();
-      break;
-    case 2:
-      tariff = TARIFFS_VALUES.NonToU.secondNb;
-      break;
-    case 3:
-      tariff = TARIFFS_VALUES.NonToU.thirdNb;
-      break;
-  }
-  if (IsSelfTesting)
-    tariff = tariff * 3600; //convert from kwh to kws for self test
+  uint64_t billingEnergy[TARIFFS_NB][TARIFF_REGISTERS_NB];
+  for (uint8_t tariff = 0; tariff < TARIFFS_NB; tariff++)
+    for (uint8_t reg = 0; reg < TARIFF_REGISTERS_NB; reg++)
+    {
+      //the calculate thread could update the register half way through reading it
+      OS_DisableInterrupts();
+      billingEnergy[tariff][reg] = Basic_Measurements.BillingEnergy[tariff][reg];
+      OS_EnableInterrupts();
+    }
 
-  return periodEnergy * (tariff / 100); //convert to cents
+  //uWh to kWh and cents to dollars
+  return BillingCost(billingEnergy) / 1e11;
 }
 
-float GetTimeofUseTariff()
+/*! @brief Scales a value to a whole number, rounding to the nearest.
+ *
+ *  @return int32_t - the scaled value.
+ */
+static int32_t Scale(const float value, const float scale)
 {
-  //get the current time
-  uint8_t days, hours, minutes, seconds;
-  RTC_Format_Seconds_Days(Basic_Measurements.Time, &days, &hours, &minutes, &seconds);
-  //test peak
-  if (hours >= TARIFF_TIME_RANGE.peak.start && hours < TARIFF_TIME_RANGE.peak.end)
-    return TARIFFS_VALUES.ToU.peak;
-  else if (hours >= TARIFF_TIME_RANGE.shoulder1.start && hours < TARIFF_TIME_RANGE.shoulder1.end)
-    return TARIFFS_VALUES.ToU.shoulder;
-  else if (hours >= TARIFF_TIME_RANGE.shoulder2.start && hours < TARIFF_TIME_RANGE.shoulder2.end)
-    return TARIFFS_VALUES.ToU.shoulder;
-  else
-    return TARIFFS_VALUES.ToU.offPeak;
+  float scaled = value * scale;
+  return (int32_t)(scaled >= 0.0f ? scaled + 0.5f : scaled - 0.5f);
+}
+
+void Measurements_Get_Snapshot(TMeasurementsSnapshot * const snapshot)
+{
+  TMeasurementsBasic basic;
+  TMeasurementsIntermediate intermediate;
+  uint32_t sequence;
+
+  //the calculate thread is higher priority, so it can only ever interrupt the copy, never be caught half way
+  do
+  {
+    sequence = UpdateSequence;
+    MEASUREMENTS_BARRIER();
+    basic = Basic_Measurements;
+    intermediate = Intermediate_Measurements;
+    MEASUREMENTS_BARRIER();
+  } while ((sequence & 1) || sequence != UpdateSequence);
+
+  snapshot->Sequence = sequence / 2;
+  snapshot->Time = basic.Time;
+  snapshot->MeteringTime = basic.MeteringTime;
+  snapshot->Power = Scale(basic.AveragePower, 1e3f);
+  snapshot->ReactivePower = Scale(intermediate.ReactivePower, 1e3f);
+  snapshot->ApparentPower = Scale(intermediate.ApparentPower, 1e3f);
+  //kWh to Wh
+  snapshot->ImportEnergy = basic.TotalEnergy * 1e3 + 0.5;
+  snapshot->ExportEnergy = basic.ExportEnergy * 1e3 + 0.5;
+  snapshot->ImportReactiveEnergy = basic.ImportReactiveEnergy * 1e3 + 0.5;
+  snapshot->ExportReactiveEnergy = basic.ExportReactiveEnergy * 1e3 + 0.5;
+  //uWh to kWh, and cents to hundredths
+  snapshot->Cost = BillingCost((const uint64_t (*)[TARIFF_REGISTERS_NB])basic.BillingEnergy) / 1e7 + 0.5;
+  snapshot->Voltage = Scale(intermediate.RMSVoltage, 1e3f);
+  snapshot->Current = Scale(intermediate.RMSCurrent, 1e6f);
+  snapshot->Frequency = Scale(intermediate.Frequency, 1e3f);
+  snapshot->PowerFactor = Scale(intermediate.PowerFactor, 1e6f);
+  snapshot->DisplacementPowerFactor = Scale(intermediate.DisplacementPowerFactor, 1e6f);
 }
 
 
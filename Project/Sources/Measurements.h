@@ -9,44 +9,105 @@
 
 #include "OS.h"
 #include "types.h"
+#include "DSP.h"
+#include "Tarrifs.h"
 //#include "main.h"
 
-#define ANALOG_SAMPLE_SIZE 16
+//the mains period the nominal sample interval is worked out from, 50Hz in nanoseconds
+#define MAINS_NOMINAL_PERIOD 20000000
+
+//window setting, when this bit is set the count is in mains cycles rather than samples
+#define WINDOW_IN_CYCLES 0x80
+#define WINDOW_COUNT_MASK 0x7F
+
+//default window is 16 samples, one cycle at the default rate
+#define DEFAULT_WINDOW 16
+
+#define MIN_SAMPLES_PER_CYCLE 4
+#define MAX_SAMPLES_PER_CYCLE 128
+
+//number of sample frames the PIT ISR and the calculate thread ping-pong between
+#define NB_SAMPLE_FRAMES 2
+
+//voltage history kept by the ISR, a power of two and at least a quarter cycle at MAX_SAMPLES_PER_CYCLE
+#define RAW_SAMPLES_NB 128
 
 extern OS_ECB *CalculateSemaphore;
 
+//A window of samples, accumulated by the PIT ISR as each sample arrives so no samples need to be stored.
+//Conditioning to engineering units is done once per window by the calculate thread.
 typedef struct
 {
-  uint16_t volatile SamplesNb;  /*!< The number of bytes currently stored in the buffer */
-  float PowerBuffer[ANALOG_SAMPLE_SIZE];  /*!< The actual array of bytes to store the data */
-  float VoltageBuffer[ANALOG_SAMPLE_SIZE];
-  float CurrentBuffer[ANALOG_SAMPLE_SIZE];
-  int16_t RawSamples[128]; // holds the last 128 samples for analysis later on
-  uint8_t SamplesRawNb;
+  TDSPSums Sums;             /*!< Running sums of the raw V^2, I^2 and V*I */
+  uint16_t SamplesNb;        /*!< The number of samples in the window, set when the window is published */
+  int16_t VoltageMax;        /*!< Most positive raw voltage sample */
+  int16_t VoltageMin;        /*!< Most negative raw voltage sample */
+  int16_t CurrentMax;
+  int16_t CurrentMin;
 } TSample;
 
+//The PIT ISR only ever writes to Frames[Head % NB_SAMPLE_FRAMES], the calculate thread only ever reads Frames[Tail % NB_SAMPLE_FRAMES].
+//Head is only written by the ISR and Tail only by the calculate thread, so handing a frame over is a single byte store and no interrupt masking is needed.
+typedef struct
+{
+  TSample Frames[NB_SAMPLE_FRAMES];
+  uint8_t volatile Head;       /*!< Number of frames completed by the ISR */
+  uint8_t volatile Tail;       /*!< Number of frames released by the calculate thread */
+  uint32_t volatile Overruns;  /*!< Number of frames the calculate thread could not consume in time */
+  int16_t RawSamples[RAW_SAMPLES_NB]; // holds the last 128 voltage samples, also the delay line for reactive power
+  uint8_t SamplesRawNb;
+} TSampleFrames;
+
 typedef struct
 {
   uint64_t MeteringTime; //the time in seconds that we've been metering
-  double AveragePower;
-  double TotalEnergy;
-  double TotalCost;
+  float AveragePower;    //signed active power, negative when exporting
+  double TotalEnergy;    //imported active energy, kWh
+  double ExportEnergy;   //exported active energy, kWh
+  double ImportReactiveEnergy; //lagging reactive energy, kvarh
+  double ExportReactiveEnergy; //leading reactive energy, kvarh
+  uint64_t BillingEnergy[TARIFFS_NB][TARIFF_REGISTERS_NB]; //imported energy for each rate of each tariff, uWh, only written by the calculate thread
   uint64_t Time; //the current time, we need our own local copy as in self test mode we need to be able to emulate time.
 } TMeasurementsBasic;
 
 typedef struct
 {
-  double Frequency;
-  double RMSVoltage;
-  double RMSCurrent;
-  double PowerFactor; //what is this even
+  float Frequency;
+  float RMSVoltage;
+  float RMSCurrent;
+  float ApparentPower;   //VA, Vrms * Irms
+  float ReactivePower;   //var, positive when the current lags
+  float DisplacementPowerFactor; //cos of the angle between the fundamentals, P / sqrt(P^2 + Q^2)
+  float PowerFactor; //P / S, includes distortion, negative when exporting
   //^^ for the above:
   //http://www.syscompdesign.com/assets/images/appnotes/power-factor-measurement.pdf
   //https://www.allaboutcircuits.com/textbook/alternating-current/chpt-11/calculating-power-factor/
 } TMeasurementsIntermediate;
 
 
-extern TSample Samples;
+//every register at one instant, as whole numbers so nothing needs converting by the head end
+//sent as it is laid out in memory (little endian) by CMD_SNAPSHOT
+typedef struct
+{
+  uint32_t Sequence;             //windows calculated since boot, changes whenever any value below does
+  uint32_t Time;                 //RTC seconds
+  uint32_t MeteringTime;         //seconds
+  int32_t Power;                 //mW, negative when exporting
+  int32_t ReactivePower;         //mvar, positive when the current lags
+  uint32_t ApparentPower;        //mVA
+  uint32_t ImportEnergy;         //Wh
+  uint32_t ExportEnergy;         //Wh
+  uint32_t ImportReactiveEnergy; //varh
+  uint32_t ExportReactiveEnergy; //varh
+  uint32_t Cost;                 //hundredths of a cent
+  uint32_t Voltage;              //mV rms
+  uint32_t Current;              //uA rms
+  uint32_t Frequency;            //mHz
+  int32_t PowerFactor;           //millionths, negative when exporting
+  int32_t DisplacementPowerFactor; //millionths
+} TMeasurementsSnapshot;
+
+extern TSampleFrames Samples;
 
 extern TMeasurementsBasic Basic_Measurements;
 
@@ -54,6 +115,71 @@ extern TMeasurementsIntermediate Intermediate_Measurements;
 
 bool Measurements_Init();
 
+/*! @brief Sets how long each measurement window is.
+ *
+ *  The new length is picked up by the PIT ISR at the end of the window being filled.
+ *  @param setting The number of samples, or the number of mains cycles if WINDOW_IN_CYCLES is set.
+ *  @return bool - TRUE if the setting was valid and applied.
+ */
+bool Measurements_Set_Window(const uint8_t setting);
+
+/*! @brief Gets the window setting last applied.
+ *
+ *  @return uint8_t - the setting as given to Measurements_Set_Window.
+ */
+uint8_t Measurements_Get_Window();
+
+/*! @brief Sets the sample rate as a number of samples in each nominal mains cycle.
+ *
+ *  Moves the PIT, the frequency tracker and the PLL over to the new rate. A window in cycles keeps the same number of cycles.
+ *  @param samplesPerCycle Between MIN_SAMPLES_PER_CYCLE and MAX_SAMPLES_PER_CYCLE.
+ *  @return bool - TRUE if the rate was valid and applied.
+ */
+bool Measurements_Set_Samples_Per_Cycle(const uint16_t samplesPerCycle);
+
+/*! @brief Gets the number of samples taken in each mains cycle.
+ *
+ *  @return uint16_t - samples per cycle.
+ */
+uint16_t Measurements_Get_Samples_Per_Cycle();
+
+/*! @brief Gets how far the sample rate has been decimated from the rate that was set.
+ *
+ *  @return uint8_t - 1 if running at the set rate, otherwise the factor the rate was divided by.
+ */
+uint8_t Measurements_Get_Decimation();
+
+/*! @brief Halves the sample rate if the sampling ISR went over budget or a window was dropped since the last check,
+ *         and doubles a decimated rate again once the ISR has stayed well under budget for LOAD_RECOVER_SECONDS.
+ *
+ *  @note Called once a second after Load_Update.
+ */
+void Measurements_Check_Load();
+
+/*! @brief Adds a sample pair to the window being accumulated and publishes the window once it is complete.
+ *
+ *  If the calculate thread still holds every other frame when the window completes, the window is discarded and the overrun counter is incremented.
+ *  @param voltage The raw voltage sample.
+ *  @param current The raw current sample.
+ *  @note Must only be called from the PIT ISR.
+ */
+void Measurements_Add_Sample(const int16_t voltage, const int16_t current);
+
 void calculateBasic(void *pData);
 
+/*! @brief Works out the cost of all the imported energy at the current tariff rates.
+ *
+ *  Cost isn't accumulated, each billing register is charged at its rate whenever this is called, so a rate change re-rates everything.
+ *  @return double - the total cost in dollars.
+ */
+double Measurements_Get_Cost();
+
+/*! @brief Captures every register from the same window.
+ *
+ *  The calculate thread bumps a sequence count either side of its updates, the copy is taken again if it moved.
+ *  @param snapshot Set to the registers.
+ *  @note Must not be called from a thread that can preempt the calculate thread.
+ */
+void Measurements_Get_Snapshot(TMeasurementsSnapshot * const snapshot);
+
 #endif
@@ -0,0 +1,126 @@
+/*
+ * PLL.c
+ *
+ *  Created on: 5 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "PLL.h"
+#include "PIT.h"
+#include "Frequency.h"
+#include "Cpu.h"
+
+//the PIT can't be set any finer than one bus clock
+#define PLL_MIN_STEP (1000000000U / CPU_BUS_CLK_HZ)
+
+static uint32_t NominalInterval;
+static uint32_t MinInterval;
+static uint32_t MaxInterval;
+static uint32_t TargetPeriod;     //samples per cycle, Q16
+static uint32_t volatile Interval;
+
+static TPLLState volatile State;
+static uint8_t InTolerance;
+static uint64_t Acquiring;       //time spent trying to lock, ns
+static uint32_t volatile LockTime;
+
+/*! @brief Moves the PIT and the frequency tracker to a new sample interval.
+ *
+ *  @param interval The new interval in nanoseconds.
+ */
+static void Retune(const uint32_t interval)
+{
+  //PIT_Set truncates to whole bus clocks, truncate here so the PIT, the frequency tracker and energy all use the same rate
+  Interval = (interval / PLL_MIN_STEP) * PLL_MIN_STEP;
+  //takes effect from the next PIT period, so sampling isn't disturbed
+  PIT_Set(Interval, false);
+  Frequency_Set_Interval(Interval);
+}
+
+/*! @brief Drops back to the unlocked state and starts timing the next lock.
+ */
+static void Unlock()
+{
+  State = PLL_UNLOCKED;
+  InTolerance = 0;
+  Acquiring = 0;
+}
+
+bool PLL_Init(const uint32_t nominalInterval, const uint16_t samplesPerCycle)
+{
+  NominalInterval = nominalInterval;
+  MinInterval = nominalInterval - (nominalInterval / 100) * PLL_MAX_DEVIATION;
+  MaxInterval = nominalInterval + (nominalInterval / 100) * PLL_MAX_DEVIATION;
+  TargetPeriod = (uint32_t)samplesPerCycle << 16;
+  Interval = nominalInterval;
+  LockTime = 0;
+  Unlock();
+  return true;
+}
+
+void PLL_Update(const uint32_t period)
+{
+  if (period == 0)
+  {
+    //no mains to lock to, go back to nominal
+    Unlock();
+    if (Interval != NominalInterval)
+      Retune(NominalInterval);
+    return;
+  }
+
+  int32_t error = (int32_t)(period - TargetPeriod);
+  if (error < 0)
+    error = -error;
+
+  //how long the mains cycle really is, in ns
+  uint64_t cycle = ((uint64_t)period * Interval) >> 16;
+
+  if (State == PLL_LOCKED)
+  {
+    if (error > PLL_UNLOCK_TOLERANCE)
+      Unlock();
+  }
+  else
+  {
+    Acquiring += cycle * FREQUENCY_AVERAGE_CYCLES;
+    if (error <= PLL_LOCK_TOLERANCE)
+    {
+      if (++InTolerance >= PLL_LOCK_COUNT)
+      {
+        State = PLL_LOCKED;
+        LockTime = (uint32_t)(Acquiring / 1000000);
+      }
+    }
+    else
+      InTolerance = 0;
+  }
+
+  //the interval that would put exactly TargetPeriod samples in this cycle, and move part of the way there
+  uint32_t ideal = (uint32_t)((cycle << 16) / TargetPeriod);
+  int32_t step = ((int32_t)ideal - (int32_t)Interval) / (1 << PLL_GAIN_SHIFT);
+  uint32_t interval = Interval + step;
+
+  if (interval < MinInterval)
+    interval = MinInterval;
+  else if (interval > MaxInterval)
+    interval = MaxInterval;
+
+  if ((interval > Interval ? interval - Interval : Interval - interval) >= PLL_MIN_STEP)
+    Retune(interval);
+}
+
+uint32_t PLL_Get_Interval()
+{
+  return Interval;
+}
+
+TPLLState PLL_Get_State()
+{
+  return State;
+}
+
+uint32_t PLL_Get_Lock_Time()
+{
+  return LockTime;
+}
@@ -0,0 +1,67 @@
+/*
+ * PLL.h
+ *
+ *  Created on: 5 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef PLL_H
+#define PLL_H
+
+#include "types.h"
+
+//the sample interval is never moved more than this percentage from nominal, covers 45 to 55 Hz
+#define PLL_MAX_DEVIATION 10
+
+//locked once the measured period is within this many samples (Q16) of the target, 0.01 of a sample
+#define PLL_LOCK_TOLERANCE ((1 << 16) / 100)
+
+//lose lock if the period moves more than this many samples (Q16) away, 0.1 of a sample
+#define PLL_UNLOCK_TOLERANCE ((1 << 16) / 10)
+
+//number of consecutive period estimates that must be in tolerance before we call it locked
+#define PLL_LOCK_COUNT 3
+
+//each correction moves the interval 1 / 2^PLL_GAIN_SHIFT of the way to the ideal interval
+#define PLL_GAIN_SHIFT 1
+
+typedef enum
+{
+  PLL_UNLOCKED,
+  PLL_LOCKED
+} TPLLState;
+
+/*! @brief Sets up the software PLL before first use.
+ *
+ *  @param nominalInterval The sample interval in nanoseconds at nominal mains frequency.
+ *  @param samplesPerCycle The number of samples wanted in each mains cycle.
+ *  @return bool - TRUE if the PLL was successfully initialized.
+ */
+bool PLL_Init(const uint32_t nominalInterval, const uint16_t samplesPerCycle);
+
+/*! @brief Feeds a measured mains period back into the PIT so sampling stays a whole multiple of the line frequency.
+ *
+ *  @param period The averaged mains period in samples, with 16 fractional bits. 0 if the mains has been lost.
+ *  @note Called by the calculate thread each time Frequency has a new estimate.
+ */
+void PLL_Update(const uint32_t period);
+
+/*! @brief Gets the sample interval the PIT is currently running at.
+ *
+ *  @return uint32_t - the interval in nanoseconds.
+ */
+uint32_t PLL_Get_Interval();
+
+/*! @brief Gets whether the sampling is locked to the mains.
+ *
+ *  @return TPLLState - the lock state.
+ */
+TPLLState PLL_Get_State();
+
+/*! @brief Gets how long the most recent lock took to acquire.
+ *
+ *  @return uint32_t - the time from losing lock (or start up) to locking in milliseconds, 0 if it has never locked.
+ */
+uint32_t PLL_Get_Lock_Time();
+
+#endif
@@ -108,7 +108,7 @@ void SelfTest_Put_Data()
   Analog_Put(ANALOG_CURRENT_CHANNEL,
              (int16_t)SineRaw[phaseShiftedIndex] * CurrentScale);
 
-  SamplesPutCounter += 128 / ANALOG_SAMPLE_SIZE; //to account for the fact that we are outputting 16 samples not 128
+  SamplesPutCounter += RAW_SINE_SAMPLES / Measurements_Get_Samples_Per_Cycle(); //to account for the fact that we are outputting fewer samples than the table holds
   if (SamplesPutCounter >= RAW_SINE_SAMPLES)
   {
     SamplesPutCounter = 0;
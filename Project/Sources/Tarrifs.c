@@ -1,31 +1,336 @@
 /*
- * Constants.c
+ * Tarrifs.c
  *
  *  Created on: 26 Oct 2017
  *      Author: 98112939
  */
 
-#include "Constants.h"
+#include "Tarrifs.h"
 #include "types.h"
+#include "CRC.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
 
-const Tariff_Time_Range TARIFF_TIME_RANGE = {
-    .peak.start = 14,
-    .peak.end = 20,
-    .shoulder1.start = 7,
-    .shoulder1.end = 14,
-    .shoulder2.start = 20,
-    .shoulder2.end = 22,
-};
-
-//tarrifs in the order: peak, shoulder, offPeak, secondNb, thirdNb
-const float TARIFFS[5] = {22.235, 4.4, 2.109, 1.713, 4.1};
-
-const Tariff_Values TARIFFS_VALUES = {
-    .ToU.peak = 22.235,
-    .ToU.shoulder = 4.4,
-    .ToU.offPeak = 2.109,
-    .NonToU.secondNb = 1.713,
-    .NonToU.thirdNb = 4.1
-};
+//the table is written to flash a phrase at a time
+typedef char TariffTableIsWholePhrases[(sizeof(TTariffTable) % FLASH_PHRASE_SIZE) == 0 ? 1 : -1];
+
+//short names so the day profiles line up, 12 slots (6 hours) per line
+#define OFF TARIFF_OFF_PEAK
+#define SHD TARIFF_SHOULDER
+#define PK TARIFF_PEAK
+
+//used until a table has been uploaded
+static const TTariffTable DEFAULT_TABLE =
+  {
+    .Magic = TARIFF_TABLE_MAGIC,
+    .Version = 0,
+    .Schedules =
+      {
+        //1, time of use, there's only the one season and weekends are charged the same as weekdays
+        {
+          .SeasonsNb = 1,
+          .Seasons = {{.StartDay = 0, .Weekday = 0, .Weekend = 0,
+                       .Rates = {[TARIFF_OFF_PEAK] = TARIFF_RATE(2.109), [TARIFF_SHOULDER] = TARIFF_RATE(4.4), [TARIFF_PEAK] = TARIFF_RATE(22.235)}}}
+        },
+        //2, flat
+        {
+          .BlocksNb = 1,
+          .Blocks = {{.Threshold = 0, .Rate = TARIFF_RATE(1.713)}}
+        },
+        //3, flat
+        {
+          .BlocksNb = 1,
+          .Blocks = {{.Threshold = 0, .Rate = TARIFF_RATE(4.1)}}
+        }
+      },
+    .Profiles =
+      {
+        //peak 14:00 - 20:00, shoulder 7:00 - 14:00 and 20:00 - 22:00, off peak the rest
+        {
+          {
+            OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF, OFF,
+            OFF, OFF, SHD, SHD, SHD, SHD, SHD, SHD, SHD, SHD, SHD, SHD,
+            SHD, SHD, SHD, SHD, PK, PK, PK, PK, PK, PK, PK, PK,
+            PK, PK, PK, PK, SHD, SHD, SHD, SHD, OFF, OFF, OFF, OFF,
+          }
+        }
+      }
+  };
 
 const uint8_t DEFAULT_TARIFF_LOADED = 1;
+
+//the active table and the one being uploaded, the calculate thread only ever follows Active
+static TTariffTable Tables[2];
+static TTariffTable * volatile Active;
+
+//the flash bank the active table was loaded from or saved to, 0 for the built in table
+static uint32_t ActiveBank;
+
+//how much of the inactive table has been uploaded, or -1 when there's no upload
+static int16_t UploadLength;
+
+//set from a commit until the flash thread has saved the table, the inactive copy can't be uploaded into till then
+static volatile bool Committing;
+static TFlashCallback CommitCallback;
+static uint32_t CommitArgument;
+
+//the register stays good while the table, time and energy stay inside these limits
+static struct
+{
+  const TTariffTable *Table;
+  uint8_t Tariff;
+  uint64_t SlotStart;   //seconds, inclusive
+  uint64_t SlotEnd;     //seconds, exclusive
+  double EnergyStart;   //kWh, inclusive
+  double EnergyEnd;     //kWh, exclusive
+  uint8_t Register;
+  TTariffBand Band;
+} Cache;
+
+/*! @brief Checks a table is safe to use, so a bad upload can't send the engine off the end of an array.
+ *
+ *  @param table The table.
+ *  @return bool - TRUE if every count, index and band is in range, and the seasons and tiers start at 0 and go up.
+ */
+static bool TableValid(const TTariffTable * const table)
+{
+  if (table->Magic != TARIFF_TABLE_MAGIC)
+    return false;
+  if (CRC_16(table, offsetof(TTariffTable, CRC), CRC16_INITIAL) != table->CRC)
+    return false;
+
+  for (uint8_t tariff = 0; tariff < TARIFFS_NB; tariff++)
+  {
+    const TTariffSchedule *schedule = &table->Schedules[tariff];
+    if (schedule->SeasonsNb > TARIFF_MAX_SEASONS || schedule->BlocksNb > TARIFF_REGISTERS_NB)
+      return false;
+    for (uint8_t season = 0; season < schedule->SeasonsNb; season++)
+      if (schedule->Seasons[season].Weekday >= TARIFF_MAX_PROFILES || schedule->Seasons[season].Weekend >= TARIFF_MAX_PROFILES)
+        return false;
+
+    //the lookups assume every day and every kWh falls in exactly one season and tier, the cache would never hit otherwise
+    for (uint8_t season = 0; season < schedule->SeasonsNb; season++)
+      if (season == 0 ? schedule->Seasons[0].StartDay != 0
+          : schedule->Seasons[season].StartDay <= schedule->Seasons[season - 1].StartDay)
+        return false;
+    for (uint8_t tier = 0; tier < schedule->BlocksNb; tier++)
+      if (tier == 0 ? schedule->Blocks[0].Threshold != 0
+          : schedule->Blocks[tier].Threshold <= schedule->Blocks[tier - 1].Threshold)
+        return false;
+  }
+
+  for (uint8_t profile = 0; profile < TARIFF_MAX_PROFILES; profile++)
+    for (uint8_t slot = 0; slot < TARIFF_SLOTS_PER_DAY; slot++)
+      if (table->Profiles[profile].Bands[slot] >= TARIFF_BANDS_NB)
+        return false;
+
+  return true;
+}
+
+bool Tariff_Init()
+{
+  const TTariffTable *bankA = (const TTariffTable *)TARIFF_BANK_A;
+  const TTariffTable *bankB = (const TTariffTable *)TARIFF_BANK_B;
+  bool aValid = TableValid(bankA);
+  bool bValid = TableValid(bankB);
+
+  //the newer of the two, allowing for the sequence wrapping
+  if (aValid && (!bValid || (int16_t)(bankA->Sequence - bankB->Sequence) > 0))
+  {
+    memcpy(&Tables[0], bankA, sizeof(TTariffTable));
+    ActiveBank = TARIFF_BANK_A;
+  }
+  else if (bValid)
+  {
+    memcpy(&Tables[0], bankB, sizeof(TTariffTable));
+    ActiveBank = TARIFF_BANK_B;
+  }
+  else
+  {
+    memcpy(&Tables[0], &DEFAULT_TABLE, sizeof(TTariffTable));
+    ActiveBank = 0;
+  }
+
+  Active = &Tables[0];
+  UploadLength = -1;
+  Cache.Table = NULL;
+  return true;
+}
+
+/*! @brief Works out the time of use register and how long it holds for.
+ *
+ *  @param table The table.
+ *  @param schedule The tariff.
+ *  @param time The metering time in seconds.
+ */
+static void CacheTimeOfUse(const TTariffTable * const table, const TTariffSchedule * const schedule, const uint64_t time)
+{
+  uint32_t days = time / TARIFF_DAY_SECONDS;
+  uint8_t slot = (time % TARIFF_DAY_SECONDS) / TARIFF_SLOT_SECONDS;
+
+  uint16_t dayOfYear = days % TARIFF_DAYS_PER_YEAR;
+  uint8_t seasonNb = 0;
+  while (seasonNb + 1 < schedule->SeasonsNb && schedule->Seasons[seasonNb + 1].StartDay <= dayOfYear)
+    seasonNb++;
+  const TTariffSeason *season = &schedule->Seasons[seasonNb];
+
+  uint8_t weekday = (days + TARIFF_EPOCH_WEEKDAY) % 7;
+  const TTariffDayProfile *profile = &table->Profiles[(weekday >= 5) ? season->Weekend : season->Weekday];
+  TTariffBand band = profile->Bands[slot];
+
+  //neighbouring slots in the same band don't need a recompute, but the day always ends the run
+  uint8_t first = slot, last = slot;
+  while (first > 0 && profile->Bands[first - 1] == band)
+    first--;
+  while (last < TARIFF_SLOTS_PER_DAY - 1 && profile->Bands[last + 1] == band)
+    last++;
+
+  uint64_t dayStart = (uint64_t)days * TARIFF_DAY_SECONDS;
+  Cache.SlotStart = dayStart + first * TARIFF_SLOT_SECONDS;
+  Cache.SlotEnd = dayStart + (last + 1) * TARIFF_SLOT_SECONDS;
+  Cache.Band = band;
+  Cache.Register = seasonNb * TARIFF_BANDS_NB + band;
+}
+
+/*! @brief Works out the block register and how much energy it holds for.
+ *
+ *  @param schedule The tariff.
+ *  @param energy The energy used so far in kWh.
+ */
+static void CacheBlock(const TTariffSchedule * const schedule, const double energy)
+{
+  uint8_t tier = 0;
+  while (tier + 1 < schedule->BlocksNb && schedule->Blocks[tier + 1].Threshold <= energy)
+    tier++;
+
+  Cache.EnergyStart = schedule->Blocks[tier].Threshold;
+  Cache.EnergyEnd = (tier + 1 < schedule->BlocksNb) ? schedule->Blocks[tier + 1].Threshold : HUGE_VAL;
+  Cache.Register = tier;
+}
+
+uint8_t Tariff_Get_Register(const uint8_t tariff, const uint64_t time, const double energy)
+{
+  //a single read, a new table is swapped in whole
+  const TTariffTable *table = Active;
+
+  //nearly every window lands here
+  if (table == Cache.Table && tariff == Cache.Tariff && time >= Cache.SlotStart && time < Cache.SlotEnd
+      && energy >= Cache.EnergyStart && energy < Cache.EnergyEnd)
+    return Cache.Register;
+
+  //start from something that never needs recomputing
+  Cache.Table = table;
+  Cache.Tariff = tariff;
+  Cache.SlotStart = 0;
+  Cache.SlotEnd = UINT64_MAX;
+  Cache.EnergyStart = -HUGE_VAL;
+  Cache.EnergyEnd = HUGE_VAL;
+  Cache.Register = TARIFF_NO_REGISTER;
+  Cache.Band = TARIFF_OFF_PEAK;
+
+  if (tariff < 1 || tariff > TARIFFS_NB)
+    return Cache.Register;
+
+  const TTariffSchedule *schedule = &table->Schedules[tariff - 1];
+  if (schedule->SeasonsNb > 0)
+    CacheTimeOfUse(table, schedule, time);
+  else if (schedule->BlocksNb > 0)
+    CacheBlock(schedule, energy);
+
+  return Cache.Register;
+}
+
+double Tariff_Get_Register_Rate(const uint8_t tariff, const uint8_t reg)
+{
+  if (tariff < 1 || tariff > TARIFFS_NB || reg >= TARIFF_REGISTERS_NB)
+    return 0.0;
+
+  const TTariffSchedule *schedule = &Active->Schedules[tariff - 1];
+  uint32_t rate = 0;
+  if (schedule->SeasonsNb > 0)
+  {
+    uint8_t season = reg / TARIFF_BANDS_NB;
+    if (season < schedule->SeasonsNb)
+      rate = schedule->Seasons[season].Rates[reg % TARIFF_BANDS_NB];
+  }
+  else if (reg < schedule->BlocksNb)
+    rate = schedule->Blocks[reg].Rate;
+
+  return (double)rate / (1 << FIXED_Q24_SHIFT);
+}
+
+TTariffBand Tariff_Get_Band()
+{
+  return Cache.Band;
+}
+
+uint16_t Tariff_Get_Version()
+{
+  return Active->Version;
+}
+
+bool Tariff_Upload_Begin()
+{
+  if (Committing)
+    return false;
+
+  UploadLength = 0;
+  return true;
+}
+
+bool Tariff_Upload_Data(const uint8_t data[], const uint8_t length)
+{
+  if (UploadLength < 0)
+    return false;
+
+  //the last packet can carry padding past the end of the table
+  uint8_t *staging = (uint8_t *)((Active == &Tables[0]) ? &Tables[1] : &Tables[0]);
+  for (uint8_t i = 0; i < length && UploadLength < (int16_t)sizeof(TTariffTable); i++)
+    staging[UploadLength++] = data[i];
+  return true;
+}
+
+/*! @brief Swaps in the table once the flash thread has saved it, then passes the result on.
+ *
+ *  @param bank The bank the table was written to.
+ *  @param success Whether it was written.
+ */
+static void Committed(const uint32_t bank, const bool success)
+{
+  //a single store, the calculate thread sees the old table or the new one
+  if (success)
+  {
+    Active = (Active == &Tables[0]) ? &Tables[1] : &Tables[0];
+    ActiveBank = bank;
+  }
+  Committing = false;
+
+  if (CommitCallback)
+    CommitCallback(CommitArgument, success);
+}
+
+bool Tariff_Upload_Commit(const TFlashCallback callback, const uint32_t argument)
+{
+  TTariffTable *staging = (Active == &Tables[0]) ? &Tables[1] : &Tables[0];
+  bool complete = (UploadLength == (int16_t)sizeof(TTariffTable));
+  UploadLength = -1;
+  if (!complete || !TableValid(staging))
+    return false;
+
+  //goes in whichever bank isn't holding the active table, so a failed write still leaves a good one
+  staging->Sequence = Active->Sequence + 1;
+  staging->CRC = CRC_16(staging, offsetof(TTariffTable, CRC), CRC16_INITIAL);
+  uint32_t bank = (ActiveBank == TARIFF_BANK_A) ? TARIFF_BANK_B : TARIFF_BANK_A;
+
+  //the erase busy waits, so the flash thread does it, and it writes the first phrase with the magic in it last
+  CommitCallback = callback;
+  CommitArgument = argument;
+  Committing = true;
+  if (!Flash_Write_Sector_Async(bank, staging, sizeof(TTariffTable), Committed, bank))
+  {
+    Committing = false;
+    return false;
+  }
+  return true;
+}
@@ -1,52 +1,162 @@
 /*
- * constants.h
+ * Tarrifs.h
  *
  *  Created on: 26 Oct 2017
  *      Author: 98112939
  */
 
-#ifndef CONSTANTS_H
-#define CONSTANTS_H
+#ifndef TARIFFS_H
+#define TARIFFS_H
 
 #include "types.h"
+#include "Flash.h"
+#include "FixedPoint.h"
 
-//tariff Defaults holds values
-typedef struct {
-  struct {
-    double peak;
-    double shoulder;
-    double offPeak;
-  } ToU;
-  struct  {
-    double secondNb;
-    double thirdNb;
-  } NonToU;
-} Tariff_Values;
-
-typedef struct {
-  struct {
-    uint8_t start;
-    uint8_t end;
-  } peak;
-  struct {
-    uint8_t start;
-    uint8_t end;
-  } shoulder1;
-  struct {
-    uint8_t start;
-    uint8_t end;
-  } shoulder2;
-} Tariff_Time_Range;
+//the day is split into half hour slots, each slot is charged at one band
+#define TARIFF_SLOT_SECONDS 1800
+#define TARIFF_SLOTS_PER_DAY 48
+#define TARIFF_DAY_SECONDS 86400
 
+//there's no calendar, a year is always this many days and day 0 of the metering time is this day of the week (0 is Monday)
+#define TARIFF_DAYS_PER_YEAR 365
+#define TARIFF_EPOCH_WEEKDAY 0
+
+//number of tariffs that can be selected with CMD_TARIFF, numbered from 1
+#define TARIFFS_NB 3
+
+//energy is registered separately for each rate a tariff can charge, a season and band or a block tier
+#define TARIFF_MAX_SEASONS 4
+#define TARIFF_REGISTERS_NB (TARIFF_MAX_SEASONS * TARIFF_BANDS_NB)
+#define TARIFF_NO_REGISTER 0xFF
+
+//day profiles shared by all the seasons of all the tariffs
+#define TARIFF_MAX_PROFILES 4
+
+//"TRF" and the table format version, a table with any other magic is ignored
+#define TARIFF_TABLE_MAGIC 0x54524601
+
+//the table is kept in two sectors after the variable log, written alternately so there's always a good one
+#define TARIFF_BANK_A (FLASH_DATA_END + 1)
+#define TARIFF_BANK_B (FLASH_DATA_END + 1 + FLASH_SECTOR_SIZE)
+
+//a rate in cents per kWh as 32Q24
+#define TARIFF_RATE(cents) ((uint32_t)((cents) * (1 << FIXED_Q24_SHIFT) + 0.5))
+
+typedef enum
+{
+  TARIFF_OFF_PEAK,
+  TARIFF_SHOULDER,
+  TARIFF_PEAK,
+  TARIFF_BANDS_NB
+} TTariffBand;
+
+//the band for each half hour of a day
+typedef struct
+{
+  uint8_t Bands[TARIFF_SLOTS_PER_DAY];
+} TTariffDayProfile;
+
+//a season runs from its start day until the start day of the next season in the schedule
+typedef struct
+{
+  uint16_t StartDay;                 /*!< First day of the year, seasons must be in order and the first must start on day 0 */
+  uint8_t Weekday;                   /*!< Day profile for Monday to Friday */
+  uint8_t Weekend;                   /*!< Day profile for Saturday and Sunday */
+  uint32_t Rates[TARIFF_BANDS_NB];   /*!< Cents per kWh for each band, 32Q24 */
+} TTariffSeason;
+
+//a block tier applies once the energy used reaches its threshold
+typedef struct
+{
+  uint32_t Threshold;                /*!< Whole kWh, tiers must be in order and the first must be 0 */
+  uint32_t Rate;                     /*!< Cents per kWh, 32Q24 */
+} TTariffBlock;
+
+//a time of use tariff has seasons, a block tariff has blocks and no seasons
+typedef struct
+{
+  uint8_t SeasonsNb;
+  uint8_t BlocksNb;
+  uint16_t Reserved;
+  TTariffSeason Seasons[TARIFF_MAX_SEASONS];
+  TTariffBlock Blocks[TARIFF_REGISTERS_NB];
+} TTariffSchedule;
+
+//the whole table, stored in flash exactly as it is held in RAM and as it is uploaded (little endian)
+typedef struct
+{
+  uint32_t Magic;                    /*!< TARIFF_TABLE_MAGIC */
+  uint16_t Version;                  /*!< Set by whoever uploads the table */
+  uint16_t Sequence;                 /*!< Bumped by every commit, the newest bank is loaded at boot */
+  TTariffSchedule Schedules[TARIFFS_NB];
+  TTariffDayProfile Profiles[TARIFF_MAX_PROFILES];
+  uint16_t Reserved;
+  uint16_t CRC;                      /*!< CRC-16 of everything before it */
+} TTariffTable;
 
 extern const uint8_t DEFAULT_TARIFF_LOADED;
 
-//tarrifs in the order: peak, shoulder, offPeak, secondNb, thirdNb
-extern const float TARIFFS[5];
+/*! @brief Loads the newest good table from flash into RAM, or the built in table if there isn't one.
+ *
+ *  @return bool - TRUE if the tariffs were successfully initialized.
+ *  @note Assumes Flash has been initialized.
+ */
+bool Tariff_Init();
+
+/*! @brief Gets the register energy used now should be added to.
+ *
+ *  The register is cached until the next slot boundary or block threshold, so between those this is just the compares.
+ *  @param tariff The selected tariff, 1 to TARIFFS_NB.
+ *  @param time The metering time in seconds.
+ *  @param energy The energy used so far in kWh, for the block tiers.
+ *  @return uint8_t - the register, TARIFF_NO_REGISTER if the tariff doesn't exist.
+ *  @note Not reentrant, only the calculate thread should use it.
+ */
+uint8_t Tariff_Get_Register(const uint8_t tariff, const uint64_t time, const double energy);
+
+/*! @brief Gets the rate charged for the energy in a register.
+ *
+ *  Always looked up from the active table, so a new table re-rates everything already in the register.
+ *  @param tariff The tariff, 1 to TARIFFS_NB.
+ *  @param reg The register.
+ *  @return double - the rate in cents per kWh, 0 if the register isn't used by the tariff.
+ */
+double Tariff_Get_Register_Rate(const uint8_t tariff, const uint8_t reg);
+
+/*! @brief Gets the band the last register came from.
+ *
+ *  @return TTariffBand - the band.
+ */
+TTariffBand Tariff_Get_Band();
+
+/*! @brief Gets the version of the active table.
+ *
+ *  @return uint16_t - the version it was uploaded with, 0 for the built in table.
+ */
+uint16_t Tariff_Get_Version();
 
-extern const Tariff_Values TARIFFS_VALUES;
+/*! @brief Starts uploading a new table into the inactive RAM copy.
+ *
+ *  @return bool - TRUE if the upload was started.
+ */
+bool Tariff_Upload_Begin();
 
-extern const Tariff_Time_Range TARIFF_TIME_RANGE;
+/*! @brief Appends the next bytes of the table being uploaded.
+ *
+ *  @param data The bytes.
+ *  @param length The number of bytes.
+ *  @return bool - TRUE if the bytes were taken, FALSE if no upload was started.
+ */
+bool Tariff_Upload_Data(const uint8_t data[], const uint8_t length);
 
+/*! @brief Checks the uploaded table and queues it for the flash thread to write to the older bank.
+ *
+ *  The table is swapped in from the flash thread once it has been saved, and the callback is called after that.
+ *  Another upload can't be started until then.
+ *  @param callback Called from the flash thread with whether the table was saved and swapped in, can be NULL.
+ *  @param argument Passed to the callback.
+ *  @return bool - TRUE if the table was good and has been queued.
+ */
+bool Tariff_Upload_Commit(const TFlashCallback callback, const uint32_t argument);
 
 #endif
@@ -0,0 +1,169 @@
+/*
+ * Telemetry.c
+ *
+ *  Created on: 14 Nov 2017
+ *      Author: 98112939
+ */
+
+#include "Telemetry.h"
+#include "TowerProtocol.h"
+#include "packet.h"
+#include "UART.h"
+#include "OS.h"
+
+typedef struct
+{
+  bool Active;
+  uint8_t Field;
+  uint8_t Period;          //as given to Telemetry_Subscribe
+  uint8_t Count;           //windows or seconds since the last sample was due
+  TTelemetryStats Stats;
+} TTelemetryStream;
+
+//changed by the protocol thread with interrupts off, so the calculate and RTC threads never see half a subscription
+static TTelemetryStream Streams[TELEMETRY_STREAMS_NB];
+
+//a bit for each stream with a sample due, set by the calculate and RTC threads and taken by the telemetry thread
+static uint8_t Pending;
+
+//signalled when Pending goes from none to some
+static OS_ECB *TelemetrySemaphore;
+
+/*! @brief Marks a stream's sample as due, a sample that's still waiting is coalesced into it.
+ */
+static void Due(const uint8_t stream)
+{
+  uint8_t bit = 1 << stream;
+
+  OS_DisableInterrupts();
+  bool wake = (Pending == 0);
+  if (Pending & bit)
+    Streams[stream].Stats.Dropped++;
+  Pending |= bit;
+  OS_EnableInterrupts();
+
+  if (wake)
+    OS_SemaphoreSignal(TelemetrySemaphore);
+}
+
+/*! @brief Counts a window or a second towards the streams with that kind of period.
+ *
+ *  @param inSeconds TRUE for a second, FALSE for a window.
+ */
+static void Count(const bool inSeconds)
+{
+  for (uint8_t stream = 0; stream < TELEMETRY_STREAMS_NB; stream++)
+  {
+    TTelemetryStream *s = &Streams[stream];
+    if (!s->Active || ((s->Period & TELEMETRY_IN_SECONDS) != 0) != inSeconds)
+      continue;
+
+    if (++s->Count >= (s->Period & TELEMETRY_PERIOD_MASK))
+    {
+      s->Count = 0;
+      Due(stream);
+    }
+  }
+}
+
+bool Telemetry_Init()
+{
+  //only the first time, this is retried until everything initialises
+  if (!TelemetrySemaphore)
+    TelemetrySemaphore = OS_SemaphoreCreate(0);
+
+  Pending = 0;
+  for (uint8_t stream = 0; stream < TELEMETRY_STREAMS_NB; stream++)
+    Streams[stream].Active = false;
+  return true;
+}
+
+bool Telemetry_Subscribe(const uint8_t stream, const uint8_t field, const uint8_t period)
+{
+  if (stream >= TELEMETRY_STREAMS_NB)
+    return false;
+  bool active = (field < TELEMETRY_FIELDS_NB);
+  if (active && (period & TELEMETRY_PERIOD_MASK) == 0)
+    return false;
+
+  OS_DisableInterrupts();
+  TTelemetryStream *s = &Streams[stream];
+  s->Active = active;
+  s->Field = field;
+  s->Period = period;
+  s->Count = 0;
+  s->Stats.Sent = 0;
+  s->Stats.Dropped = 0;
+  Pending &= ~(1 << stream);
+  OS_EnableInterrupts();
+  return true;
+}
+
+bool Telemetry_Get_Stats(const uint8_t stream, TTelemetryStats * const stats)
+{
+  if (stream >= TELEMETRY_STREAMS_NB)
+    return false;
+
+  OS_DisableInterrupts();
+  *stats = Streams[stream].Stats;
+  OS_EnableInterrupts();
+  return true;
+}
+
+void Telemetry_Window()
+{
+  Count(false);
+}
+
+void Telemetry_Tick()
+{
+  Count(true);
+}
+
+void Telemetry_Thread(void *pData)
+{
+  for (;;)
+  {
+    OS_SemaphoreWait(TelemetrySemaphore, 0);
+
+    //anything that falls due from here on wakes us again
+    OS_DisableInterrupts();
+    uint8_t pending = Pending;
+    Pending = 0;
+    OS_EnableInterrupts();
+
+    //every stream due now gets a value from the same window
+    TMeasurementsSnapshot snapshot;
+    Measurements_Get_Snapshot(&snapshot);
+    const uint32_t *fields = (const uint32_t *)&snapshot;
+
+    for (uint8_t stream = 0; stream < TELEMETRY_STREAMS_NB; stream++)
+    {
+      if (!(pending & (1 << stream)))
+        continue;
+
+      TTelemetryStream *s = &Streams[stream];
+      //unsubscribed since it fell due
+      if (!s->Active)
+        continue;
+
+      //a slow link drops samples rather than filling the FIFO, so nothing ever waits on telemetry
+      if (UART_OutFree() < 2 * PACKET_NB_BYTES + TELEMETRY_TX_RESERVE)
+      {
+        OS_DisableInterrupts();
+        s->Stats.Dropped++;
+        OS_EnableInterrupts();
+        continue;
+      }
+
+      uint32union_t value;
+      value.l = fields[s->Field];
+      Packet_Put(CMD_TELEMETRY, stream, value.s.Lo & 0xFF, value.s.Lo >> 8);
+      Packet_Put(CMD_TELEMETRY, stream | TELEMETRY_HIGH_HALF, value.s.Hi & 0xFF, value.s.Hi >> 8);
+
+      OS_DisableInterrupts();
+      s->Stats.Sent++;
+      OS_EnableInterrupts();
+    }
+  }
+}
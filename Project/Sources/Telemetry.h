@@ -0,0 +1,76 @@
+/*
+ * Telemetry.h
+ *
+ *  Created on: 14 Nov 2017
+ *      Author: 98112939
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include "types.h"
+#include "Measurements.h"
+
+//the number of subscriptions that can be running at once
+#define TELEMETRY_STREAMS_NB 8
+
+//every field of a TMeasurementsSnapshot is 32 bits, a stream sends one of them by its index
+#define TELEMETRY_FIELDS_NB (sizeof(TMeasurementsSnapshot) / sizeof(uint32_t))
+
+//period setting, when this bit is set the period is in seconds rather than measurement windows
+#define TELEMETRY_IN_SECONDS 0x80
+#define TELEMETRY_PERIOD_MASK 0x7F
+
+//a sample is only sent if the transmit FIFO still has this much space after it, so replies to commands are never held up
+#define TELEMETRY_TX_RESERVE 64
+
+typedef struct
+{
+  uint32_t Sent;     //samples sent
+  uint32_t Dropped;  //samples coalesced into a later one, or skipped because the link was busy
+} TTelemetryStats;
+
+/*! @brief Starts with no subscriptions.
+ *
+ *  @return bool - TRUE if telemetry was successfully initialized.
+ */
+bool Telemetry_Init();
+
+/*! @brief Starts, changes or stops a stream, its counters start again from zero.
+ *
+ *  @param stream The stream, 0 to TELEMETRY_STREAMS_NB - 1.
+ *  @param field The index of the field in TMeasurementsSnapshot, or TELEMETRY_FIELDS_NB or above to stop the stream.
+ *  @param period The number of windows between samples, 1 to 127, or the number of seconds if TELEMETRY_IN_SECONDS is set.
+ *  @return bool - TRUE if the subscription was valid.
+ */
+bool Telemetry_Subscribe(const uint8_t stream, const uint8_t field, const uint8_t period);
+
+/*! @brief Gets the counters of a stream.
+ *
+ *  @param stream The stream.
+ *  @param stats Set to the counters.
+ *  @return bool - TRUE if the stream exists.
+ */
+bool Telemetry_Get_Stats(const uint8_t stream, TTelemetryStats * const stats);
+
+/*! @brief Counts a measurement window towards the streams with their period in windows.
+ *
+ *  Only marks the streams that are due, the sending is left to the telemetry thread so the calculate thread never waits on the UART.
+ *  @note Called by the calculate thread at the end of every window.
+ */
+void Telemetry_Window();
+
+/*! @brief Counts a second towards the streams with their period in seconds.
+ *
+ *  @note Called once a second by the RTC thread.
+ */
+void Telemetry_Tick();
+
+/*! @brief Sends the samples that are due, from one snapshot of the registers.
+ *
+ *  @param pData Unused.
+ *  @note Takes snapshots, so it must be lower priority than the calculate thread.
+ */
+void Telemetry_Thread(void *pData);
+
+#endif
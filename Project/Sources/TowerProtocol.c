@@ -12,10 +12,66 @@
 #include "Flash.h"
 #include "RTC.h"
 #include "SelfTest.h"
+#include "PLL.h"
+#include "Load.h"
+#include "Harmonics.h"
+#include "Cpu.h"
+#include "LoadProfile.h"
+#include "Demand.h"
+#include "Telemetry.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 
+//the command of the packet being handled without the ACK bit, the packet itself is read only
+static uint8_t Command;
+
+//set while handling a packet that asked for an ACK
+static bool AckRequested;
+
+//set by a command that saves to flash, its ACK is sent by the flash thread once the value is saved
+static bool AckDeferred;
+
+/*! @brief Queues a variable to be saved to flash, deferring the ACK until it has been
+ *
+ *  @return bool Returns true if the write was queued.
+ */
+static bool SaveVariable(volatile void * const address, const uint32_t data, const uint8_t size);
+
+/*! @brief Queues an erase of every flash variable, deferring the ACK until it is done
+ *
+ *  @return bool Returns true if the erase was queued.
+ */
+static bool EraseVariables();
+
+/*! @brief Packs the packet being handled into the argument of a deferred ACK
+ *
+ *  @return uint32_t The command and parameters.
+ */
+static uint32_t AckArgument();
+
+/*! @brief Sends the deferred ACK or NAK once a flash write is done
+ *
+ *  @param argument The packet being acknowledged, command in the top byte then the three parameters.
+ *  @param success Whether the value was saved.
+ */
+static void SaveAck(const uint32_t argument, const bool success);
+
+/*! @brief Queues the uploaded tariff table to be saved, deferring the ACK until it has been
+ *
+ *  @param ack Sends the ACK, for a packet or a frame.
+ *  @param argument Passed to ack.
+ *  @return bool Returns true if the table was good and has been queued.
+ */
+static bool CommitTariff(const TFlashCallback ack, const uint32_t argument);
+
+/*! @brief Sends the deferred ACK or NAK of a frame once the flash thread is done
+ *
+ *  @param argument The command being acknowledged.
+ *  @param success Whether it was saved.
+ */
+static void FrameAck(const uint32_t argument, const bool success);
+
 /*! @brief Sends the tower version packet
  *
  *  @return bool
@@ -78,6 +134,176 @@ static bool SelfTestSetCurrentStep();
 
 static bool SelfTestSetPhaseStep();
 
+/*! @brief Sends the sampling PLL lock state and how long it took to lock
+ *
+ *  @return bool
+ */
+static bool PLLStatusPacket();
+
+/*! @brief Gets or sets the measurement window length
+ *
+ *  @return bool
+ */
+static bool WindowPacket();
+
+/*! @brief Gets or sets the number of samples taken each mains cycle
+ *
+ *  @return bool
+ */
+static bool SampleRatePacket();
+
+/*! @brief Sends the CPU utilisation, the sample rate decimation and the sampling ISR times
+ *
+ *  @return bool
+ */
+static bool CPUStatsPacket();
+
+static bool ApparentPowerPacket();
+
+/*! @brief Sends the reactive power in var, as a signed 16 bit value
+ *
+ *  @return bool
+ */
+static bool ReactivePowerPacket();
+
+/*! @brief Sends the displacement power factor times 1000, as a signed 16 bit value
+ *
+ *  @return bool
+ */
+static bool DisplacementPFPacket();
+
+/*! @brief Sends one of the four quadrant energy registers in Wh or varh, param1 selects the register
+ *
+ *  @return bool
+ */
+static bool EnergyRegistersPacket();
+
+/*! @brief Sends the rms of a harmonic, param1 is the harmonic number with bit 7 set for current, harmonic 0 is the rms of the whole cycle
+ *
+ *  @return bool
+ */
+static bool HarmonicPacket();
+
+/*! @brief Sends the phase of a harmonic in tenths of a degree, param1 as for HarmonicPacket
+ *
+ *  @return bool
+ */
+static bool HarmonicPhasePacket();
+
+/*! @brief Sends the voltage and current THD in hundredths of a percent
+ *
+ *  @return bool
+ */
+static bool THDPacket();
+
+/*! @brief Starts or commits a tariff table upload, or sends the active table's version
+ *
+ *  @return bool
+ */
+static bool TariffUploadPacket();
+
+/*! @brief Adds the three parameter bytes to the tariff table being uploaded
+ *
+ *  @return bool
+ */
+static bool TariffDataPacket();
+
+/*! @brief Sets the start of the load profile range, in minutes of RTC time
+ *
+ *  @return bool
+ */
+static bool ProfileFromPacket();
+
+/*! @brief Sends every load profile record from the start of the range to the given minute
+ *
+ *  @return bool
+ */
+static bool ProfileToPacket();
+
+/*! @brief Sends a load profile record as a packet for each field
+ *
+ *  @param record The record.
+ */
+static void SendProfileRecord(const TProfileRecord * const record);
+
+/*! @brief Handles the load profile interval packet
+ *
+ *  @return bool
+ */
+static bool ProfileIntervalPacket();
+
+/*! @brief Handles the demand window packet
+ *
+ *  @return bool
+ */
+static bool DemandSettingsPacket();
+
+/*! @brief Sends a maximum demand register, or the present demand
+ *
+ *  @return bool
+ */
+static bool DemandPacket();
+
+/*! @brief Ends the billing period for the maximum demand registers
+ *
+ *  @return bool
+ */
+static bool DemandResetPacket();
+
+/*! @brief Sends or clears the packet framer's error counters
+ *
+ *  @return bool
+ */
+static bool PacketStatsPacket();
+
+/*! @brief Sends every register from the same window in one burst
+ *
+ *  @return bool
+ */
+static bool SnapshotPacket();
+
+/*! @brief Starts, changes or stops a telemetry stream
+ *
+ *  @return bool
+ */
+static bool SubscribePacket();
+
+/*! @brief Sends the sent and dropped counts of a telemetry stream
+ *
+ *  @return bool
+ */
+static bool TelemetryStatsPacket();
+
+/*! @brief Sends the tower version in a frame
+ *
+ *  @return bool
+ */
+static bool VersionFrame();
+
+/*! @brief Sends every register from the same window in one frame
+ *
+ *  @return bool
+ */
+static bool SnapshotFrame();
+
+/*! @brief Starts or commits a tariff table upload, or sends the active table's version, from a frame
+ *
+ *  @return bool
+ */
+static bool TariffUploadFrame();
+
+/*! @brief Adds the whole payload of a frame to the tariff table being uploaded
+ *
+ *  @return bool
+ */
+static bool TariffDataFrame();
+
+/*! @brief Sends every framer error counter in one frame, or clears them
+ *
+ *  @return bool
+ */
+static bool PacketStatsFrame();
+
 
 /*! @brief Allows the user to write on a particular flash address.
  *
@@ -94,13 +320,16 @@ void TowerProtocol_Handle_Packet()
   //ack command true if ack packet and success true if command successful.
   bool ackCommand = false, success = false;
   //if ack, flip command bit
-  if (Packet_Command & PACKET_ACK_MASK)
+  Command = Packet_Command;
+  if (Command & PACKET_ACK_MASK)
   {
     ackCommand = true;
-    Packet_Command ^= PACKET_ACK_MASK;
+    Command ^= PACKET_ACK_MASK;
   }
+  AckRequested = ackCommand;
+  AckDeferred = false;
 
-  switch (Packet_Command)
+  switch (Command)
   {
     //detect startup command
     case CMD_STARTUP:
@@ -168,22 +397,136 @@ void TowerProtocol_Handle_Packet()
     case CMD_SET_PHASE_STEP:
       success = SelfTestSetPhaseStep();
       break;
+    case CMD_PLL_STATUS:
+      success = PLLStatusPacket();
+      break;
+    case CMD_WINDOW:
+      success = WindowPacket();
+      break;
+    case CMD_SAMPLE_RATE:
+      success = SampleRatePacket();
+      break;
+    case CMD_CPU_STATS:
+      success = CPUStatsPacket();
+      break;
+    case CMD_APPARENT_POWER:
+      success = ApparentPowerPacket();
+      break;
+    case CMD_REACTIVE_POWER:
+      success = ReactivePowerPacket();
+      break;
+    case CMD_DISPLACEMENT_PF:
+      success = DisplacementPFPacket();
+      break;
+    case CMD_ENERGY_REGISTERS:
+      success = EnergyRegistersPacket();
+      break;
+    case CMD_HARMONIC:
+      success = HarmonicPacket();
+      break;
+    case CMD_HARMONIC_PHASE:
+      success = HarmonicPhasePacket();
+      break;
+    case CMD_THD:
+      success = THDPacket();
+      break;
+    case CMD_TARIFF_UPLOAD:
+      success = TariffUploadPacket();
+      break;
+    case CMD_TARIFF_DATA:
+      success = TariffDataPacket();
+      break;
+    case CMD_PROFILE_FROM:
+      success = ProfileFromPacket();
+      break;
+    case CMD_PROFILE_TO:
+      success = ProfileToPacket();
+      break;
+    case CMD_PROFILE_INTERVAL:
+      success = ProfileIntervalPacket();
+      break;
+    case CMD_DEMAND_SETTINGS:
+      success = DemandSettingsPacket();
+      break;
+    case CMD_DEMAND:
+      success = DemandPacket();
+      break;
+    case CMD_DEMAND_RESET:
+      success = DemandResetPacket();
+      break;
+    case CMD_PACKET_STATS:
+      success = PacketStatsPacket();
+      break;
+    case CMD_SNAPSHOT:
+      success = SnapshotPacket();
+      break;
+    case CMD_SUBSCRIBE:
+      success = SubscribePacket();
+      break;
+    case CMD_TELEMETRY_STATS:
+      success = TelemetryStatsPacket();
+      break;
     default:
-      Packet_Put(Packet_Command, 'N', '/', 'A');
+      Packet_Put(Command, 'N', '/', 'A');
       success = false;
       break;
   }
   //if success flip command bit again and send
-  if (ackCommand)
+  if (ackCommand && !AckDeferred)
+  {
     if (success)
-      Packet_Put(Packet_Command ^ PACKET_ACK_MASK, Packet_Parameter1,
+      Packet_Put(Command ^ PACKET_ACK_MASK, Packet_Parameter1,
       Packet_Parameter2,
                  Packet_Parameter3);
     else
-      Packet_Put(Packet_Command, Packet_Parameter1, Packet_Parameter2,
+      Packet_Put(Command, Packet_Parameter1, Packet_Parameter2,
       Packet_Parameter3);
+  }
  }
 
+/*! @brief Handles a frame by executing the command operation.
+ *
+ *  @return void
+ */
+void TowerProtocol_Handle_Frame()
+{
+  bool ackCommand = false, success = false;
+  Command = Frame->Command;
+  if (Command & PACKET_ACK_MASK)
+  {
+    ackCommand = true;
+    Command ^= PACKET_ACK_MASK;
+  }
+  AckRequested = ackCommand;
+  AckDeferred = false;
+
+  switch (Command)
+  {
+    case CMD_VERSION:
+      success = VersionFrame();
+      break;
+    case CMD_TARIFF_UPLOAD:
+      success = TariffUploadFrame();
+      break;
+    case CMD_TARIFF_DATA:
+      success = TariffDataFrame();
+      break;
+    case CMD_PACKET_STATS:
+      success = PacketStatsFrame();
+      break;
+    case CMD_SNAPSHOT:
+      success = SnapshotFrame();
+      break;
+    default:
+      Frame_Put(Command, "N/A", 3);
+      success = false;
+      break;
+  }
+  //the same as a packet, but without the payload, it could be up to 255 bytes
+  if (ackCommand && !AckDeferred)
+    Frame_Put(success ? Command ^ PACKET_ACK_MASK : Command, NULL, 0);
+}
+
 /*! @brief Calls the startup function to send the start up packets (i.e. startup, version and tower number)
  *
  *  @return bool
@@ -216,7 +559,7 @@ static bool TNumberFunction()
     uint16union_t newTowerNumber;
     newTowerNumber.s.Lo = Packet_Parameter2;
     newTowerNumber.s.Hi = Packet_Parameter3;
-    return Flash_Write16((uint16_t*)TowerNumber, newTowerNumber.l);
+    return SaveVariable(TowerNumber, newTowerNumber.l, sizeof(uint16_t));
   }
   //get tower number
   else if (Packet_Parameter1 == 1)
@@ -244,7 +587,7 @@ static bool TModeFunction()
     uint16union_t newTowerMode;
     newTowerMode.s.Lo = Packet_Parameter2;
     newTowerMode.s.Hi = Packet_Parameter3;
-    return Flash_Write16((uint16_t*)TowerMode, newTowerMode.l);
+    return SaveVariable(TowerMode, newTowerMode.l, sizeof(uint16_t));
   }
   //get tower mode
   else if (Packet_Parameter1 == 1)
@@ -268,10 +611,10 @@ static bool ProgramFunction()
   if (Packet_Parameter1 > 0x08) //out of bounds
     return false;
   if (Packet_Parameter1 == ERASE_SECTOR) //erase sector command
-    return Flash_Erase();
+    return EraseVariables();
   else
     //program byte
-    return ProgramByte((uint8_t*) FLASH_DATA_START + Packet_Parameter1,
+    return ProgramByte((uint8_t*) Flash_Get_Variable(Packet_Parameter1),
     Packet_Parameter3);
 }
 
@@ -283,7 +626,7 @@ static bool ReadFunction()
 {
   if (Packet_Parameter1 < 0x08)
   {
-    uint8_t byte = *((uint8_t *)(FLASH_DATA_START + Packet_Parameter1));
+    uint8_t byte = *Flash_Get_Variable(Packet_Parameter1);
     Packet_Put(CMD_READ_BYTE, Packet_Parameter1, 0, byte);
     return true;
   }
@@ -340,11 +683,11 @@ bool TestModePacket()
 bool TarrifPacket()
 {
   //get which tariff is selected and write to flash
-  uint8_t tariffIndex;
-  if (tariffIndex >= 1 && tariffIndex <= 3)
+  uint8_t tariffIndex = Packet_Parameter1;
+  if (tariffIndex >= 1 && tariffIndex <= TARIFFS_NB)
   {
     //write to flash
-    return Flash_Write8((uint8_t *) Tariff_Loaded, tariffIndex);
+    return SaveVariable(Tariff_Loaded, tariffIndex, sizeof(uint8_t));
   }
   else
     return false;
@@ -373,7 +716,8 @@ bool TimePacket(uint8_t timeVal)
 bool PowerPacket()
 {
   uint16union_t power;
-  power.l = (uint16_t) Basic_Measurements.AveragePower;
+  //signed, negative when exporting
+  power.l = (int16_t) Basic_Measurements.AveragePower;
   Packet_Put(CMD_POWER, power.s.Lo, power.s.Hi, 0);
   return true;
 }
@@ -389,8 +733,9 @@ bool EnergyPacket()
 bool CostPacket()
 {
   int real, frac;
-  real = Basic_Measurements.TotalCost;
-  frac = trunc((Basic_Measurements.TotalCost - real) * 100);
+  double cost = Measurements_Get_Cost();
+  real = cost;
+  frac = trunc((cost - real) * 100);
   if (real > 255)
   {
     uint16union_t dollars;
@@ -453,6 +798,492 @@ bool SelfTestSetPhaseStep()
   return SelfTest_Set_Phase_Step(step);
 }
 
+bool PLLStatusPacket()
+{
+  //lock time in ms, saturates at 65.535 seconds
+  uint32_t lockTime = PLL_Get_Lock_Time();
+  uint16union_t time;
+  time.l = lockTime > 0xFFFF ? 0xFFFF : lockTime;
+  Packet_Put(CMD_PLL_STATUS, PLL_Get_State() == PLL_LOCKED, time.s.Lo, time.s.Hi);
+  return true;
+}
+
+bool WindowPacket()
+{
+  //set window, param2 is the sample count or WINDOW_IN_CYCLES | cycle count
+  if (Packet_Parameter1 == 2)
+  {
+    if (!Measurements_Set_Window(Packet_Parameter2))
+      return false;
+    return SaveVariable(Window_Saved, Packet_Parameter2, sizeof(uint8_t));
+  }
+  //get window
+  else if (Packet_Parameter1 == 1)
+  {
+    Packet_Put(CMD_WINDOW, Packet_Parameter1, Measurements_Get_Window(), 0);
+    return true;
+  }
+  return false;
+}
+
+bool SampleRatePacket()
+{
+  //set samples per cycle
+  if (Packet_Parameter1 == 2)
+  {
+    uint16union_t samplesPerCycle;
+    samplesPerCycle.s.Lo = Packet_Parameter2;
+    samplesPerCycle.s.Hi = Packet_Parameter3;
+    if (!Measurements_Set_Samples_Per_Cycle(samplesPerCycle.l))
+      return false;
+    return SaveVariable(Samples_Per_Cycle_Saved, samplesPerCycle.l, sizeof(uint16_t));
+  }
+  //get samples per cycle
+  else if (Packet_Parameter1 == 1)
+  {
+    uint16union_t samplesPerCycle;
+    samplesPerCycle.l = Measurements_Get_Samples_Per_Cycle();
+    Packet_Put(CMD_SAMPLE_RATE, Packet_Parameter1, samplesPerCycle.s.Lo, samplesPerCycle.s.Hi);
+    return true;
+  }
+  return false;
+}
+
+bool CPUStatsPacket()
+{
+  //ISR times are in core clock cycles and saturate at 16 bits
+  uint32_t isrMax = Load_Get_ISR_Max();
+  uint32_t isrAverage = Load_Get_ISR_Average();
+  uint16union_t max, average;
+  max.l = isrMax > 0xFFFF ? 0xFFFF : isrMax;
+  average.l = isrAverage > 0xFFFF ? 0xFFFF : isrAverage;
+
+  Packet_Put(CMD_CPU_STATS, 1, Load_Get_CPU(), Measurements_Get_Decimation());
+  Packet_Put(CMD_CPU_STATS, 2, max.s.Lo, max.s.Hi);
+  Packet_Put(CMD_CPU_STATS, 3, average.s.Lo, average.s.Hi);
+
+  //last harmonic analysis in microseconds
+  uint32_t analysis = Harmonics_Get_Cycles() / (CPU_CORE_CLK_HZ / 1000000);
+  uint16union_t time;
+  time.l = analysis > 0xFFFF ? 0xFFFF : analysis;
+  Packet_Put(CMD_CPU_STATS, 4, time.s.Lo, time.s.Hi);
+  return true;
+}
+
+bool ApparentPowerPacket()
+{
+  uint16union_t apparentPower;
+  apparentPower.l = (uint16_t) Intermediate_Measurements.ApparentPower;
+  Packet_Put(CMD_APPARENT_POWER, apparentPower.s.Lo, apparentPower.s.Hi, 0);
+  return true;
+}
+
+bool ReactivePowerPacket()
+{
+  uint16union_t reactivePower;
+  reactivePower.l = (int16_t) Intermediate_Measurements.ReactivePower;
+  Packet_Put(CMD_REACTIVE_POWER, reactivePower.s.Lo, reactivePower.s.Hi, 0);
+  return true;
+}
+
+bool DisplacementPFPacket()
+{
+  uint16union_t powerFactor;
+  powerFactor.l = (int16_t) (Intermediate_Measurements.DisplacementPowerFactor * 1000);
+  Packet_Put(CMD_DISPLACEMENT_PF, powerFactor.s.Lo, powerFactor.s.Hi, 0);
+  return true;
+}
+
+bool EnergyRegistersPacket()
+{
+  double energy;
+  if (Packet_Parameter1 > 3)
+    return false;
+
+  //the calculate thread is higher priority, keep it from updating the register half way through the copy
+  OS_DisableInterrupts();
+  //0 import kWh, 1 export kWh, 2 import kvarh, 3 export kvarh
+  switch (Packet_Parameter1)
+  {
+    case 0:
+      energy = Basic_Measurements.TotalEnergy;
+      break;
+    case 1:
+      energy = Basic_Measurements.ExportEnergy;
+      break;
+    case 2:
+      energy = Basic_Measurements.ImportReactiveEnergy;
+      break;
+    default:
+      energy = Basic_Measurements.ExportReactiveEnergy;
+      break;
+  }
+  OS_EnableInterrupts();
+
+  //sent in Wh, saturates at 65.535 kWh
+  uint16union_t wattHours;
+  energy *= 1000;
+  wattHours.l = energy > 0xFFFF ? 0xFFFF : (uint16_t) energy;
+  Packet_Put(CMD_ENERGY_REGISTERS, Packet_Parameter1, wattHours.s.Lo, wattHours.s.Hi);
+  return true;
+}
+
+/*! @brief Looks up the harmonic channel asked for in param1.
+ *
+ *  @param harmonic Set to the harmonic number, 0 for the whole cycle.
+ *  @return const THarmonicsChannel * - the channel, NULL if there's no such harmonic in the latest analysis.
+ */
+static const THarmonicsChannel *RequestedHarmonic(uint8_t * const harmonic)
+{
+  const THarmonics *harmonics = Harmonics_Get();
+  uint8_t channel = (Packet_Parameter1 & 0x80) ? HARMONICS_CURRENT : HARMONICS_VOLTAGE;
+  *harmonic = Packet_Parameter1 & 0x7F;
+  if (harmonics->HarmonicsNb == 0 || *harmonic > harmonics->HarmonicsNb)
+    return NULL;
+  return &harmonics->Channels[channel];
+}
+
+bool HarmonicPacket()
+{
+  uint8_t harmonic;
+  const THarmonicsChannel *channel = RequestedHarmonic(&harmonic);
+  if (!channel)
+    return false;
+
+  //voltage in hundredths of a volt, current in mA
+  float scale = (Packet_Parameter1 & 0x80) ? 1000 : 100;
+  float value = channel->Magnitude[harmonic] * scale;
+  uint16union_t magnitude;
+  magnitude.l = value > 0xFFFF ? 0xFFFF : (uint16_t) value;
+  Packet_Put(CMD_HARMONIC, Packet_Parameter1, magnitude.s.Lo, magnitude.s.Hi);
+  return true;
+}
+
+bool HarmonicPhasePacket()
+{
+  uint8_t harmonic;
+  const THarmonicsChannel *channel = RequestedHarmonic(&harmonic);
+  //the whole cycle has no phase
+  if (!channel || harmonic == 0)
+    return false;
+
+  uint16union_t phase;
+  phase.l = (int16_t) (channel->Phase[harmonic] * 10);
+  Packet_Put(CMD_HARMONIC_PHASE, Packet_Parameter1, phase.s.Lo, phase.s.Hi);
+  return true;
+}
+
+bool THDPacket()
+{
+  const THarmonics *harmonics = Harmonics_Get();
+  for (uint8_t channel = HARMONICS_VOLTAGE; channel <= HARMONICS_CURRENT; channel++)
+  {
+    float value = harmonics->Channels[channel].THD * 10000;
+    uint16union_t thd;
+    thd.l = value > 0xFFFF ? 0xFFFF : (uint16_t) value;
+    Packet_Put(CMD_THD, channel, thd.s.Lo, thd.s.Hi);
+  }
+  return true;
+}
+
+bool TariffUploadPacket()
+{
+  //0xFE starts an upload, 0xFF checks and saves it
+  if (Packet_Parameter1 == 0xFE)
+    return Tariff_Upload_Begin();
+  if (Packet_Parameter1 == 0xFF)
+    return CommitTariff(SaveAck, AckArgument());
+
+  if (Packet_Parameter1 == 1)
+  {
+    uint16union_t version;
+    version.l = Tariff_Get_Version();
+    Packet_Put(CMD_TARIFF_UPLOAD, 1, version.s.Lo, version.s.Hi);
+    return true;
+  }
+  return false;
+}
+
+bool TariffDataPacket()
+{
+  const uint8_t data[3] = {Packet_Parameter1, Packet_Parameter2, Packet_Parameter3};
+  return Tariff_Upload_Data(data, sizeof(data));
+}
+
+//the start of the load profile range, set by CMD_PROFILE_FROM
+static uint32_t ProfileFrom;
+
+bool ProfileFromPacket()
+{
+  ProfileFrom = Packet_Parameter1 | ((uint32_t)Packet_Parameter2 << 8) | ((uint32_t)Packet_Parameter3 << 16);
+  return true;
+}
+
+bool ProfileToPacket()
+{
+  uint32_t to = Packet_Parameter1 | ((uint32_t)Packet_Parameter2 << 8) | ((uint32_t)Packet_Parameter3 << 16);
+  if (to < ProfileFrom)
+    return false;
+
+  //the whole of the last minute is included
+  uint16union_t count;
+  count.l = LoadProfile_Read(ProfileFrom * 60, to * 60 + 59, SendProfileRecord);
+  Packet_Put(CMD_PROFILE_RECORD, PROFILE_END, count.s.Lo, count.s.Hi);
+  return true;
+}
+
+/*! @brief Sends one field of a load profile record
+ *
+ *  @param field The field.
+ *  @param value The value.
+ */
+static void SendProfileField(const PROFILE_FIELD field, const uint16_t value)
+{
+  uint16union_t field16;
+  field16.l = value;
+  Packet_Put(CMD_PROFILE_RECORD, field, field16.s.Lo, field16.s.Hi);
+}
+
+void SendProfileRecord(const TProfileRecord * const record)
+{
+  uint32_t minutes = record->Time / 60;
+  int32_t power = record->AveragePower;
+  if (power > INT16_MAX)
+    power = INT16_MAX;
+  else if (power < INT16_MIN)
+    power = INT16_MIN;
+
+  SendProfileField(PROFILE_TIME_LO, minutes);
+  SendProfileField(PROFILE_TIME_HI, minutes >> 16);
+  SendProfileField(PROFILE_IMPORT, record->ImportEnergy > 0xFFFF ? 0xFFFF : record->ImportEnergy);
+  SendProfileField(PROFILE_EXPORT, record->ExportEnergy > 0xFFFF ? 0xFFFF : record->ExportEnergy);
+  SendProfileField(PROFILE_POWER, (int16_t)power);
+  SendProfileField(PROFILE_VOLTAGE, record->Voltage);
+  SendProfileField(PROFILE_CURRENT, record->Current);
+  SendProfileField(PROFILE_FREQUENCY, record->Frequency);
+}
+
+bool ProfileIntervalPacket()
+{
+  //set interval in minutes
+  if (Packet_Parameter1 == 2)
+  {
+    if (!LoadProfile_Set_Interval(Packet_Parameter2))
+      return false;
+    return SaveVariable(Profile_Interval_Saved, Packet_Parameter2, sizeof(uint8_t));
+  }
+  //get interval
+  else if (Packet_Parameter1 == 1)
+  {
+    Packet_Put(CMD_PROFILE_INTERVAL, Packet_Parameter1, LoadProfile_Get_Interval(), 0);
+    return true;
+  }
+  return false;
+}
+
+bool DemandSettingsPacket()
+{
+  //set sub-interval in minutes and number of sub-intervals
+  if (Packet_Parameter1 == 2)
+  {
+    if (!Demand_Set(Packet_Parameter2, Packet_Parameter3))
+      return false;
+    uint16union_t setting;
+    setting.s.Lo = Packet_Parameter2;
+    setting.s.Hi = Packet_Parameter3;
+    return SaveVariable(Demand_Saved, setting.l, sizeof(uint16_t));
+  }
+  //get window
+  else if (Packet_Parameter1 == 1)
+  {
+    Packet_Put(CMD_DEMAND_SETTINGS, Packet_Parameter1, Demand_Get_Subinterval(), Demand_Get_Setting());
+    return true;
+  }
+  return false;
+}
+
+/*! @brief Sends one field of a demand reply, saturated at 16 bits
+ *
+ *  @param field The field.
+ *  @param value The value.
+ */
+static void SendDemandField(const DEMAND_FIELD field, const uint32_t value)
+{
+  uint16union_t field16;
+  field16.l = value > 0xFFFF ? 0xFFFF : value;
+  Packet_Put(CMD_DEMAND, field, field16.s.Lo, field16.s.Hi);
+}
+
+bool DemandPacket()
+{
+  if (Packet_Parameter1 == DEMAND_REQUEST_PRESENT)
+  {
+    SendDemandField(DEMAND_PRESENT, Demand_Get_Present());
+    return true;
+  }
+
+  TDemandMax max;
+  if (!Demand_Get_Max(Packet_Parameter1, Packet_Parameter2, &max))
+    return false;
+
+  uint32_t minutes = max.Time / 60;
+  SendDemandField(DEMAND_VALUE, max.Demand);
+  SendDemandField(DEMAND_TIME_LO, minutes & 0xFFFF);
+  SendDemandField(DEMAND_TIME_HI, minutes >> 16);
+  return true;
+}
+
+bool DemandResetPacket()
+{
+  Demand_Reset();
+  return true;
+}
+
+/*! @brief Sends one of the packet framer's counters, saturated at 16 bits
+ *
+ *  @param field The field.
+ *  @param value The count.
+ */
+static void SendStatsField(const STATS_FIELD field, const uint32_t value)
+{
+  uint16union_t field16;
+  field16.l = value > 0xFFFF ? 0xFFFF : value;
+  Packet_Put(CMD_PACKET_STATS, field, field16.s.Lo, field16.s.Hi);
+}
+
+bool PacketStatsPacket()
+{
+  //clear counters
+  if (Packet_Parameter1 == 2)
+  {
+    Packet_Clear_Stats();
+    return true;
+  }
+  //get counters
+  else if (Packet_Parameter1 == 1)
+  {
+    TPacketStats stats;
+    Packet_Get_Stats(&stats);
+    SendStatsField(STATS_CHECKSUM_ERRORS, stats.ChecksumErrors);
+    SendStatsField(STATS_RESYNCS, stats.Resyncs);
+    SendStatsField(STATS_DISCARDED_BYTES, stats.DiscardedBytes);
+    SendStatsField(STATS_DROPPED_PACKETS, stats.DroppedPackets);
+    SendStatsField(STATS_CRC_ERRORS, stats.CRCErrors);
+    return true;
+  }
+  return false;
+}
+
+bool SnapshotPacket()
+{
+  //padded to a whole number of packets
+  union
+  {
+    TMeasurementsSnapshot Snapshot;
+    uint8_t Bytes[(sizeof(TMeasurementsSnapshot) + 2) / 3 * 3];
+  } burst;
+  //= {0} would only clear the snapshot, the padding after it is sent too
+  memset(&burst, 0, sizeof(burst));
+  Measurements_Get_Snapshot(&burst.Snapshot);
+
+  //a header with the layout, then 3 bytes of the snapshot in every packet
+  uint8_t packetsNb = sizeof(burst.Bytes) / 3;
+  Packet_Put(CMD_SNAPSHOT, SNAPSHOT_VERSION, sizeof(TMeasurementsSnapshot), packetsNb);
+  for (uint8_t i = 0; i < sizeof(burst.Bytes); i += 3)
+    Packet_Put(CMD_SNAPSHOT_DATA, burst.Bytes[i], burst.Bytes[i + 1], burst.Bytes[i + 2]);
+  return true;
+}
+
+bool SubscribePacket()
+{
+  //param1 is the stream, param2 the snapshot field and param3 the period
+  return Telemetry_Subscribe(Packet_Parameter1, Packet_Parameter2, Packet_Parameter3);
+}
+
+bool TelemetryStatsPacket()
+{
+  TTelemetryStats stats;
+  if (!Telemetry_Get_Stats(Packet_Parameter1, &stats))
+    return false;
+
+  uint16union_t count;
+  count.l = stats.Sent > 0xFFFF ? 0xFFFF : stats.Sent;
+  Packet_Put(CMD_TELEMETRY_STATS, Packet_Parameter1, count.s.Lo, count.s.Hi);
+  count.l = stats.Dropped > 0xFFFF ? 0xFFFF : stats.Dropped;
+  Packet_Put(CMD_TELEMETRY_STATS, Packet_Parameter1 | TELEMETRY_HIGH_HALF, count.s.Lo, count.s.Hi);
+  return true;
+}
+
+bool VersionFrame()
+{
+  const uint8_t version[3] = {'v', MAJ_VER, MIN_VER};
+  Frame_Put(CMD_VERSION, version, sizeof(version));
+  return true;
+}
+
+bool SnapshotFrame()
+{
+  TMeasurementsSnapshot snapshot;
+  Measurements_Get_Snapshot(&snapshot);
+
+  //the layout, then the whole snapshot, the same bytes as the CMD_SNAPSHOT_DATA packets without the padding
+  uint8_t reply[1 + sizeof(TMeasurementsSnapshot)];
+  reply[0] = SNAPSHOT_VERSION;
+  memcpy(&reply[1], &snapshot, sizeof(snapshot));
+  Frame_Put(CMD_SNAPSHOT, reply, sizeof(reply));
+  return true;
+}
+
+bool TariffUploadFrame()
+{
+  if (Frame->Length < 1)
+    return false;
+
+  //the same as the packet, param1 is the first byte of the payload
+  if (Frame->Payload[0] == 0xFE)
+    return Tariff_Upload_Begin();
+  if (Frame->Payload[0] == 0xFF)
+    return CommitTariff(FrameAck, Command);
+
+  if (Frame->Payload[0] == 1)
+  {
+    uint16union_t version;
+    version.l = Tariff_Get_Version();
+    const uint8_t reply[3] = {1, version.s.Lo, version.s.Hi};
+    Frame_Put(CMD_TARIFF_UPLOAD, reply, sizeof(reply));
+    return true;
+  }
+  return false;
+}
+
+bool TariffDataFrame()
+{
+  return Tariff_Upload_Data(Frame->Payload, Frame->Length);
+}
+
+bool PacketStatsFrame()
+{
+  if (Frame->Length < 1)
+    return false;
+
+  //clear counters
+  if (Frame->Payload[0] == 2)
+  {
+    Packet_Clear_Stats();
+    return true;
+  }
+  //get counters, all of them at full width in the order of STATS_FIELD
+  else if (Frame->Payload[0] == 1)
+  {
+    TPacketStats stats;
+    Packet_Get_Stats(&stats);
+    const uint32_t reply[] = {stats.ChecksumErrors, stats.Resyncs, stats.DiscardedBytes, stats.DroppedPackets, stats.CRCErrors};
+    Frame_Put(CMD_PACKET_STATS, reply, sizeof(reply));
+    return true;
+  }
+  return false;
+}
+
 //we need to ask if we need to check that the address is taken or not.
 /*! @brief Allows the user to write on a particular flash address.
  *
@@ -460,5 +1291,54 @@ bool SelfTestSetPhaseStep()
  */
 bool ProgramByte(uint8_t* address, uint8_t data)
 {
-  return Flash_Write8(address, data);
+  return SaveVariable(address, data, sizeof(uint8_t));
+}
+
+uint32_t AckArgument()
+{
+  return ((uint32_t)Command << 24) | ((uint32_t)Packet_Parameter1 << 16)
+      | ((uint32_t)Packet_Parameter2 << 8) | Packet_Parameter3;
+}
+
+bool SaveVariable(volatile void * const address, const uint32_t data, const uint8_t size)
+{
+  if (!Flash_Write_Async(address, data, size, AckRequested ? SaveAck : NULL, AckArgument()))
+    return false;
+
+  AckDeferred = AckRequested;
+  return true;
+}
+
+bool EraseVariables()
+{
+  //four sector erases busy wait, so they're left to the flash thread like the writes
+  if (!Flash_Erase_Async(AckRequested ? SaveAck : NULL, AckArgument()))
+    return false;
+
+  AckDeferred = AckRequested;
+  return true;
+}
+
+bool CommitTariff(const TFlashCallback ack, const uint32_t argument)
+{
+  //a sector erase and the whole table, left to the flash thread like the variables
+  if (!Tariff_Upload_Commit(AckRequested ? ack : NULL, argument))
+    return false;
+
+  AckDeferred = AckRequested;
+  return true;
+}
+
+void FrameAck(const uint32_t argument, const bool success)
+{
+  Frame_Put(success ? argument ^ PACKET_ACK_MASK : argument, NULL, 0);
+}
+
+void SaveAck(const uint32_t argument, const bool success)
+{
+  //same as an immediate ACK, the command bit is set on success and left clear on failure
+  uint8_t command = argument >> 24;
+  if (success)
+    command |= PACKET_ACK_MASK;
+  Packet_Put(command, argument >> 16, argument >> 8, argument);
 }
@@ -36,10 +36,94 @@ typedef enum
   CMD_SET_VOLTAGE_STEP = 0x1B,
   CMD_SET_CURRENT_STEP = 0x1C,
   CMD_SET_PHASE_STEP = 0x1D,
+  //sampling
+  CMD_PLL_STATUS = 0x1E,
+  CMD_WINDOW = 0x1F,
+  CMD_SAMPLE_RATE = 0x20,
+  CMD_CPU_STATS = 0x21,
+  //power quality
+  CMD_APPARENT_POWER = 0x22,
+  CMD_REACTIVE_POWER = 0x23,
+  CMD_DISPLACEMENT_PF = 0x24,
+  CMD_ENERGY_REGISTERS = 0x25,
+  CMD_HARMONIC = 0x26,
+  CMD_HARMONIC_PHASE = 0x27,
+  CMD_THD = 0x28,
+  CMD_TARIFF_UPLOAD = 0x29,
+  CMD_TARIFF_DATA = 0x2A,
+  CMD_PROFILE_FROM = 0x2B,
+  CMD_PROFILE_TO = 0x2C,
+  CMD_PROFILE_RECORD = 0x2D,
+  CMD_PROFILE_INTERVAL = 0x2E,
+  CMD_DEMAND_SETTINGS = 0x2F,
+  CMD_DEMAND = 0x30,
+  CMD_DEMAND_RESET = 0x31,
+  CMD_PACKET_STATS = 0x32,
+  CMD_SNAPSHOT = 0x33,
+  CMD_SNAPSHOT_DATA = 0x34,
+  CMD_TELEMETRY = 0x35,
+  CMD_SUBSCRIBE = 0x36,
+  CMD_TELEMETRY_STATS = 0x37,
 } CMD;
 
+//set in param1 of a CMD_TELEMETRY packet carrying the high 16 bits of a sample, or a CMD_TELEMETRY_STATS packet carrying the dropped count
+#define TELEMETRY_HIGH_HALF 0x80
+
+//the layout of the TMeasurementsSnapshot sent by CMD_SNAPSHOT, bumped whenever a field is added or changed
+#define SNAPSHOT_VERSION 1
+
+//param1 of a CMD_PROFILE_RECORD packet, each record is sent as a packet for each field with the value in param2 and param3
+typedef enum
+{
+  PROFILE_TIME_LO = 0,   //minutes of RTC time at the end of the interval
+  PROFILE_TIME_HI = 1,
+  PROFILE_IMPORT = 2,    //Wh
+  PROFILE_EXPORT = 3,    //Wh
+  PROFILE_POWER = 4,     //W, signed
+  PROFILE_VOLTAGE = 5,   //0.1 V
+  PROFILE_CURRENT = 6,   //mA
+  PROFILE_FREQUENCY = 7, //mHz
+  PROFILE_END = 0xFF,    //after the last record, with the number of records
+} PROFILE_FIELD;
+
+//param1 of a CMD_DEMAND request is the billing period, or this for the demand over the last window
+#define DEMAND_REQUEST_PRESENT 0xFF
+
+//param1 of a CMD_DEMAND reply, the value is in param2 and param3
+typedef enum
+{
+  DEMAND_VALUE = 0,      //W, saturated at 16 bits
+  DEMAND_TIME_LO = 1,    //minutes of RTC time at the end of the window
+  DEMAND_TIME_HI = 2,
+  DEMAND_PRESENT = 3,    //W, over the last window
+} DEMAND_FIELD;
+
+//param1 of a CMD_PACKET_STATS reply, the count is in param2 and param3, saturated at 16 bits
+typedef enum
+{
+  STATS_CHECKSUM_ERRORS = 0,
+  STATS_RESYNCS = 1,
+  STATS_DISCARDED_BYTES = 2,
+  STATS_DROPPED_PACKETS = 3,
+  STATS_CRC_ERRORS = 4,
+} STATS_FIELD;
+
+//frames use the same commands as packets, with the ACK bit, and reply in frames. The ones handled and their payloads are
+//  CMD_VERSION        request empty, reply 'v', major, minor
+//  CMD_SNAPSHOT       request empty, reply SNAPSHOT_VERSION then the TMeasurementsSnapshot, little endian
+//  CMD_TARIFF_UPLOAD  request 0xFE, 0xFF or 1 as param1 of the packet, reply to 1 is 1 then the version, little endian
+//  CMD_TARIFF_DATA    request up to 255 bytes of the table, no reply
+//  CMD_PACKET_STATS   request 1 or 2 as param1 of the packet, reply to 1 is every counter as 32 bits in STATS_FIELD order
+//an ACK frame has no payload
+
 void TowerProtocol_Handle_Packet();
 
+/*! @brief Handles a frame by executing the command operation.
+ *
+ *  @return void
+ */
+void TowerProtocol_Handle_Frame();
+
 /*! @brief Send the start up packets (i.e. startup, version and tower number)
  *
  *  @return void
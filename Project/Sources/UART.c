@@ -20,34 +20,34 @@
 #include "MK70F12.h"
 #include "Cpu.h"
 #include "../Library/OS.h"
+#include <string.h>
 //#define PORTE_MUX_MASK 0x180
 
-#define RxBUFFER_SIZE 256
-
-static uint8_t RxBuffer[RxBUFFER_SIZE];
-static uint16_t RxBufferStart;
-static uint16_t RxBufferEnd;
-
 static long long byteCount;
 
+//the ISR is the only producer of RxFIFO, TxAccess makes the threads putting to TxFIFO a single producer
 static TFIFO RxFIFO;
 static TFIFO TxFIFO;
+static OS_ECB *TxAccess;
 
-OS_ECB *RxSemaphore;
-OS_ECB *TxSemaphore;
+//the number of bytes the UART's own transmit FIFO holds
+static uint8_t TxFIFODepth;
+
+//given each received byte by the ISR instead of RxFIFO, if set
+static void (*ReceiveFunction)(const uint8_t data);
 
 static uint8_t TempVar;
-/*! @brief Gets data from FIFO and transmits. Disables the interrupt if FIFO is empty.
+/*! @brief Moves as much of TxFIFO into the UART's transmit FIFO as will fit. Disables the interrupt once TxFIFO is empty.
  *
  */
 static void SendData();
 
 
-bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk, void (*receiveFunction)(const uint8_t data))
 {
+  ReceiveFunction = receiveFunction;
 
-  RxSemaphore = OS_SemaphoreCreate(0);
-  TxSemaphore = OS_SemaphoreCreate(1);
+  TxAccess = OS_SemaphoreCreate(1);
   uint16union_t sbr;
   float sbrFloat, brfd_decimal;
   uint8_t brfd, sbr_uint;
@@ -56,9 +56,6 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
   FIFO_Init(&RxFIFO);
   FIFO_Init(&TxFIFO);
 
-  uint16_t RxBufferStart = 0;
-  uint16_t RxBufferEnd = 0;
-
   byteCount = 0;
 
   //enable UART2 and PORTE (PORT E shares pins with UART)
@@ -85,6 +82,14 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
   UART2_BDH = sbr.s.Hi;//write high value
   UART2_C4 |= brfd;//write decimal to BRFA
 
+  //the transmit FIFO can only be set up with the transmitter off, TDRE is set whenever it is empty
+  UART2_PFIFO |= UART_PFIFO_TXFE_MASK;
+  UART2_CFIFO |= UART_CFIFO_TXFLUSH_MASK;
+  UART2_TWFIFO = 0;
+  //size 0 is a single byte, otherwise 2^(size + 1)
+  uint8_t txFIFOSize = (UART2_PFIFO & UART_PFIFO_TXFIFOSIZE_MASK) >> UART_PFIFO_TXFIFOSIZE_SHIFT;
+  TxFIFODepth = txFIFOSize ? (1 << (txFIFOSize + 1)) : 1;
+
   UART2_C2 &= ~UART_C2_TIE_MASK; //disables the transmit interrupt
   UART2_C2 |= UART_C2_RIE_MASK; //enables the receive interrupt
 
@@ -104,7 +109,7 @@ bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk)
 
 }
 
-/*! @brief Get a character from the receive FIFO if it is not empty.
+/*! @brief Get a character from the receive FIFO, waiting until there is one.
  *
  *  @param dataPtr A pointer to memory to store the retrieved byte.
  *  @return bool - TRUE if the receive FIFO returned a character.
@@ -123,20 +128,46 @@ bool UART_InChar(uint8_t * const dataPtr)
  */
 bool UART_OutChar(const uint8_t data)
 {
-	return FIFO_Put(&TxFIFO, data);
+	return UART_OutBlock(&data, 1);
 }
 
 bool UART_OutString(const uint8_t data[])
 {
-  uint8_t currentChar = data[0];
-  int i = 0;
-  do
+  return UART_OutBlock(data, strlen((const char *) data));
+}
+
+bool UART_OutBlock(const uint8_t data[], const uint16_t length)
+{
+  //the whole block goes in together, so packets and strings from different threads don't interleave
+  OS_SemaphoreWait(TxAccess, 0);
+  uint16_t nb = 0;
+  while (nb < length)
   {
-//    FIFO_Put(&TxFIFO, currentChar);
-    UART_OutChar(currentChar);
-    currentChar = data[++i];
-  } while(currentChar != '\0');
-  return true;
+    //only as much as fits, then start the ISR on it, so a block bigger than the space never waits on a FIFO nothing is draining
+    //a full FIFO already has TIE set, so waiting for a single byte of space is safe
+    uint16_t chunk = length - nb;
+    uint16_t space = UART_OutFree();
+    if (chunk > space)
+      chunk = space ? space : 1;
+    nb += FIFO_Put_Block(&TxFIFO, &data[nb], chunk);
+
+    //the ISR clears TIE once TxFIFO is empty, so don't let it happen between the read and the write
+    OS_DisableInterrupts();
+    UART2_C2 |= UART_C2_TIE_MASK;
+    OS_EnableInterrupts();
+  }
+  OS_SemaphoreSignal(TxAccess);
+  return nb == length;
+}
+
+uint16_t UART_InCount(void)
+{
+  return FIFO_Get_Count(&RxFIFO);
+}
+
+uint16_t UART_OutFree(void)
+{
+  return FIFO_SIZE - FIFO_Get_Count(&TxFIFO);
 }
 
 /*! @brief Poll the UART status register to try and receive and/or transmit one character.
@@ -159,30 +190,6 @@ void UART_Poll(void)
 }
  */
 
-void TransmitThread(void *arg)
-{
-	for(;;)
-	{
-		OS_SemaphoreWait(TxSemaphore, 0);
-		FIFO_Get(&TxFIFO, (uint8_t *) &UART2_D);
-		UART2_C2 |= UART_C2_TIE_MASK; //enable the UART interrupt if the FIFO buffer is not empty, disable is done before every transmit in UART2_ISR
-	}
-}
-
-void ReceiveThread(void *arg)
-{
-	for(;;)
-	{
-		OS_SemaphoreWait(RxSemaphore, 0);
-    uint8_t data = RxBuffer[RxBufferStart];
-    RxBufferStart++;
-    if (RxBufferStart >= RxBUFFER_SIZE)
-      RxBufferStart = 0;
-		FIFO_Put(&RxFIFO, data);
-		//UART2_C2 |= UART_C2_RIE_MASK;
-	}
-}
-
 
 /*! @brief Interrupt service routine for the UART.
  *
@@ -196,42 +203,47 @@ void __attribute__ ((interrupt)) UART_ISR(void)
 	{
 		if (UART2_S1 & UART_S1_TDRE_MASK)
 		{
-			//SendData();
-			OS_SemaphoreSignal(TxSemaphore);
-			UART2_C2 &= ~UART_C2_TIE_MASK;
+			//refilled straight from TxFIFO, no thread is woken for it
+			SendData();
 		}
 	}
 	if(UART2_C2 & UART_C2_RIE_MASK)
 	{
 		if (UART2_S1 & UART_S1_RDRF_MASK)
 		{
-
-			RxBuffer[RxBufferEnd] = UART2_D;
-			RxBufferEnd++;
-			if (RxBufferEnd >= RxBUFFER_SIZE)
-			  RxBufferEnd = 0;
+			uint8_t data = UART2_D;
+			if (ReceiveFunction)
+				ReceiveFunction(data);
+			else
+				//straight into the FIFO, the receiver is only woken if it is waiting, and a byte is dropped if it is full
+				FIFO_Try_Put(&RxFIFO, &data, 1);
 
 			byteCount++;
-
-//			FIFO_Put(&RxFIFO, UART2_D);
-			OS_SemaphoreSignal(RxSemaphore);
 		}
 	}
 	OS_ISRExit();
 	//ExitCritical();
 }
 
-/*! @brief Gets data from FIFO and transmits. Disables the interrupt if FIFO is empty.
+/*! @brief Moves as much of TxFIFO into the UART's transmit FIFO as will fit. Disables the interrupt once TxFIFO is empty.
  *
  *  @return void
  */
 void SendData()
 {
-	bool success = FIFO_Get(&TxFIFO, (uint8_t *) &UART2_D); //calls FIFO_Get to get data from FIFO and transmit it
-	if(!success)
-	{
-		UART2_C2 &= ~UART_C2_TIE_MASK; //disables the UART interrupt if the FIFO buffer is empty
-	}
+	uint8_t data[8];
+	uint8_t space = TxFIFODepth - UART2_TCFIFO;
+	if (space > sizeof(data))
+		space = sizeof(data);
+
+	//S1 was read with TDRE set, so writing D clears it once the UART FIFO is above the watermark
+	uint16_t nb = FIFO_Try_Get(&TxFIFO, data, space);
+	for (uint16_t i = 0; i < nb; i++)
+		UART2_D = data[i];
+
+	//the last bytes drain from the UART FIFO without needing another interrupt
+	if (FIFO_Get_Count(&TxFIFO) == 0)
+		UART2_C2 &= ~UART_C2_TIE_MASK;
 }
 
 /*!
@@ -21,21 +21,16 @@
 #include "MK70F12.h"
 #include "../Library/OS.h"
 
-extern OS_ECB *RxSemaphore;
-extern OS_ECB *TxSemaphore;
-
-void TransmitThread(void *arg);
-void ReceiveThread(void *arg);
-
 /*! @brief Sets up the UART interface before first use.
  *
  *  @param baudRate The desired baud rate in bits/sec.
  *  @param moduleClk The module clock rate in Hz
+ *  @param receiveFunction Called from the ISR with each received byte, or NULL to queue them in the receive FIFO for UART_InChar.
  *  @return bool - TRUE if the UART was successfully initialized.
  */
-bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk);
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk, void (*receiveFunction)(const uint8_t data));
  
-/*! @brief Get a character from the receive FIFO if it is not empty.
+/*! @brief Get a character from the receive FIFO, waiting until there is one.
  *
  *  @param dataPtr A pointer to memory to store the retrieved byte.
  *  @return bool - TRUE if the receive FIFO returned a character.
@@ -59,6 +54,30 @@ bool UART_OutChar(const uint8_t data);
  */
 bool UART_OutString(const uint8_t data[]);
 
+/*! @brief Place a block of bytes in the transmit FIFO, waiting for space as needed.
+ *
+ *  The block is kept together, nothing another thread sends can end up in the middle of it.
+ *  @param data The bytes to be placed in the transmit FIFO.
+ *  @param length The number of bytes.
+ *  @return bool - TRUE if the data was placed in the transmit FIFO.
+ *  @note Assumes that UART_Init has been called.
+ */
+bool UART_OutBlock(const uint8_t data[], const uint16_t length);
+
+/*! @brief Get the number of received bytes waiting in the receive FIFO.
+ *
+ *  @return uint16_t - the number of bytes.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint16_t UART_InCount(void);
+
+/*! @brief Get the space left in the transmit FIFO.
+ *
+ *  @return uint16_t - the number of bytes that can be placed without waiting, if no other thread gets there first.
+ *  @note Assumes that UART_Init has been called.
+ */
+uint16_t UART_OutFree(void);
+
 /*! @brief Poll the UART status register to try and receive and/or transmit one character.
  *
  *  @return void
@@ -40,11 +40,19 @@
 #include "UART.h"
 #include "packet.h"
 #include "Flash.h"
+#include "Checkpoint.h"
+#include "LoadProfile.h"
+#include "Demand.h"
+#include "Telemetry.h"
 #include "LEDs.h"
 #include "RTC.h"
 #include "FTM.h"
 #include "PIT.h"
 #include "Measurements.h"
+#include "Frequency.h"
+#include "PLL.h"
+#include "Load.h"
+#include "Harmonics.h"
 #include "FixedPoint.h"
 #include "HMI.h"
 #include "LPT.h"
@@ -67,12 +75,22 @@ OS_THREAD_STACK(RTCThreadStack, THREAD_STACK_SIZE);
 //OS_THREAD_STACK(PITThreadStack, THREAD_STACK_SIZE);
 OS_THREAD_STACK(FTM0ThreadStack, THREAD_STACK_SIZE);
 //OS_THREAD_STACK(LPTThreadStack, THREAD_STACK_SIZE);
-OS_THREAD_STACK(TransmitThreadStack, 200);
-OS_THREAD_STACK(ReceiveThreadStack, 200); //100 isn't enough
 OS_THREAD_STACK(HMIThreadStack, 250);
 //project threads
 //Measurements.c
 OS_THREAD_STACK(CalculateThreadStack, THREAD_STACK_SIZE);
+//Harmonics.c
+OS_THREAD_STACK(HarmonicsThreadStack, THREAD_STACK_SIZE);
+//Checkpoint.c
+OS_THREAD_STACK(CheckpointThreadStack, THREAD_STACK_SIZE);
+//LoadProfile.c
+OS_THREAD_STACK(LoadProfileThreadStack, THREAD_STACK_SIZE);
+//Telemetry.c
+OS_THREAD_STACK(TelemetryThreadStack, 200); //a snapshot copies all the registers
+//Flash.c
+OS_THREAD_STACK(FlashThreadStack, 200);
+//Load.c
+OS_THREAD_STACK(IdleThreadStack, THREAD_STACK_SIZE);
 
 /*! @brief The callback from FTM, turns off blue LED.
  *
@@ -108,10 +126,6 @@ void MainThread(void *pData);
 
 void AnalogLoopback(void* args);
 
-void InputConditioning(int16_t voltage, int16_t current, float* voltageOut, float* currentOut);
-
-float Sample_To_Amplitude(int16_t sample);
-
 void OutputHMI();
 
 void SwitchCallbackThread(void *pData);
@@ -138,26 +152,18 @@ void AnalogLoopback(void* args)
   // Get analog sample
   Analog_Get(ANALOG_VOLTAGE_CHANNEL, &analogVoltageInputValue);
   Analog_Get(ANALOG_CURRENT_CHANNEL, &analogCurrentInputValue);
-  int sample = Samples.SamplesNb;
-  Samples.RawSamples[Samples.SamplesRawNb++] = analogVoltageInputValue;
-  InputConditioning(analogVoltageInputValue, analogCurrentInputValue, &Samples.VoltageBuffer[sample], &Samples.CurrentBuffer[sample]);
-  Samples.PowerBuffer[Samples.SamplesNb] = fabs(Samples.VoltageBuffer[sample] * Samples.CurrentBuffer[sample]);
-  Samples.SamplesNb++;
-
-  if (Samples.SamplesNb >= ANALOG_SAMPLE_SIZE)
-  {
-    OS_SemaphoreSignal(CalculateSemaphore); //signal the calculate thread
-    Samples.SamplesNb = 0;
-  }
-
-  if (Samples.SamplesRawNb >= 128)
-  {
-    Samples.SamplesRawNb = 0;
-  }
+  Frequency_Track(analogVoltageInputValue);
+  //only does anything while a harmonics capture is in progress
+  Harmonics_Add_Sample(analogVoltageInputValue, analogCurrentInputValue);
+  //running sums for the window, the calculate thread is signalled when the window is complete
+  Measurements_Add_Sample(analogVoltageInputValue, analogCurrentInputValue);
 
 //  Analog_Put(ANALOG_VOLTAGE_CHANNEL, (int16_t)Samples.VoltageBuffer[sample]);
   if (!IsSelfTesting)
   {
+    //the loopback is only there to watch the input on a scope, at high rates it costs too much of the ISR
+    if (Measurements_Get_Samples_Per_Cycle() > ANALOG_LOOPBACK_MAX_SAMPLES_PER_CYCLE)
+      return;
     Analog_Put(ANALOG_VOLTAGE_CHANNEL, analogVoltageInputValue);
     Analog_Put(ANALOG_CURRENT_CHANNEL, analogCurrentInputValue);
   }
@@ -167,26 +173,6 @@ void AnalogLoopback(void* args)
   }
 }
 
-void InputConditioning(int16_t voltage, int16_t current, float *voltageOut, float *currentOut)
-{
-  float conditionedVoltage, conditionedCurrent;
-  //convert digital samples (16 bit signed) to scale to 10V.
-  conditionedVoltage = Sample_To_Amplitude(voltage);
-  //scale the sample up by 100 to get the actual voltage
-  *voltageOut = conditionedVoltage * 100;
-//  *voltageOut = conditionedVoltage;
-  conditionedCurrent = Sample_To_Amplitude(current);
-  *currentOut = (conditionedCurrent);
-}
-
-float Sample_To_Amplitude(int16_t sample)
-{
-  if (sample < 0)
-    return (float)sample / (3276.8f);
-  else
-    return (float)sample / (3276.7f);
-}
-
 void AllocateFlash()
 {
   //  allocate the number and mode as the first 2 16bit spots in memory.
@@ -211,6 +197,35 @@ void AllocateFlash()
   {
     Flash_Write8((uint8_t *) Tariff_Loaded, DEFAULT_TARIFF_LOADED);
   }
+
+  //allocate the measurement settings
+  Flash_AllocateVar((void *) &Window_Saved, 1);
+  Flash_AllocateVar((void *) &Samples_Per_Cycle_Saved, 2);
+
+  if (*Window_Saved == CLEAR_DATA1)
+  {
+    Flash_Write8((uint8_t *) Window_Saved, DEFAULT_WINDOW);
+  }
+  if (Samples_Per_Cycle_Saved->l == CLEAR_DATA2)
+  {
+    Flash_Write16((uint16_t *) Samples_Per_Cycle_Saved, ANALOG_SAMPLES_PER_CYCLE);
+  }
+
+  //allocate the load profile interval
+  Flash_AllocateVar((void *) &Profile_Interval_Saved, 1);
+
+  if (*Profile_Interval_Saved == CLEAR_DATA1)
+  {
+    Flash_Write8((uint8_t *) Profile_Interval_Saved, LOADPROFILE_DEFAULT_INTERVAL);
+  }
+
+  //allocate the demand window
+  Flash_AllocateVar((void *) &Demand_Saved, 2);
+
+  if (Demand_Saved->l == CLEAR_DATA2)
+  {
+    Flash_Write16((uint16_t *) Demand_Saved, ((uint16_t)DEMAND_DEFAULT_SUBINTERVALS << 8) | DEMAND_DEFAULT_SUBINTERVAL);
+  }
 }
 
 /*! @brief Initialises the tower by setting up the Baud rate, Flash, LED's and the tower number
@@ -233,12 +248,20 @@ void TowerInit(void *pData)
     bool PITSuccess = PIT_Init(CPU_BUS_CLK_HZ, &PITCallback, 0);
     bool AnalogSuccess = Analog_Init(CPU_BUS_CLK_HZ); //added by john <<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
     bool MeasurementsSuccess = Measurements_Init();
+    //before the checkpoint, which restores the maximum demand registers
+    bool DemandSuccess = Demand_Init();
+    bool CheckpointSuccess = Checkpoint_Init();
+    bool LoadProfileSuccess = LoadProfile_Init();
+    bool TelemetrySuccess = Telemetry_Init();
+    bool LoadSuccess = Load_Init();
+    bool HarmonicsSuccess = Harmonics_Init();
+    bool TariffSuccess = Tariff_Init();
     bool HMISuccess = HMI_Init();
 //    bool LPTSuccess = LPTMRInit(DISPLAY_CYCLE_INTERVAL);// Initialise the low power timer to tick every 10 s
 
     success = packetSuccess && flashSuccess && LEDSuccess && RTCSuccess
         && FTMSuccess && FTMLEDSetSuccess && PITSuccess && AnalogSuccess
-        && MeasurementsSuccess && HMISuccess;
+        && MeasurementsSuccess && CheckpointSuccess && LoadProfileSuccess && DemandSuccess && TelemetrySuccess && LoadSuccess && HarmonicsSuccess && TariffSuccess && HMISuccess;
   }
   while (!success);
 
@@ -250,8 +273,18 @@ void TowerInit(void *pData)
   //Turn on LED to show that we have initialised successfully
   LEDs_On(LED_GREEN);
 
+  //apply the saved rate before the window, a window in cycles depends on it
+  if (!Measurements_Set_Samples_Per_Cycle(Samples_Per_Cycle_Saved->l))
+    Measurements_Set_Samples_Per_Cycle(ANALOG_SAMPLES_PER_CYCLE);
+  if (!Measurements_Set_Window(*Window_Saved))
+    Measurements_Set_Window(DEFAULT_WINDOW);
+  if (!LoadProfile_Set_Interval(*Profile_Interval_Saved))
+    LoadProfile_Set_Interval(LOADPROFILE_DEFAULT_INTERVAL);
+  if (!Demand_Set(Demand_Saved->s.Lo, Demand_Saved->s.Hi))
+    Demand_Set(DEMAND_DEFAULT_SUBINTERVAL, DEMAND_DEFAULT_SUBINTERVALS);
+
   //Set up PIT timer and the ADC interval
-  PIT_Set(PIT_INTERVAL, true);
+  PIT_Set(PLL_Get_Interval(), true);
 
   //send 3 startup packets as stated by spec sheet
   Handle_Startup_Packet();
@@ -276,10 +309,6 @@ int main(void)
   error = OS_ThreadCreate(TowerInit, NULL,
                           &TowerInitThreadStack[THREAD_STACK_SIZE - 1], 0); // Highest priority
   //create main thread, always must be last priority so that main doesn't hog it.
-  error = OS_ThreadCreate(ReceiveThread, NULL,
-                          &ReceiveThreadStack[THREAD_STACK_SIZE - 1], 1); //create Receive UART thread thread
-  error = OS_ThreadCreate(TransmitThread, NULL,
-                          &TransmitThreadStack[THREAD_STACK_SIZE - 1], 2); //create transmit UART thread
   error = OS_ThreadCreate(calculateBasic, NULL,
                           &CalculateThreadStack[THREAD_STACK_SIZE - 1], 3); //create calculate  thread
   error = OS_ThreadCreate(MainThread, NULL,
@@ -292,6 +321,20 @@ int main(void)
 //                          &LPTThreadStack[THREAD_STACK_SIZE - 1], 9); //create LPT thread
   error = OS_ThreadCreate(HMI_Cycle_Display_Thread, NULL,
                           &HMIThreadStack[THREAD_STACK_SIZE - 1], 7); //create HMI thread
+  //below the calculate thread, it takes snapshots
+  error = OS_ThreadCreate(Telemetry_Thread, NULL,
+                          &TelemetryThreadStack[200 - 1], 8); //create telemetry thread
+  error = OS_ThreadCreate(Harmonics_Thread, NULL,
+                          &HarmonicsThreadStack[THREAD_STACK_SIZE - 1], 9); //create harmonics thread
+  error = OS_ThreadCreate(Checkpoint_Thread, NULL,
+                          &CheckpointThreadStack[THREAD_STACK_SIZE - 1], 10); //create checkpoint thread
+  error = OS_ThreadCreate(LoadProfile_Thread, NULL,
+                          &LoadProfileThreadStack[THREAD_STACK_SIZE - 1], 11); //create load profile thread
+  error = OS_ThreadCreate(Flash_Thread, NULL,
+                          &FlashThreadStack[200 - 1], 12); //create flash thread
+  //never blocks, so it must stay below every other thread
+  error = OS_ThreadCreate(Load_Idle_Thread, NULL,
+                          &IdleThreadStack[THREAD_STACK_SIZE - 1], 13); //create idle thread
 
 
   // Start multithreading - never returns!
@@ -300,7 +343,7 @@ int main(void)
 
 void MainThread(void *pData)
 {
-  //no need to wait for anything
+  //blocks in Packet_Get until the UART ISR has framed a good packet or frame
   for (;;)
   {
     if (Packet_Get())
@@ -309,7 +352,10 @@ void MainThread(void *pData)
       //start the timer
       LEDs_On(LED_BLUE);
       FTM_StartTimer(&OneSecTimer);
-      TowerProtocol_Handle_Packet();
+      if (Frame)
+        TowerProtocol_Handle_Frame();
+      else
+        TowerProtocol_Handle_Packet();
     }
   }
 }
@@ -342,6 +388,23 @@ void RTCThread(void* arg)
 
     //here we also increment the seconds until dormant
     HMI_Tick();
+
+    //save the registers if it's been long enough
+    Checkpoint_Tick();
+
+    //add this second to the load profile interval
+    LoadProfile_Tick();
+
+    //flag the telemetry streams counted in seconds
+    Telemetry_Tick();
+
+    //work out the CPU load for the last second and back off the sample rate if it's too much
+    Load_Update();
+    Measurements_Check_Load();
+
+    //a capture is only a whole cycle once the sampling is locked to the mains
+    if (PLL_Get_State() == PLL_LOCKED)
+      Harmonics_Start_Capture(Measurements_Get_Samples_Per_Cycle());
   }
 }
 
@@ -356,7 +419,9 @@ void FTMCallback0(void* args)
 
 void PITCallback(void* arg)
 {
+  uint32_t start = Load_ISR_Start();
   AnalogLoopback(arg);
+  Load_ISR_End(start);
 }
 
 void LPTCallback(void* arg)
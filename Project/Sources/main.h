@@ -10,7 +10,7 @@
 
 #include "types.h"
 #include "OS.h"
-#include "Constants.h"
+#include "Tarrifs.h"
 #include "Measurements.h"
 #include "FTM.h"
 
@@ -23,8 +23,8 @@
 #define THREAD_STACK_SIZE 100
 #define NB_ANALOG_CHANNELS 2
 
-#define ANALOG_SAMPLE_SIZE 16
-#define ANALOG_SAMPLE_INTERVAL 1.25//0.0390625 //0.15625 //0.3125 //1.25 // we get this value from: period: 1/50 = 20 ms, we need 16 samples per period atleast so: 20 / 16 = 1.25
+#define ANALOG_SAMPLES_PER_CYCLE 16 //default rate, the PLL keeps this many samples in each mains cycle
+#define ANALOG_LOOPBACK_MAX_SAMPLES_PER_CYCLE 16 //above this rate the DAC loopback is skipped to keep the ISR short
 #define ANALOG_VOLTAGE_CHANNEL 0
 #define ANALOG_CURRENT_CHANNEL 1
 
@@ -41,9 +41,6 @@ static const int DEFAULT_TOWER_MODE = 1;
 const static int MAJ_VER = 6;
 const static int MIN_VER = 99;
 
-//PIT light up every 500 ms
-const static uint32_t PIT_INTERVAL = ANALOG_SAMPLE_INTERVAL * 1000000; //ms to nanoseconds;
-
 
 //ASK IF BETWEEN BUILDS THE FLASH IS ERASED - It is.
 uint16union_t *TowerNumber; //FML Always uppercase first letter for globals
@@ -52,4 +49,14 @@ uint16union_t *TowerMode;
 //this hold the tariff currently loaded in memory
 uint8_t *Tariff_Loaded;
 
+//measurement window and sample rate, see Measurements_Set_Window and Measurements_Set_Samples_Per_Cycle
+uint8_t *Window_Saved;
+uint16union_t *Samples_Per_Cycle_Saved;
+
+//load profile interval in minutes, see LoadProfile_Set_Interval
+uint8_t *Profile_Interval_Saved;
+
+//demand sub-interval in minutes in Lo and the number of sub-intervals in Hi, see Demand_Set
+uint16union_t *Demand_Saved;
+
 #endif
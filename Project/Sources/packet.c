@@ -3,7 +3,8 @@
 ** @version 1.0
  *  @brief Routines to implement packet encoding and decoding for the serial port.
  *
- *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets.
+ *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets,
+ *  and the variable length frames that share the serial port with them.
  *  @author 98112939, 99141145
  *  @date 8-08-2017
 */
@@ -16,20 +17,85 @@
 #include "packet.h"
 #include "types.h"
 #include "UART.h"
+#include "CRC.h"
 #include "stdbool.h"
 #include "../Library/OS.h"
+#include <string.h>
 
-TPacket Packet;
-
-OS_ECB *PacketSemaphore;
+const TPacket *Packet;
+const TFrame *Frame;
 
 //Mask to flip the MSB in a byte
 const uint8_t PACKET_ACK_MASK = 0x80;
 
-static int PacketState = 0; //used in Packet_Get to maintain the packet byte counter.
+//a slot holds whichever of a packet or a frame was received into it
+typedef struct
+{
+  bool IsFrame;
+  TPacket Packet;
+  TFrame Frame;
+} TSlot;
+
+//packets are framed straight into these by the UART ISR, Slots[SlotsHead % PACKET_SLOTS_NB] is the one being received into
+//SlotsHead is only written by the ISR and SlotsTail only by the protocol thread, so no locking is needed
+static TSlot Slots[PACKET_SLOTS_NB];
+static uint8_t volatile SlotsHead;  //packets queued by the ISR
+static uint8_t volatile SlotsTail;  //packets handed back by the protocol thread
+static bool Holding;                //Packet points at Slots[SlotsTail]
+
+//counts the queued packets, signalled once per good packet
+static OS_ECB *PacketSemaphore;
+
+static uint8_t PacketState = 0; //the number of bytes received into the slot, only used by the ISR
+
+//a FRAME_START where a frame could begin and the bytes after it, held until the length check shows whether it is a frame, only used by the ISR
+static uint8_t Header[FRAME_HEADER_NB];
+static uint8_t HeaderNb;
+
+//the number of bytes of a frame received, 0 when not in a frame, and the CRC of them after the start byte, only used by the ISR
+static uint16_t FrameState;
+static uint16_t FrameCRC;
+
+//frames are built here so each goes to the UART in one block, FrameAccess keeps threads from building two at once
+static uint8_t FrameBuffer[FRAME_PAYLOAD_MAX + FRAME_OVERHEAD];
+static OS_ECB *FrameAccess;
+
+//cleared by a checksum error and set again by the next good packet, only used by the ISR
+static bool InStep;
+
+//only written by the ISR, and read with interrupts off
+static TPacketStats Stats;
 
 static uint8_t Calc_Checksum(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
 
+static void ReceiveByte(const uint8_t data);
+
+/*! @brief Frames a byte into the slot being received into, and queues the packet once it is complete and its checksum is right.
+ *
+ *  The slot is a sliding window over the last 5 bytes. A bad checksum only drops the oldest byte, so every byte offset is tried
+ *  and a lost or extra byte costs just the packets it touched.
+ *  The first bad checksum after a good packet skips the next three offsets, one bad byte always leaves the next packet 4, 5 or
+ *  6 bytes on, and the offset one on is a rotation of the bad packet that passes the XOR checksum whenever the next command is the same.
+ *  @param slot The slot being received into.
+ *  @param data The byte.
+ *  @note Called from the UART ISR.
+ */
+static void ReceivePacketByte(TSlot * const slot, const uint8_t data);
+
+/*! @brief Frames a received byte into the frame being received, and queues the frame once it is complete and its CRC is right.
+ *
+ *  @param slot The slot being received into.
+ *  @param data The received byte.
+ *  @note Called from the UART ISR.
+ */
+static void ReceiveFrameByte(TSlot * const slot, const uint8_t data);
+
+/*! @brief Queues the slot being received into for the protocol thread, or drops it if every other slot is queued.
+ *
+ *  @note Called from the UART ISR.
+ */
+static void Queue(void);
+
 /*! @brief Initializes the packets by calling the initialization routines of the supporting software modules.
  *
  *  @param baudRate The desired baud rate in bits/sec.
@@ -38,62 +104,198 @@ static uint8_t Calc_Checksum(const uint8_t command, const uint8_t parameter1, co
  */
 bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk)
 {
-	PacketSemaphore = OS_SemaphoreCreate(1);
-  return UART_Init(baudRate, moduleClk);
+  SlotsHead = 0;
+  SlotsTail = 0;
+  Holding = false;
+  PacketState = 0;
+  HeaderNb = 0;
+  FrameState = 0;
+  InStep = true;
+  Packet_Clear_Stats();
+  Packet = &Slots[0].Packet;
+  Frame = NULL;
+  PacketSemaphore = OS_SemaphoreCreate(0);
+  FrameAccess = OS_SemaphoreCreate(1);
+  return UART_Init(baudRate, moduleClk, ReceiveByte);
 }
 
-/*! @brief Attempts to get a packet from the received data.
+/*! @brief Frames a received byte as part of a frame or a packet, and queues them once they are complete and right.
  *
- *  @return bool - TRUE if a valid packet was received.
+ *  A FRAME_START where a packet could start is only taken as a frame once the length after it matches its complement,
+ *  so a stray start byte or a corrupted length can't swallow the packets after it. Otherwise the bytes are framed as packets.
+ *  A failed header hands back at most three bytes and nothing is rescanned, so the ISR's work per byte stays bounded whatever arrives.
+ *  @param data The received byte.
+ *  @note Called from the UART ISR.
  */
-bool Packet_Get(void)
+static void ReceiveByte(const uint8_t data)
 {
-  uint8_t recByte;//the received byte that is updated whenever UART_InChar is called.
-  if(UART_InChar(&recByte)) //check if we can get a byte ftom UART and store it in recByte.
+  TSlot *slot = &Slots[SlotsHead % PACKET_SLOTS_NB];
+  if (FrameState)
   {
-    //switch depending on the the packet number of bytes received. (state machine)
-    switch(PacketState)
+    ReceiveFrameByte(slot, data);
+    return;
+  }
+
+  if (HeaderNb)
+  {
+    Header[HeaderNb++] = data;
+    if (HeaderNb < FRAME_HEADER_NB)
+      return;
+    HeaderNb = 0;
+
+    if ((uint8_t)~Header[1] == Header[2])
     {
-      case 0:
-				Packet_Command = recByte;
-				PacketState++;
-				break;
-      case 1:
-				Packet_Parameter1 = recByte;
-				PacketState++;
-				break;
-      case 2:
-				Packet_Parameter2 = recByte;
-				PacketState++;
-				break;
-      case 3:
-				Packet_Parameter3 = recByte;
-				PacketState++;
-				break;
-      case 4:
-				Packet_Checksum = recByte;
-				// checksum = Packet_Command ^ Packet_Parameter1 ^ Packet_Parameter2 ^ Packet_Parameter3;
-				uint8_t checksum = Calc_Checksum(Packet_Command, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3); //calculate XOR checksum
-				if(checksum != Packet_Checksum) //check if checksum is correct, if not shift up.
-				{
-//					Packet_Command = Packet_Parameter1;
-//					Packet_Parameter1 = Packet_Parameter2;
-//					Packet_Parameter2 = Packet_Parameter3;
-//					Packet_Parameter3 = Packet_Checksum;
-				  PacketState = 0;
-					return false;
-				}
-				else {
-					PacketState = 0;
-					return true;
-				}
-				break;
+      //a frame, so whatever was in the packet window wasn't a packet
+      Stats.DiscardedBytes += PacketState;
+      PacketState = 0;
+      slot->Frame.Length = Header[1];
+      FrameCRC = CRC_16(&Header[1], FRAME_HEADER_NB - 1, CRC16_INITIAL);
+      FrameState = FRAME_HEADER_NB;
+      return;
     }
+
+    //not a frame, the start byte goes in the packet window and the other two are looked at again, either could start a frame
+    //neither can get back here, the first at most starts another header and the second only adds to it
+    const uint8_t next[FRAME_HEADER_NB - 1] = {Header[1], Header[2]};
+    ReceivePacketByte(slot, Header[0]);
+    ReceiveByte(next[0]);
+    ReceiveByte(next[1]);
+    return;
   }
-  return false;
+
+  //at a packet boundary, or while looking for one, the start byte can only be the start of a frame
+  if (data == FRAME_START && (PacketState == 0 || !InStep))
+  {
+    Header[0] = data;
+    HeaderNb = 1;
+    return;
+  }
+
+  ReceivePacketByte(slot, data);
 }
 
+void ReceivePacketByte(TSlot * const slot, const uint8_t data)
+{
+  TPacket *packet = &slot->Packet;
+  packet->bytes[PacketState++] = data;
+  if (PacketState < PACKET_NB_BYTES)
+    return;
 
+  if (Calc_Checksum(packet->bytes[0], packet->bytes[1], packet->bytes[2], packet->bytes[3]) != packet->packetStruct.checksum)
+  {
+    //slide the window on a byte and wait for the next one, or straight on to the last byte the first time
+    uint8_t slide = 1;
+    if (InStep)
+    {
+      Stats.ChecksumErrors++;
+      InStep = false;
+      slide = PACKET_NB_BYTES - 1;
+    }
+    Stats.DiscardedBytes += slide;
+
+    for (uint8_t i = slide; i < PACKET_NB_BYTES; i++)
+      packet->bytes[i - slide] = packet->bytes[i];
+    PacketState = PACKET_NB_BYTES - slide;
+    return;
+  }
+
+  PacketState = 0;
+  if (!InStep)
+  {
+    Stats.Resyncs++;
+    InStep = true;
+  }
+
+  slot->IsFrame = false;
+  Queue();
+}
+
+void ReceiveFrameByte(TSlot * const slot, const uint8_t data)
+{
+  TFrame *frame = &slot->Frame;
+  uint16_t index = FrameState++;
+
+  //the CRC itself goes in too, which leaves 0 if the frame is right
+  FrameCRC = CRC_16(&data, 1, FrameCRC);
+
+  if (index == FRAME_HEADER_NB)
+    frame->Command = data;
+  else if (index < FRAME_HEADER_NB + 1 + frame->Length)
+    frame->Payload[index - FRAME_HEADER_NB - 1] = data;
+
+  if (FrameState < FRAME_OVERHEAD + frame->Length)
+    return;
+
+  FrameState = 0;
+  if (FrameCRC != 0)
+  {
+    //the length was checked, so the next byte is where the next packet or frame should start
+    Stats.CRCErrors++;
+    Stats.DiscardedBytes += FRAME_OVERHEAD + frame->Length;
+    InStep = false;
+    return;
+  }
+
+  if (!InStep)
+  {
+    Stats.Resyncs++;
+    InStep = true;
+  }
+
+  slot->IsFrame = true;
+  Queue();
+}
+
+void Queue(void)
+{
+  //the protocol thread can have every other slot, the one being received into must never be one of them
+  //if they're all queued the packet is dropped and the slot is reused
+  if ((uint8_t)(SlotsHead - SlotsTail) >= PACKET_SLOTS_NB - 1)
+  {
+    Stats.DroppedPackets++;
+    return;
+  }
+
+  SlotsHead++;
+  OS_SemaphoreSignal(PacketSemaphore);
+}
+
+bool Packet_Get(void)
+{
+  //done with the last one, the ISR can have its slot back
+  if (Holding)
+  {
+    SlotsTail++;
+    Holding = false;
+  }
+
+  OS_SemaphoreWait(PacketSemaphore, 0);
+  const TSlot *slot = &Slots[SlotsTail % PACKET_SLOTS_NB];
+  Packet = &slot->Packet;
+  Frame = slot->IsFrame ? &slot->Frame : NULL;
+  Holding = true;
+  return true;
+}
+
+
+
+void Packet_Get_Stats(TPacketStats * const stats)
+{
+  OS_DisableInterrupts();
+  *stats = Stats;
+  OS_EnableInterrupts();
+}
+
+void Packet_Clear_Stats(void)
+{
+  OS_DisableInterrupts();
+  Stats.ChecksumErrors = 0;
+  Stats.Resyncs = 0;
+  Stats.DiscardedBytes = 0;
+  Stats.DroppedPackets = 0;
+  Stats.CRCErrors = 0;
+  OS_EnableInterrupts();
+}
 
 /*! @brief Builds a packet and places it in the transmit FIFO buffer. Must also calculate checksum of arguments
  *
@@ -101,17 +303,33 @@ bool Packet_Get(void)
  */
 void Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
 {
-	OS_SemaphoreWait(PacketSemaphore,0);
-  uint8_t checksum = Calc_Checksum(command, parameter1, parameter2, parameter3);
-  UART_OutChar(command);
-  UART_OutChar(parameter1);
-  UART_OutChar(parameter2);
-  UART_OutChar(parameter3);
-  UART_OutChar(checksum);
-  OS_SemaphoreSignal(PacketSemaphore);
+  uint8_t packet[PACKET_NB_BYTES] = {command, parameter1, parameter2, parameter3,
+      Calc_Checksum(command, parameter1, parameter2, parameter3)};
+  //one block, so packets from different threads can't interleave
+  UART_OutBlock(packet, PACKET_NB_BYTES);
   //return true;
 }
 
+void Frame_Put(const uint8_t command, const void * const payload, const uint8_t length)
+{
+  OS_SemaphoreWait(FrameAccess, 0);
+
+  FrameBuffer[0] = FRAME_START;
+  FrameBuffer[1] = length;
+  FrameBuffer[2] = ~length;
+  FrameBuffer[3] = command;
+  if (length)
+    memcpy(&FrameBuffer[4], payload, length);
+  uint16_t crc = CRC_16(&FrameBuffer[1], length + 3, CRC16_INITIAL);
+  FrameBuffer[4 + length] = crc >> 8;
+  FrameBuffer[5 + length] = crc & 0xFF;
+
+  //one block, so packets from other threads can't end up in the middle of it
+  UART_OutBlock(FrameBuffer, length + FRAME_OVERHEAD);
+
+  OS_SemaphoreSignal(FrameAccess);
+}
+
 /*! @brief Calculates the checksum of a packet.
  *
  *  @return unint8_t - the calculated checksum of a packet.
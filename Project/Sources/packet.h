@@ -2,7 +2,8 @@
  *
  *  @brief Routines to implement packet encoding and decoding for the serial port.
  *
- *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets.
+ *  This contains the functions for implementing the "Tower to PC Protocol" 5-byte packets,
+ *  and the variable length frames that share the serial port with them.
  *
  *  @author PMcL
  *  @date 2015-07-23
@@ -25,6 +26,27 @@
  * The byte size of a packet
  */
 #define PACKET_NB_BYTES 5
+/*!
+ * The number of received packets that can be queued, a power of two. One slot is always the one being received into.
+ */
+#define PACKET_SLOTS_NB 8
+
+/*!
+ * The first byte of a frame, neither a command nor a command with its ACK bit, so a 5-byte packet never starts with it
+ */
+#define FRAME_START 0xFA
+/*!
+ * The most payload bytes a frame can carry
+ */
+#define FRAME_PAYLOAD_MAX 255
+/*!
+ * The start byte, the length and its complement, the framer only takes a frame as a frame once all three check out
+ */
+#define FRAME_HEADER_NB 3
+/*!
+ * The bytes of a frame around its payload, the header, command and CRC-16
+ */
+#define FRAME_OVERHEAD (FRAME_HEADER_NB + 3)
 
 #pragma pack(push)
 #pragma pack(1)
@@ -62,38 +84,68 @@ typedef union
 } TPacket;
 
 #pragma pack(pop)
+
+/*!
+ * @struct TFrame packet.h
+ * A frame, sent as FRAME_START, Length, ~Length, Command, Payload then the CRC-16 of Length to Payload, high byte first
+ */
+typedef struct
+{
+  uint8_t Command;                     /*!< The frame's command, the same commands as the 5-byte packets */
+  uint8_t Length;                      /*!< The number of payload bytes */
+  uint8_t Payload[FRAME_PAYLOAD_MAX];  /*!< The payload */
+} TFrame;
 /*!
  * The command byte of packet
  */
-#define Packet_Command     Packet.packetStruct.command
+#define Packet_Command     (Packet->packetStruct.command)
 /*!
  * The first parameter byte of packet
  */
-#define Packet_Parameter1  Packet.packetStruct.parameters.separate.parameter1
+#define Packet_Parameter1  (Packet->packetStruct.parameters.separate.parameter1)
 /*!
  * The second parameter of packet
  */
-#define Packet_Parameter2  Packet.packetStruct.parameters.separate.parameter2
+#define Packet_Parameter2  (Packet->packetStruct.parameters.separate.parameter2)
 /*!
  * The third parameter of packet
  */
-#define Packet_Parameter3  Packet.packetStruct.parameters.separate.parameter3
+#define Packet_Parameter3  (Packet->packetStruct.parameters.separate.parameter3)
 /*!
  * Combined first and second parameter of packet
  */
-#define Packet_Parameter12 Packet.packetStruct.parameters.combined12.parameter12
+#define Packet_Parameter12 (Packet->packetStruct.parameters.combined12.parameter12)
 /*!
  * Combined second and third parameter of packet
  */
-#define Packet_Parameter23 Packet.packetStruct.parameters.combined23.parameter23
+#define Packet_Parameter23 (Packet->packetStruct.parameters.combined23.parameter23)
 /*!
  * The checksum parameter of packet
  */
-#define Packet_Checksum    Packet.packetStruct.checksum
+#define Packet_Checksum    (Packet->packetStruct.checksum)
 
-extern TPacket Packet;
+/*!
+ * The packet last returned by Packet_Get, read only, it stays valid until the next call
+ */
+extern const TPacket *Packet;
+
+/*!
+ * The frame last returned by Packet_Get, or NULL if it was a 5-byte packet, read only, it stays valid until the next call
+ */
+extern const TFrame *Frame;
 
-extern OS_ECB *PacketSemaphore;
+/*!
+ * @struct TPacketStats packet.h
+ * Counts of what the framer has thrown away, since Packet_Init or the last Packet_Clear_Stats
+ */
+typedef struct
+{
+  uint32_t ChecksumErrors;   /*!< Times a packet failed its checksum when the framer thought it was in step */
+  uint32_t Resyncs;          /*!< Times the framer found a good packet again after a checksum error */
+  uint32_t DiscardedBytes;   /*!< Bytes skipped while looking for a good packet */
+  uint32_t DroppedPackets;   /*!< Good packets dropped because every slot was queued */
+  uint32_t CRCErrors;        /*!< Frames that failed their CRC */
+} TPacketStats;
 
 // Acknowledgment bit mask
 extern const uint8_t PACKET_ACK_MASK;
@@ -106,17 +158,36 @@ extern const uint8_t PACKET_ACK_MASK;
  */
 bool Packet_Init(const uint32_t baudRate, const uint32_t moduleClk);
 
-/*! @brief Attempts to get a packet from the received data.
+/*! @brief Waits for the next packet or frame framed by the UART ISR and points Packet or Frame at it.
  *
+ *  The packet before it is handed back to the ISR, so only one thread should get packets.
  *  @return bool - TRUE if a valid packet was received.
  */
 bool Packet_Get(void);
 
+/*! @brief Gets the framer's error counters.
+ *
+ *  @param stats Set to the counters.
+ */
+void Packet_Get_Stats(TPacketStats * const stats);
+
+/*! @brief Zeroes the framer's error counters.
+ */
+void Packet_Clear_Stats(void);
+
 /*! @brief Builds a packet and places it in the transmit FIFO buffer. Must also calculate checksum of arguments
  *
  *  @return bool - TRUE if a valid packet was sent.
  */
 void Packet_Put(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3);
+
+/*! @brief Builds a frame and places it in the transmit FIFO buffer in one block.
+ *
+ *  @param command The command.
+ *  @param payload The payload, can be NULL if length is 0.
+ *  @param length The number of payload bytes, up to FRAME_PAYLOAD_MAX, which is more than the transmit FIFO holds, UART_OutBlock feeds it in as it drains.
+ */
+void Frame_Put(const uint8_t command, const void * const payload, const uint8_t length);
 /*!
 * @}
 */
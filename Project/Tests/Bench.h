@@ -0,0 +1,51 @@
+/*
+ * Bench.h
+ *
+ *  Shared helpers for the host tests.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+//time stamp counter, close enough to core clock cycles to compare two paths
+static inline uint64_t Bench_Cycles(void)
+{
+  return __rdtsc();
+}
+#else
+#include <time.h>
+
+//no cycle counter, nanoseconds instead
+static inline uint64_t Bench_Cycles(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+#endif
+
+//fails the test with the line it failed on, unlike assert it can't be compiled out
+#define CHECK(condition) \
+  do \
+  { \
+    if (!(condition)) \
+    { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      exit(1); \
+    } \
+  } while (0)
+
+//keeps the optimiser from throwing away a result that's only benchmarked
+static inline void Bench_Keep(const void * const result)
+{
+  __asm volatile ("" : : "r" (result) : "memory");
+}
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Cpu.h
+ *
+ *  Host stand in for the Processor Expert CPU header, just the clocks.
+ */
+
+#ifndef __Cpu_H
+#define __Cpu_H
+
+#define CPU_BUS_CLK_HZ 25000000U
+#define CPU_CORE_CLK_HZ 50000000U
+
+#endif
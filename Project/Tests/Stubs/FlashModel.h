@@ -0,0 +1,144 @@
+/*
+ * FlashModel.h
+ *
+ *  A model of the FTFE and program flash block 1, mapped at its real address so the sources read it directly.
+ *  Counts erases per sector, refuses to program a phrase that isn't erased, and can cut the power part way through any command.
+ */
+
+#ifndef FLASH_MODEL_H
+#define FLASH_MODEL_H
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MK70F12.h"
+
+#define FLASH_MODEL_START 0x00080000LU
+#define FLASH_MODEL_SIZE 0x80000LU
+#define FLASH_MODEL_SECTOR_SIZE 0x1000LU
+#define FLASH_MODEL_SECTORS (FLASH_MODEL_SIZE / FLASH_MODEL_SECTOR_SIZE)
+
+//FCCOB0 holds this while no command is loaded
+#define FLASH_MODEL_IDLE 0xEE
+
+volatile uint8_t FlashModel_FCCOB[12] = {FLASH_MODEL_IDLE};
+static volatile uint8_t FlashModel_Status = FTFE_FSTAT_CCIF_MASK;
+
+static uint32_t FlashModel_Erases[FLASH_MODEL_SECTORS];
+static uint32_t FlashModel_Programs;
+
+//commands left before the power is cut, negative for never, and where to go when it is
+static int32_t FlashModel_Budget = -1;
+static jmp_buf FlashModel_PowerCut;
+
+/*! @brief Maps the flash block, full of whatever was there before.
+ *
+ *  @param fill The byte every location starts out as, 0xFF for a blank part.
+ */
+static void FlashModel_Init(const uint8_t fill)
+{
+  static bool mapped;
+  if (!mapped)
+  {
+    void *block = mmap((void *)FLASH_MODEL_START, FLASH_MODEL_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (block != (void *)FLASH_MODEL_START)
+    {
+      printf("can't map the flash block at 0x%lx\n", FLASH_MODEL_START);
+      exit(1);
+    }
+    mapped = true;
+  }
+  memset((void *)FLASH_MODEL_START, fill, FLASH_MODEL_SIZE);
+  memset(FlashModel_Erases, 0, sizeof(FlashModel_Erases));
+  FlashModel_Programs = 0;
+  FlashModel_Budget = -1;
+}
+
+/*! @brief Runs the loaded command, the way the FTFE does once CCIF is cleared.
+ */
+static void FlashModel_Execute(void)
+{
+  uint32_t address = FlashModel_FCCOB[3] | FlashModel_FCCOB[2] << 8 | FlashModel_FCCOB[1] << 16;
+  uint8_t command = FlashModel_FCCOB[0];
+  FlashModel_FCCOB[0] = FLASH_MODEL_IDLE;
+  FlashModel_Status = FTFE_FSTAT_CCIF_MASK;
+
+  if (address < FLASH_MODEL_START || address >= FLASH_MODEL_START + FLASH_MODEL_SIZE)
+  {
+    FlashModel_Status |= FTFE_FSTAT_FPVIOL_MASK;
+    return;
+  }
+
+  uint8_t *memory = (uint8_t *)(uintptr_t)address;
+  if (FlashModel_Budget == 0)
+  {
+    //the command is left half done, a program has only cleared some of its bits and an erase has only got part way
+    if (command == 0x07)
+      for (uint8_t i = 0; i < 8; i++)
+        memory[i] &= FlashModel_FCCOB[(i < 4 ? 7 : 15) - i] | rand();
+    else if (command == 0x09)
+      memset(memory, 0xFF, rand() % FLASH_MODEL_SECTOR_SIZE);
+    longjmp(FlashModel_PowerCut, 1);
+  }
+  if (FlashModel_Budget > 0)
+    FlashModel_Budget--;
+
+  if (command == 0x09)
+  {
+    if (address % FLASH_MODEL_SECTOR_SIZE)
+    {
+      FlashModel_Status |= FTFE_FSTAT_ACCERR_MASK;
+      return;
+    }
+    memset(memory, 0xFF, FLASH_MODEL_SECTOR_SIZE);
+    FlashModel_Erases[(address - FLASH_MODEL_START) / FLASH_MODEL_SECTOR_SIZE]++;
+  }
+  else if (command == 0x07)
+  {
+    //FCCOB4-7 is the word at the address and FCCOB8-B the word after it, each big endian
+    uint8_t phrase[8] = {FlashModel_FCCOB[7], FlashModel_FCCOB[6], FlashModel_FCCOB[5], FlashModel_FCCOB[4],
+        FlashModel_FCCOB[11], FlashModel_FCCOB[10], FlashModel_FCCOB[9], FlashModel_FCCOB[8]};
+    if (address % 8)
+    {
+      FlashModel_Status |= FTFE_FSTAT_ACCERR_MASK;
+      return;
+    }
+    for (uint8_t i = 0; i < 8; i++)
+      if (memory[i] != 0xFF)
+      {
+        //programming over programmed flash isn't allowed
+        printf("phrase at 0x%x programmed twice\n", address);
+        exit(1);
+      }
+    memcpy(memory, phrase, sizeof(phrase));
+    FlashModel_Programs++;
+  }
+  else
+    FlashModel_Status |= FTFE_FSTAT_ACCERR_MASK;
+}
+
+volatile uint8_t *FlashModel_FSTAT(void)
+{
+  if (FlashModel_FCCOB[0] != FLASH_MODEL_IDLE)
+    FlashModel_Execute();
+  return &FlashModel_Status;
+}
+
+/*! @brief Adds up the erases of a range of sectors.
+ *
+ *  @param address The start of the first sector.
+ *  @param sectorsNb The number of sectors.
+ */
+static uint32_t FlashModel_Erase_Count(const uint32_t address, const uint8_t sectorsNb)
+{
+  uint32_t erases = 0;
+  for (uint8_t i = 0; i < sectorsNb; i++)
+    erases += FlashModel_Erases[(address - FLASH_MODEL_START) / FLASH_MODEL_SECTOR_SIZE + i];
+  return erases;
+}
+
+#endif
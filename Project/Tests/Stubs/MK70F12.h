@@ -0,0 +1,36 @@
+/*
+ * MK70F12.h
+ *
+ *  Host stand in for the K70 register map, only what the tested modules touch.
+ *  The FTFE registers go to the flash model in FlashModel.h.
+ */
+
+#ifndef MK70F12_H
+#define MK70F12_H
+
+#include <stdint.h>
+
+#define FTFE_FSTAT_CCIF_MASK 0x80u
+#define FTFE_FSTAT_ACCERR_MASK 0x20u
+#define FTFE_FSTAT_FPVIOL_MASK 0x10u
+#define FTFE_FCCOB0_CCOBn(x) (x)
+
+extern volatile uint8_t FlashModel_FCCOB[12];
+volatile uint8_t *FlashModel_FSTAT(void);
+
+//reading or writing FSTAT runs a command that has just been loaded
+#define FTFE_FSTAT (*FlashModel_FSTAT())
+#define FTFE_FCCOB0 FlashModel_FCCOB[0]
+#define FTFE_FCCOB1 FlashModel_FCCOB[1]
+#define FTFE_FCCOB2 FlashModel_FCCOB[2]
+#define FTFE_FCCOB3 FlashModel_FCCOB[3]
+#define FTFE_FCCOB4 FlashModel_FCCOB[4]
+#define FTFE_FCCOB5 FlashModel_FCCOB[5]
+#define FTFE_FCCOB6 FlashModel_FCCOB[6]
+#define FTFE_FCCOB7 FlashModel_FCCOB[7]
+#define FTFE_FCCOB8 FlashModel_FCCOB[8]
+#define FTFE_FCCOB9 FlashModel_FCCOB[9]
+#define FTFE_FCCOBA FlashModel_FCCOB[10]
+#define FTFE_FCCOBB FlashModel_FCCOB[11]
+
+#endif
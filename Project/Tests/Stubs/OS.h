@@ -0,0 +1,75 @@
+/*
+ * OS.h
+ *
+ *  Host stand in for the RTOS, force included ahead of everything else so its guard
+ *  also keeps the sources' "../Library/OS.h" out.
+ */
+
+#ifndef OS_H
+#define OS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define OS_THREAD_STACK(x, y) static uint32_t x[y] __attribute__ ((aligned(0x08)))
+
+typedef enum
+{
+  OS_NO_ERROR,
+  OS_TIMEOUT,
+  OS_SEMAPHORE_OVERFLOW
+} OS_ERROR;
+
+typedef struct ecb
+{
+  uint32_t count;
+  uint32_t waitList;
+} OS_ECB;
+
+static OS_ECB OS_Events[32];
+static uint8_t OS_EventsNb;
+
+//where a thread would block on a semaphore with a 0 count, a test can run whatever would have signalled it or leave the thread
+static void (*OS_Blocked)(OS_ECB * const event);
+
+static inline OS_ECB *OS_SemaphoreCreate(const uint32_t value)
+{
+  OS_ECB *event = &OS_Events[OS_EventsNb++ % 32];
+  event->count = value;
+  event->waitList = 0;
+  return event;
+}
+
+static inline OS_ERROR OS_SemaphoreSignal(OS_ECB * const pEvent)
+{
+  pEvent->count++;
+  return OS_NO_ERROR;
+}
+
+static inline OS_ERROR OS_SemaphoreWait(OS_ECB * const pEvent, const uint32_t timeout)
+{
+  if (pEvent->count == 0 && OS_Blocked)
+    OS_Blocked(pEvent);
+  if (pEvent->count == 0)
+    return OS_TIMEOUT;
+  pEvent->count--;
+  return OS_NO_ERROR;
+}
+
+static inline void OS_ISREnter(void)
+{
+}
+
+static inline void OS_ISRExit(void)
+{
+}
+
+static inline void OS_TimeDelay(const uint32_t ticks)
+{
+}
+
+//no interrupts on the host, just keep the compiler from moving accesses across them
+#define OS_DisableInterrupts() __asm volatile ("" : : : "memory")
+#define OS_EnableInterrupts() __asm volatile ("" : : : "memory")
+
+#endif
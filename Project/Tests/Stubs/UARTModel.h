@@ -0,0 +1,46 @@
+/*
+ * UARTModel.h
+ *
+ *  Host stand in for the UART, the bytes sent go on a wire that a test can damage and then feed back through
+ *  the receive ISR callback as if they had come in from the PC.
+ */
+
+#ifndef UARTMODEL_H
+#define UARTMODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define UARTMODEL_WIRE_NB (1 << 20)
+
+static void (*UARTModel_Receive)(const uint8_t data);
+static uint8_t UARTModel_Wire[UARTMODEL_WIRE_NB];
+static uint32_t UARTModel_WireNb;
+
+bool UART_Init(const uint32_t baudRate, const uint32_t moduleClk, void (*receiveFunction)(const uint8_t data))
+{
+  UARTModel_Receive = receiveFunction;
+  UARTModel_WireNb = 0;
+  return true;
+}
+
+bool UART_OutBlock(const uint8_t data[], const uint16_t length)
+{
+  if (UARTModel_WireNb + length > UARTMODEL_WIRE_NB)
+    return false;
+  memcpy(&UARTModel_Wire[UARTModel_WireNb], data, length);
+  UARTModel_WireNb += length;
+  return true;
+}
+
+/*! @brief Receives everything on the wire, a byte per ISR call, and empties it.
+ */
+static void UARTModel_Feed(void)
+{
+  for (uint32_t i = 0; i < UARTModel_WireNb; i++)
+    UARTModel_Receive(UARTModel_Wire[i]);
+  UARTModel_WireNb = 0;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * test_dsp.c
+ *
+ *  Checks the paired SMLALD kernel gives bit-identical sums to the sample by sample loop, and times both per sample.
+ *  Off the M4 SMLALD is done in C, so this checks the kernel's pairing, not the instruction itself.
+ */
+
+#include "Bench.h"
+#include "DSP.c"
+#include <string.h>
+
+#define BLOCK_NB 1024
+#define RUNS_NB 2000
+
+static int16_t Voltage[BLOCK_NB] __attribute__ ((aligned(0x04)));
+static int16_t Current[BLOCK_NB] __attribute__ ((aligned(0x04)));
+
+static bool SameSums(const TDSPSums * const a, const TDSPSums * const b)
+{
+  return a->VoltageSquared == b->VoltageSquared && a->CurrentSquared == b->CurrentSquared && a->Power == b->Power
+      && a->Reactive == b->Reactive;
+}
+
+static void TestIdentical(void)
+{
+  srand(3);
+  for (int run = 0; run < RUNS_NB; run++)
+  {
+    for (int i = 0; i < BLOCK_NB; i++)
+    {
+      Voltage[i] = rand();
+      Current[i] = rand();
+    }
+    //full scale both ways, the products only just fit in 32 bits
+    if (run == 0)
+      for (int i = 0; i < BLOCK_NB; i++)
+      {
+        Voltage[i] = INT16_MIN;
+        Current[i] = (i & 1) ? INT16_MIN : INT16_MAX;
+      }
+
+    //odd lengths leave a sample for the C loop
+    uint16_t length = run % (BLOCK_NB + 1);
+    TDSPSums paired = {1, 2, 3, 4}, single = {1, 2, 3, 4};
+    DSP_Accumulate(Voltage, Current, length, &paired);
+    DSP_Accumulate_C(Voltage, Current, length, &single);
+    CHECK(SameSums(&paired, &single));
+  }
+
+  //a block of full scale squares doesn't wrap
+  for (int i = 0; i < BLOCK_NB; i++)
+    Voltage[i] = INT16_MIN;
+  TDSPSums sums = {0};
+  DSP_Accumulate(Voltage, Voltage, BLOCK_NB, &sums);
+  CHECK(sums.VoltageSquared == (int64_t)BLOCK_NB * 32768 * 32768);
+  CHECK(sums.Power == (int64_t)BLOCK_NB * 32768 * 32768);
+}
+
+static void Benchmark(const uint16_t length)
+{
+  TDSPSums sums = {0};
+  uint64_t start = Bench_Cycles();
+  for (int run = 0; run < RUNS_NB; run++)
+  {
+    DSP_Accumulate(Voltage, Current, length, &sums);
+    Bench_Keep(&sums);
+  }
+  uint64_t paired = Bench_Cycles() - start;
+
+  start = Bench_Cycles();
+  for (int run = 0; run < RUNS_NB; run++)
+  {
+    DSP_Accumulate_C(Voltage, Current, length, &sums);
+    Bench_Keep(&sums);
+  }
+  uint64_t single = Bench_Cycles() - start;
+
+  printf("%4u samples: paired kernel %.2f cycles/sample, sample by sample %.2f cycles/sample\n", length,
+      (double)paired / ((double)RUNS_NB * length), (double)single / ((double)RUNS_NB * length));
+}
+
+int main(void)
+{
+  TestIdentical();
+  Benchmark(16);
+  Benchmark(128);
+  Benchmark(BLOCK_NB);
+  return 0;
+}
@@ -0,0 +1,193 @@
+/*
+ * test_fixedpoint.c
+ *
+ *  Checks the Q24 helpers, and benchmarks the fixed point window conversion calculateBasic uses
+ *  against the float path it replaced, for cycles per window and error against a double reference.
+ */
+
+#include "Bench.h"
+#include "FixedPoint.c"
+#include <math.h>
+
+//the same constants as Measurements.c
+static const Fixed32Q24 VOLTAGE_PER_COUNT = FIXED_Q24(512000);
+static const Fixed32Q24 CURRENT_PER_COUNT = FIXED_Q24(5120);
+#define MEASUREMENT_Q 16
+
+#define WINDOWS_NB 2000
+
+typedef struct
+{
+  float Voltage;
+  float Current;
+  float Power;
+} TResult;
+
+static int16_t Voltage[WINDOWS_NB][128];
+static int16_t Current[WINDOWS_NB][128];
+
+/*! @brief The fixed point path, 64 bit sums of the raw samples converted once at the end of the window as calculateBasic does.
+ */
+static TResult FixedWindow(const int16_t voltage[], const int16_t current[], const uint16_t samplesNb)
+{
+  int64_t voltageSquared = 0, currentSquared = 0, power = 0;
+  for (uint16_t i = 0; i < samplesNb; i++)
+  {
+    voltageSquared += (int32_t)voltage[i] * voltage[i];
+    currentSquared += (int32_t)current[i] * current[i];
+    power += (int32_t)voltage[i] * current[i];
+  }
+
+  TResult result;
+  uint32_t voltageRMSCounts = FixedPoint_Sqrt64(((uint64_t)voltageSquared / samplesNb) << (2 * MEASUREMENT_Q));
+  uint32_t currentRMSCounts = FixedPoint_Sqrt64(((uint64_t)currentSquared / samplesNb) << (2 * MEASUREMENT_Q));
+  result.Voltage = (float)FixedPoint_Scale(voltageRMSCounts, VOLTAGE_PER_COUNT) / (1 << MEASUREMENT_Q);
+  result.Current = (float)FixedPoint_Scale(currentRMSCounts, CURRENT_PER_COUNT) / (1 << MEASUREMENT_Q);
+  uint64_t magnitude = power < 0 ? -(uint64_t)power : (uint64_t)power;
+  int64_t powerQ = (int64_t)(magnitude / samplesNb) << MEASUREMENT_Q;
+  float watts = (float)FixedPoint_Scale(FixedPoint_Scale(powerQ, CURRENT_PER_COUNT), VOLTAGE_PER_COUNT) / (1 << MEASUREMENT_Q);
+  result.Power = power < 0 ? -watts : watts;
+  return result;
+}
+
+/*! @brief The float path calculateBasic had before, each sample conditioned to volts and amps and squared with pow().
+ */
+static TResult FloatWindow(const int16_t voltage[], const int16_t current[], const uint16_t samplesNb)
+{
+  float powerSum = 0.0f, voltageRMS = 0.0f, currentRMS = 0.0f;
+  for (uint16_t i = 0; i < samplesNb; i++)
+  {
+    float v = voltage[i] * (1000.0f / 32768.0f);
+    float c = current[i] * (10.0f / 32768.0f);
+    powerSum += v * c;
+    voltageRMS += pow(v, 2);
+    currentRMS += pow(c, 2);
+  }
+
+  TResult result;
+  result.Voltage = sqrt(voltageRMS / samplesNb);
+  result.Current = sqrt(currentRMS / samplesNb);
+  result.Power = powerSum / samplesNb;
+  return result;
+}
+
+/*! @brief The exact answer, in double.
+ */
+static TResult ReferenceWindow(const int16_t voltage[], const int16_t current[], const uint16_t samplesNb)
+{
+  double powerSum = 0.0, voltageSquared = 0.0, currentSquared = 0.0;
+  for (uint16_t i = 0; i < samplesNb; i++)
+  {
+    double v = voltage[i] * (1000.0 / 32768.0);
+    double c = current[i] * (10.0 / 32768.0);
+    powerSum += v * c;
+    voltageSquared += v * v;
+    currentSquared += c * c;
+  }
+
+  TResult result;
+  result.Voltage = sqrt(voltageSquared / samplesNb);
+  result.Current = sqrt(currentSquared / samplesNb);
+  result.Power = powerSum / samplesNb;
+  return result;
+}
+
+/*! @brief Fills the windows with a mains cycle at a random amplitude, phase and third harmonic.
+ */
+static void MakeWindows(const uint16_t samplesNb)
+{
+  srand(1);
+  for (int w = 0; w < WINDOWS_NB; w++)
+  {
+    //from a few volts up to near full scale, and a few mA up to 10A
+    double voltage = 5.0 + 300.0 * rand() / RAND_MAX;
+    double current = 0.005 + 9.0 * rand() / RAND_MAX;
+    double phase = 2 * M_PI * rand() / RAND_MAX;
+    double third = 0.2 * rand() / RAND_MAX;
+    for (uint16_t i = 0; i < samplesNb; i++)
+    {
+      double angle = 2 * M_PI * i / samplesNb;
+      Voltage[w][i] = lround(voltage * sin(angle) / (1000.0 / 32768.0));
+      Current[w][i] = lround(current * (sin(angle - phase) + third * sin(3 * (angle - phase))) / (10.0 / 32768.0));
+    }
+  }
+}
+
+/*! @brief Works out the worst error of each result against the reference.
+ */
+static void WorstError(const TResult * const result, const TResult * const reference, TResult * const worst)
+{
+  worst->Voltage = fmaxf(worst->Voltage, fabsf(result->Voltage - reference->Voltage));
+  worst->Current = fmaxf(worst->Current, fabsf(result->Current - reference->Current));
+  worst->Power = fmaxf(worst->Power, fabsf(result->Power - reference->Power));
+}
+
+/*! @brief Runs both paths over the windows and prints their cycles and worst errors.
+ */
+static void Compare(const uint16_t samplesNb)
+{
+  static TResult fixed[WINDOWS_NB], floats[WINDOWS_NB];
+  MakeWindows(samplesNb);
+
+  uint64_t start = Bench_Cycles();
+  for (int w = 0; w < WINDOWS_NB; w++)
+    fixed[w] = FixedWindow(Voltage[w], Current[w], samplesNb);
+  Bench_Keep(fixed);
+  uint64_t fixedCycles = Bench_Cycles() - start;
+
+  start = Bench_Cycles();
+  for (int w = 0; w < WINDOWS_NB; w++)
+    floats[w] = FloatWindow(Voltage[w], Current[w], samplesNb);
+  Bench_Keep(floats);
+  uint64_t floatCycles = Bench_Cycles() - start;
+
+  TResult fixedError = {0}, floatError = {0};
+  for (int w = 0; w < WINDOWS_NB; w++)
+  {
+    TResult reference = ReferenceWindow(Voltage[w], Current[w], samplesNb);
+    WorstError(&fixed[w], &reference, &fixedError);
+    WorstError(&floats[w], &reference, &floatError);
+  }
+
+  printf("%3u samples: fixed %5.0f cycles/window, worst error %.1e V %.1e A %.1e W\n"
+         "             float %5.0f cycles/window, worst error %.1e V %.1e A %.1e W\n",
+      samplesNb, (double)fixedCycles / WINDOWS_NB, fixedError.Voltage, fixedError.Current, fixedError.Power,
+      (double)floatCycles / WINDOWS_NB, floatError.Voltage, floatError.Current, floatError.Power);
+  //the fixed path truncates the mean square to whole counts and the results to MEASUREMENT_Q fractional bits
+  CHECK(fixedError.Voltage < 1e-3f && fixedError.Current < 1e-4f && fixedError.Power < 1e-3f);
+}
+
+static void TestArithmetic(void)
+{
+  Fixed32Q24 a = FloatToFixed(3.25f);
+  Fixed32Q24 b = FloatToFixed(0.5f);
+  CHECK(FixedToFloat(FixedPoint_Add(a, b)) == 3.75f);
+  CHECK(FixedToFloat(FixedPoint_Subtract(a, b)) == 2.75f);
+  CHECK(FixedToFloat(FixedPoint_Multiply(a, b)) == 1.625f);
+  CHECK(FixedToFloat(FixedPoint_Divide(a, b)) == 6.5f);
+  CHECK(FixedPoint_Divide(a, FloatToFixed(0.0f)).fixed.f == 0);
+  //original follows the fixed value
+  CHECK(FixedPoint_Multiply(a, b).original == 1.625f);
+
+  CHECK(FixedPoint_Scale(1 << 20, VOLTAGE_PER_COUNT) == (1 << 20) * 1000 / 32768);
+  CHECK(FixedPoint_Scale(-(1 << 20), CURRENT_PER_COUNT) == -(1 << 20) * 10 / 32768);
+
+  CHECK(FixedPoint_Sqrt64(0) == 0);
+  CHECK(FixedPoint_Sqrt64(15) == 3);
+  CHECK(FixedPoint_Sqrt64(16) == 4);
+  CHECK(FixedPoint_Sqrt64(0xFFFFFFFE00000001ULL) == 0xFFFFFFFF);
+  for (uint64_t x = 1; x < (1ULL << 62); x = x * 3 + 1)
+  {
+    uint64_t root = FixedPoint_Sqrt64(x);
+    CHECK(root * root <= x && (root + 1) * (root + 1) > x);
+  }
+}
+
+int main(void)
+{
+  TestArithmetic();
+  Compare(16);
+  Compare(32);
+  Compare(128);
+  return 0;
+}
@@ -0,0 +1,270 @@
+/*
+ * test_flash.c
+ *
+ *  Runs the wear levelled record log against the FTFE model: single phrase writes, compaction into the next sector,
+ *  erases per sector, CRC rejection of a damaged record and recovery from a power cut part way through any flash command.
+ *  Also runs the flash thread on a queued sector write, the way a tariff table is saved.
+ */
+
+#include "Bench.h"
+#include "FlashModel.h"
+#include "Flash.c"
+#include "CRC.c"
+
+#define WRITES_NB 100000
+
+//the first sector after the log, where the tariff tables start
+#define SECTOR (FLASH_DATA_END + 1)
+
+static jmp_buf ThreadBlocked;
+static uint32_t CallbackArgument;
+static bool CallbackSuccess;
+static uint8_t CallbacksCalled;
+
+static volatile uint16_t *A;
+static volatile uint8_t *B;
+static volatile uint32_t *C;
+
+/*! @brief Restarts as a reset would, RAM is lost and the log is read back from flash.
+ */
+static void Boot(void)
+{
+  memset(MemoryMap, 0, sizeof(MemoryMap));
+  memset(Variables, 0, sizeof(Variables));
+  CHECK(Flash_Init());
+  CHECK(Flash_AllocateVar((volatile void **)&A, 2));
+  CHECK(Flash_AllocateVar((volatile void **)&B, 1));
+  CHECK(Flash_AllocateVar((volatile void **)&C, 4));
+}
+
+static uint32_t LogErases(void)
+{
+  return FlashModel_Erase_Count(FLASH_DATA_START, FLASH_LOG_SECTORS);
+}
+
+//the flash thread has done everything queued and is waiting for more
+static void LeaveThread(OS_ECB * const event)
+{
+  longjmp(ThreadBlocked, 1);
+}
+
+static void RunThread(void)
+{
+  OS_Blocked = LeaveThread;
+  if (setjmp(ThreadBlocked) == 0)
+    Flash_Thread(NULL);
+  OS_Blocked = NULL;
+}
+
+static void Written(const uint32_t argument, const bool success)
+{
+  CallbackArgument = argument;
+  CallbackSuccess = success;
+  CallbacksCalled++;
+}
+
+static void TestSinglePhrase(void)
+{
+  //a part that has never had a log on it
+  FlashModel_Init(0x5A);
+  Boot();
+  CHECK(*A == CLEAR_DATA2 && *B == CLEAR_DATA1 && *C == CLEAR_DATA4);
+  CHECK((uintptr_t)C % 4 == 0);
+
+  //a write is one phrase and no erase
+  uint32_t erases = LogErases(), programs = FlashModel_Programs;
+  CHECK(Flash_Write8((volatile uint8_t *)B, 7));
+  CHECK(FlashModel_Programs == programs + 1 && LogErases() == erases);
+  //unchanged, nothing to program
+  CHECK(Flash_Write8((volatile uint8_t *)B, 7));
+  CHECK(FlashModel_Programs == programs + 1);
+  //misaligned
+  CHECK(!Flash_Write16((volatile uint16_t *)((volatile uint8_t *)A + 1), 1));
+
+  //the variables aren't limited to a phrase any more
+  volatile void *variable;
+  uint8_t allocated = 8;
+  while (Flash_AllocateVar(&variable, 4))
+    allocated += 4;
+  CHECK(allocated == FLASH_SIZE);
+}
+
+static void TestWearLevelling(void)
+{
+  FlashModel_Init(0xFF);
+  Boot();
+
+  uint16_t a = 0;
+  uint8_t b = 0;
+  uint32_t c = 0;
+  for (uint32_t i = 0; i < WRITES_NB; i++)
+  {
+    a = i * 7;
+    b = i;
+    c = i * 2654435761u;
+    CHECK(Flash_Write16((volatile uint16_t *)A, a));
+    CHECK(Flash_Write8((volatile uint8_t *)B, b));
+    CHECK(Flash_Write32((volatile uint32_t *)C, c));
+    if (i % 9973 == 0)
+    {
+      Boot();
+      CHECK(*A == a && *B == b && *C == c);
+    }
+  }
+  Boot();
+  CHECK(*A == a && *B == b && *C == c);
+
+  uint32_t least = UINT32_MAX, most = 0;
+  for (uint8_t sector = 0; sector < FLASH_LOG_SECTORS; sector++)
+  {
+    uint32_t erases = FlashModel_Erase_Count(LOG_SECTOR(sector), 1);
+    least = erases < least ? erases : least;
+    most = erases > most ? erases : most;
+  }
+  //each sector holds its header, a copy of the live variables and then the new records
+  uint32_t perSector = FLASH_SECTOR_SIZE / FLASH_PHRASE_SIZE - 1 - 2;
+  printf("%u writes: %u phrases programmed, %u to %u erases per sector, about %u writes per erase (the old scheme erased one sector every write)\n",
+      3 * WRITES_NB, FlashModel_Programs, least, most, 3 * WRITES_NB / LogErases());
+  CHECK(most - least <= 1);
+  CHECK(LogErases() <= 3 * WRITES_NB / perSector + FLASH_LOG_SECTORS);
+}
+
+static void TestCRC(void)
+{
+  FlashModel_Init(0xFF);
+  Boot();
+  CHECK(Flash_Write32((volatile uint32_t *)C, 0x12345678));
+  CHECK(Flash_Write32((volatile uint32_t *)C, 0x9ABCDEF0));
+
+  //flash can only lose bits, clear one in the data of the newest record
+  TFlashRecord *record = (TFlashRecord *)(uintptr_t)(NextRecord - FLASH_PHRASE_SIZE);
+  record->Data[0] &= ~0x10;
+  Boot();
+  CHECK(*C == 0x12345678);
+
+  //and in its CRC
+  CHECK(Flash_Write32((volatile uint32_t *)C, 0x0F0F0F0F));
+  record = (TFlashRecord *)(uintptr_t)(NextRecord - FLASH_PHRASE_SIZE);
+  CHECK(record->CRC != 0);
+  record->CRC &= record->CRC - 1;
+  Boot();
+  CHECK(*C == 0x12345678);
+
+  //a damaged header takes its sector out, which is why every sector starts with a full copy
+  uint8_t active = ActiveSector;
+  while (ActiveSector == active)
+    CHECK(Flash_Write32((volatile uint32_t *)C, NextRecord));
+  uint32_t last = *C;
+  ((TFlashSectorHeader *)LOG_SECTOR(active))->Magic &= ~1;
+  Boot();
+  CHECK(*C == last);
+}
+
+static void TestPowerCut(void)
+{
+  FlashModel_Init(0xFF);
+  Boot();
+  CHECK(Flash_Write32((volatile uint32_t *)C, 0xC0FFEE));
+
+  uint32_t cuts = 0;
+  for (uint32_t k = 0; k < 20000; k++)
+  {
+    uint16_t before = *A;
+    //cut part way through one of the next few commands, some of which are sector rollovers
+    FlashModel_Budget = k % 7;
+    if (setjmp(FlashModel_PowerCut) == 0)
+    {
+      Flash_Write16((volatile uint16_t *)A, before + 1);
+      Flash_Write8((volatile uint8_t *)B, before);
+    }
+    else
+    {
+      cuts++;
+      //the semaphore was taken when the power went
+      AccessSemaphore->count = 1;
+    }
+    FlashModel_Budget = -1;
+
+    Boot();
+    CHECK(*A == before || *A == (uint16_t)(before + 1));
+    CHECK(*C == 0xC0FFEE);
+  }
+  printf("power cut %u times, every variable came back old or new, the others untouched\n", cuts);
+
+  CHECK(Flash_Erase());
+  Boot();
+  CHECK(*A == CLEAR_DATA2 && *C == CLEAR_DATA4);
+}
+
+static void TestSectorWrite(void)
+{
+  FlashModel_Init(0xFF);
+  Boot();
+
+  //something already in the sector, so it has to be erased first
+  uint8_t old[FLASH_SECTOR_SIZE / 2], block[FLASH_SECTOR_SIZE / 2];
+  for (uint16_t i = 0; i < sizeof(block); i++)
+  {
+    old[i] = i * 13;
+    block[i] = i * 7 + 1;
+  }
+  CHECK(Flash_Write_Block(SECTOR, old, sizeof(old)));
+
+  //only outside the log, whole phrases and one sector at a time
+  CHECK(!Flash_Write_Sector_Async(FLASH_DATA_START, block, sizeof(block), Written, 1));
+  CHECK(!Flash_Write_Sector_Async(SECTOR + FLASH_PHRASE_SIZE, block, sizeof(block), Written, 1));
+  CHECK(!Flash_Write_Sector_Async(SECTOR, block, sizeof(block) - 1, Written, 1));
+  CHECK(Flash_Write_Sector_Async(SECTOR, block, sizeof(block), Written, 42));
+  CHECK(!Flash_Write_Sector_Async(SECTOR, block, sizeof(block), Written, 1));
+
+  //nothing happens until the thread runs, and a variable write queued alongside isn't held up by it
+  CHECK(Flash_Write_Async(C, 0xCAFE, 4, Written, 7));
+  uint32_t erases = FlashModel_Erase_Count(SECTOR, 1);
+  CHECK(memcmp((void *)(uintptr_t)SECTOR, old, sizeof(old)) == 0 && *C == CLEAR_DATA4);
+  CallbacksCalled = 0;
+  RunThread();
+  CHECK(CallbacksCalled == 2 && CallbackArgument == 7 && CallbackSuccess);
+  CHECK(memcmp((void *)(uintptr_t)SECTOR, block, sizeof(block)) == 0 && *C == 0xCAFE);
+  CHECK(FlashModel_Erase_Count(SECTOR, 1) == erases + 1);
+
+  //free for the next one once the callback is queued
+  CHECK(Flash_Write_Sector_Async(SECTOR, old, sizeof(old), Written, 1));
+  RunThread();
+  CHECK(memcmp((void *)(uintptr_t)SECTOR, old, sizeof(old)) == 0);
+
+  //the first phrase goes in last, so it only ever matches once the whole block does
+  uint32_t cuts = 0;
+  for (uint32_t k = 0; k < 2 * sizeof(block) / FLASH_PHRASE_SIZE; k += 3)
+  {
+    const uint8_t *next = (k % 2) ? old : block;
+    CHECK(Flash_Write_Sector_Async(SECTOR, next, sizeof(block), Written, k));
+    FlashModel_Budget = k / 2;
+    if (setjmp(FlashModel_PowerCut) == 0)
+      RunThread();
+    else
+    {
+      cuts++;
+      //RAM is lost with the power
+      AccessSemaphore->count = 1;
+      SectorRequest.Data = NULL;
+      CallbacksNb = 0;
+      OS_Blocked = NULL;
+    }
+    FlashModel_Budget = -1;
+
+    if (memcmp((void *)(uintptr_t)SECTOR, next, FLASH_PHRASE_SIZE) == 0)
+      CHECK(memcmp((void *)(uintptr_t)SECTOR, next, sizeof(block)) == 0);
+  }
+  printf("sector write cut %u times, the first phrase never matched before the rest did\n", cuts);
+  CHECK(cuts > 0);
+}
+
+int main(void)
+{
+  TestSinglePhrase();
+  TestWearLevelling();
+  TestCRC();
+  TestPowerCut();
+  TestSectorWrite();
+  return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * test_frames.c
+ *
+ *  Checks the variable length frames come through the UART receive ISR mixed in with the 5-byte packets, that a bad
+ *  length or CRC only costs the frame it's in, and that the table CRC-16 matches a bit by bit one. Then times the ISR on
+ *  streams of packets and of frames, in cycles per byte on the wire and per payload byte.
+ */
+
+#include "Bench.h"
+#include "UARTModel.h"
+#include "packet.c"
+#include "CRC.c"
+
+//fewer than the slots, so the thread keeps up and nothing is dropped for want of room
+#define BATCH_NB 4
+#define BATCHES_NB 5000
+
+static uint8_t Payload[FRAME_PAYLOAD_MAX];
+
+static uint16_t BitwiseCRC(const uint8_t * const data, const uint32_t length, uint16_t crc)
+{
+  for (uint32_t i = 0; i < length; i++)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+static bool Waiting(void)
+{
+  return PacketSemaphore->count > 0;
+}
+
+static void ExpectPacket(const uint8_t command, const uint8_t parameter1)
+{
+  CHECK(Waiting());
+  Packet_Get();
+  CHECK(!Frame && Packet_Command == command && Packet_Parameter1 == parameter1);
+}
+
+static void ExpectFrame(const uint8_t command, const uint8_t length)
+{
+  CHECK(Waiting());
+  Packet_Get();
+  CHECK(Frame && Frame->Command == command && Frame->Length == length && memcmp(Frame->Payload, Payload, length) == 0);
+}
+
+static void TestCRC(void)
+{
+  //CRC-16/CCITT-FALSE check value
+  CHECK(CRC_16("123456789", 9, CRC16_INITIAL) == 0x29B1);
+
+  static uint8_t data[4096];
+  srand(25);
+  for (uint16_t i = 0; i < sizeof(data); i++)
+    data[i] = rand();
+  for (uint16_t length = 0; length < 300; length += 7)
+    CHECK(CRC_16(data, length, CRC16_INITIAL) == BitwiseCRC(data, length, CRC16_INITIAL));
+
+  //and carrying on from part of a block, as the ISR does a byte at a time
+  CHECK(CRC_16(&data[100], 200, CRC_16(data, 100, CRC16_INITIAL)) == BitwiseCRC(data, 300, CRC16_INITIAL));
+}
+
+static void TestMixed(void)
+{
+  CHECK(Packet_Init(0, 0));
+
+  //the start byte everywhere it could confuse the framer
+  memset(Payload, FRAME_START, sizeof(Payload));
+  Packet_Put(0x09, 'v', 1, 2);
+  Frame_Put(0x33, Payload, FRAME_PAYLOAD_MAX);
+  Frame_Put(0x10, Payload, 0);
+  Packet_Put(0x33, FRAME_START, FRAME_START, FRAME_START);
+  UARTModel_Feed();
+  ExpectPacket(0x09, 'v');
+  ExpectFrame(0x33, FRAME_PAYLOAD_MAX);
+  ExpectFrame(0x10, 0);
+  ExpectPacket(0x33, FRAME_START);
+  CHECK(!Waiting());
+
+  //a bad length can't be taken for a frame, so it doesn't swallow what comes after
+  for (uint8_t i = 0; i < 10; i++)
+    Payload[i] = i;
+  Frame_Put(0x34, Payload, 10);
+  UARTModel_Wire[1] ^= 0x40;
+  Packet_Put(0x12, 0, 0, 0);
+  Frame_Put(0x35, Payload, 4);
+  UARTModel_Feed();
+  ExpectPacket(0x12, 0);
+  ExpectFrame(0x35, 4);
+  CHECK(!Waiting());
+
+  //a bad CRC drops the frame and the next one starts straight after it
+  Frame_Put(0x36, Payload, 10);
+  UARTModel_Wire[6] ^= 0x01;
+  Packet_Put(0x13, 1, 0, 0);
+  Frame_Put(0x37, Payload, 3);
+  UARTModel_Feed();
+  ExpectPacket(0x13, 1);
+  ExpectFrame(0x37, 3);
+  CHECK(!Waiting());
+
+  TPacketStats stats;
+  Packet_Get_Stats(&stats);
+  CHECK(stats.CRCErrors == 1 && stats.DroppedPackets == 0);
+}
+
+/*! @brief Times the ISR over a stream of packets or frames.
+ *
+ *  @param length The frame payload length, or 0 for 5-byte packets.
+ *  @return double - cycles per payload byte.
+ */
+static double Benchmark(const uint8_t length)
+{
+  CHECK(Packet_Init(0, 0));
+  for (uint16_t i = 0; i < sizeof(Payload); i++)
+    Payload[i] = i * 7;
+
+  uint64_t cycles = 0, bytes = 0, payloadBytes = 0;
+  for (uint32_t batch = 0; batch < BATCHES_NB; batch++)
+  {
+    for (uint8_t i = 0; i < BATCH_NB; i++)
+      if (length)
+        Frame_Put(0x20, Payload, length);
+      else
+        Packet_Put(0x11, batch, i, 3);
+    bytes += UARTModel_WireNb;
+    payloadBytes += BATCH_NB * (length ? length : PACKET_NB_BYTES - 2);
+
+    uint64_t start = Bench_Cycles();
+    UARTModel_Feed();
+    cycles += Bench_Cycles() - start;
+
+    for (uint8_t i = 0; i < BATCH_NB; i++)
+    {
+      CHECK(Waiting());
+      Packet_Get();
+      CHECK(length ? (Frame && Frame->Length == length) : !Frame);
+    }
+  }
+
+  if (length)
+    printf("%3u byte frames: %5.1f cycles/byte, %5.1f cycles/payload byte, %.0f%% of the wire is payload\n", length,
+        (double)cycles / bytes, (double)cycles / payloadBytes, 100.0 * payloadBytes / bytes);
+  else
+    printf("5-byte packets:  %5.1f cycles/byte, %5.1f cycles/payload byte, %.0f%% of the wire is payload\n",
+        (double)cycles / bytes, (double)cycles / payloadBytes, 100.0 * payloadBytes / bytes);
+  return (double)cycles / payloadBytes;
+}
+
+static void BenchmarkCRC(void)
+{
+  static uint8_t data[65536];
+  for (uint32_t i = 0; i < sizeof(data); i++)
+    data[i] = i * 7;
+
+  uint64_t start = Bench_Cycles();
+  uint16_t crc = CRC_16(data, sizeof(data), CRC16_INITIAL);
+  Bench_Keep(&crc);
+  uint64_t table = Bench_Cycles() - start;
+
+  start = Bench_Cycles();
+  crc = BitwiseCRC(data, sizeof(data), CRC16_INITIAL);
+  Bench_Keep(&crc);
+  uint64_t bitwise = Bench_Cycles() - start;
+
+  printf("CRC-16: table %.2f cycles/byte, bit by bit %.2f cycles/byte\n", (double)table / sizeof(data), (double)bitwise / sizeof(data));
+}
+
+int main(void)
+{
+  TestCRC();
+  TestMixed();
+  double packets = Benchmark(0);
+  Benchmark(3);
+  Benchmark(16);
+  //a long payload carries its own overhead, the packets carry 2 bytes for every 3
+  CHECK(Benchmark(FRAME_PAYLOAD_MAX) < packets);
+  BenchmarkCRC();
+  return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * test_harmonics.c
+ *
+ *  Captures synthetic cycles with known harmonics through the PIT ISR entry point, runs the analysis thread on them,
+ *  checks the magnitudes, phases, THD and whole cycle rms, and reports cycles per analysis at each capture size.
+ */
+
+#include "Bench.h"
+#include "Harmonics.c"
+#include "DSP.c"
+#include <setjmp.h>
+
+#define RUNS_NB 200
+
+static jmp_buf ThreadBlocked;
+
+uint32_t Load_Get_Cycle_Count()
+{
+  return (uint32_t)Bench_Cycles();
+}
+
+//the analysis thread has finished the capture and is waiting for another
+static void LeaveThread(OS_ECB * const event)
+{
+  longjmp(ThreadBlocked, 1);
+}
+
+typedef struct
+{
+  uint8_t Harmonic;
+  double Voltage;  //rms V
+  double Current;  //rms A
+  double Phase;    //degrees from the voltage fundamental, the same for both channels
+} THarmonic;
+
+static const THarmonic WAVE[] =
+{
+  {1, 230.0, 5.0, 0.0},
+  {3, 11.5, 1.5, 30.0},
+  {5, 6.9, 0.8, -60.0},
+  {7, 2.3, 0.3, 120.0},
+};
+#define WAVE_NB (sizeof(WAVE) / sizeof(WAVE[0]))
+
+/*! @brief Feeds one cycle of the test wave through the ISR and runs the analysis.
+ *
+ *  @param samplesPerCycle The capture size.
+ *  @param offset Where in the cycle the capture starts, in degrees of the fundamental.
+ */
+static void Analyse_Cycle(const uint16_t samplesPerCycle, const double offset)
+{
+  CHECK(Harmonics_Start_Capture(samplesPerCycle));
+  for (uint16_t i = 0; i < samplesPerCycle; i++)
+  {
+    double voltage = 0, current = 0;
+    for (uint8_t w = 0; w < WAVE_NB; w++)
+    {
+      double angle = WAVE[w].Harmonic * (2 * M_PI * i / samplesPerCycle + offset * M_PI / 180) + WAVE[w].Phase * M_PI / 180;
+      voltage += WAVE[w].Voltage * M_SQRT2 * cos(angle);
+      current += WAVE[w].Current * M_SQRT2 * cos(angle);
+    }
+    Harmonics_Add_Sample(lround(voltage / VOLTS_PER_COUNT), lround(current / AMPS_PER_COUNT));
+  }
+
+  if (setjmp(ThreadBlocked) == 0)
+    Harmonics_Thread(NULL);
+}
+
+static void Check(const uint16_t samplesPerCycle)
+{
+  const THarmonics *results = Harmonics_Get();
+  CHECK(results->HarmonicsNb == (samplesPerCycle / 2 - 1 > HARMONICS_MAX ? HARMONICS_MAX : samplesPerCycle / 2 - 1));
+
+  double voltageSquares = 0, currentSquares = 0, voltageDistortion = 0, currentDistortion = 0;
+  for (uint8_t w = 0; w < WAVE_NB; w++)
+  {
+    voltageSquares += WAVE[w].Voltage * WAVE[w].Voltage;
+    currentSquares += WAVE[w].Current * WAVE[w].Current;
+    if (WAVE[w].Harmonic > 1)
+    {
+      voltageDistortion += WAVE[w].Voltage * WAVE[w].Voltage;
+      currentDistortion += WAVE[w].Current * WAVE[w].Current;
+    }
+  }
+
+  //the whole cycle rms from the DSP kernel
+  CHECK(fabs(results->Channels[HARMONICS_VOLTAGE].Magnitude[0] - sqrt(voltageSquares)) < 0.05);
+  CHECK(fabs(results->Channels[HARMONICS_CURRENT].Magnitude[0] - sqrt(currentSquares)) < 0.005);
+
+  for (uint8_t h = 1; h <= results->HarmonicsNb; h++)
+  {
+    const THarmonic *expected = NULL;
+    for (uint8_t w = 0; w < WAVE_NB; w++)
+      if (WAVE[w].Harmonic == h)
+        expected = &WAVE[w];
+
+    const THarmonicsChannel *voltage = &results->Channels[HARMONICS_VOLTAGE];
+    const THarmonicsChannel *current = &results->Channels[HARMONICS_CURRENT];
+    if (!expected)
+    {
+      CHECK(voltage->Magnitude[h] < 0.1 && current->Magnitude[h] < 0.005);
+      continue;
+    }
+    CHECK(fabs(voltage->Magnitude[h] - expected->Voltage) < 0.1);
+    CHECK(fabs(current->Magnitude[h] - expected->Current) < 0.005);
+    CHECK(fabs(WrapDegrees(voltage->Phase[h] - expected->Phase)) < 0.5);
+    CHECK(fabs(WrapDegrees(current->Phase[h] - expected->Phase)) < 0.5);
+  }
+
+  CHECK(fabs(results->Channels[HARMONICS_VOLTAGE].THD - sqrt(voltageDistortion) / WAVE[0].Voltage) < 0.001);
+  CHECK(fabs(results->Channels[HARMONICS_CURRENT].THD - sqrt(currentDistortion) / WAVE[0].Current) < 0.001);
+}
+
+int main(void)
+{
+  Harmonics_Init();
+  OS_Blocked = LeaveThread;
+
+  //a 7th harmonic needs at least 16 samples a cycle
+  for (uint16_t samplesPerCycle = 16; samplesPerCycle <= HARMONICS_FFT_SIZE; samplesPerCycle *= 2)
+  {
+    //phases are relative to the fundamental, so where the capture starts mustn't matter
+    for (double offset = 0; offset < 360; offset += 37)
+    {
+      Analyse_Cycle(samplesPerCycle, offset);
+      Check(samplesPerCycle);
+    }
+
+    uint64_t cycles = 0;
+    for (int run = 0; run < RUNS_NB; run++)
+    {
+      Analyse_Cycle(samplesPerCycle, 0);
+      cycles += Harmonics_Get_Cycles();
+    }
+    printf("%3u point capture: %.0f cycles per analysis, harmonics 1 to %u\n", samplesPerCycle, (double)cycles / RUNS_NB,
+        Harmonics_Get()->HarmonicsNb);
+  }
+
+  //not a power of two
+  CHECK(!Harmonics_Start_Capture(48));
+  return 0;
+}
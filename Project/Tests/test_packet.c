@@ -0,0 +1,202 @@
+/*
+ * test_packet.c
+ *
+ *  Runs streams of 5-byte packets through the UART receive ISR with a byte error injector in the way,
+ *  flipping bits, dropping bytes and adding bytes, and reports how many packets get through, how many bogus
+ *  ones are let through and the ISR's cycles per byte. The framer from before the sliding window is run on
+ *  the same damaged streams for comparison.
+ *  Only streams of mixed commands are checked. When every packet has the same command any rotation of a packet
+ *  passes the XOR checksum, so once a lost byte has moved the framing neither framer can tell, those are just reported.
+ */
+
+#include "Bench.h"
+#include "UARTModel.h"
+#include "packet.c"
+#include "CRC.c"
+
+//the command sent when every packet has the same one
+#define COMMAND 0x11
+
+//fewer than the slots, so the thread keeps up and nothing is dropped for want of room
+#define BATCH_NB 4
+#define BATCHES_NB 20000
+
+typedef enum
+{
+  FLIP_BIT,
+  DROP_BYTE,
+  ADD_BYTE
+} TDamage;
+
+static const char * const DAMAGE_NAMES[] = {"bit flips", "dropped bytes", "added bytes"};
+
+static bool Repeated;
+
+typedef struct
+{
+  uint32_t Sent;
+  uint32_t Delivered;  //sent packets that came out
+  uint32_t Bogus;      //packets or frames that came out but weren't sent
+} TCount;
+
+//the framer before the sliding window, a bad checksum threw all five bytes away and started again from the next
+static uint8_t OldWindow[PACKET_NB_BYTES];
+static uint8_t OldNb;
+
+static uint8_t Check3(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2)
+{
+  return command * 59 + parameter1 * 31 + parameter2 * 17 + 0x5A;
+}
+
+//the test packets carry a sequence number and a check on it, so a packet framed at the wrong offset is spotted
+static bool Genuine(const uint8_t command, const uint8_t parameter1, const uint8_t parameter2, const uint8_t parameter3)
+{
+  return !(command & PACKET_ACK_MASK) && parameter3 == Check3(command, parameter1, parameter2);
+}
+
+static void Count(TCount * const count, const bool genuine)
+{
+  if (genuine)
+    count->Delivered++;
+  else
+    count->Bogus++;
+}
+
+static void OldReceive(const uint8_t data, TCount * const count)
+{
+  OldWindow[OldNb++] = data;
+  if (OldNb < PACKET_NB_BYTES)
+    return;
+  OldNb = 0;
+  if (Calc_Checksum(OldWindow[0], OldWindow[1], OldWindow[2], OldWindow[3]) == OldWindow[4])
+    Count(count, Genuine(OldWindow[0], OldWindow[1], OldWindow[2], OldWindow[3]));
+}
+
+static void Drain(TCount * const count)
+{
+  while (PacketSemaphore->count > 0)
+  {
+    Packet_Get();
+    Count(count, !Frame && Genuine(Packet_Command, Packet_Parameter1, Packet_Parameter2, Packet_Parameter3));
+  }
+}
+
+//any command without the ACK bit, or the same one every time
+static void Send(const uint16_t sequence)
+{
+  uint8_t command = Repeated ? COMMAND : rand() & ~PACKET_ACK_MASK;
+  Packet_Put(command, sequence & 0xFF, sequence >> 8, Check3(command, sequence & 0xFF, sequence >> 8));
+}
+
+/*! @brief Damages the bytes on the wire.
+ *
+ *  @param damage What to do to a damaged byte.
+ *  @param rate The chance of each byte being damaged.
+ */
+static void Inject(const TDamage damage, const double rate)
+{
+  static uint8_t wire[UARTMODEL_WIRE_NB];
+  uint32_t wireNb = 0;
+  for (uint32_t i = 0; i < UARTModel_WireNb; i++)
+  {
+    uint8_t data = UARTModel_Wire[i];
+    if (rand() < rate * RAND_MAX)
+    {
+      if (damage == FLIP_BIT)
+        data ^= 1 << (rand() % 8);
+      else if (damage == DROP_BYTE)
+        continue;
+      else
+        wire[wireNb++] = rand();
+    }
+    wire[wireNb++] = data;
+  }
+  memcpy(UARTModel_Wire, wire, wireNb);
+  UARTModel_WireNb = wireNb;
+}
+
+static void TestDroppedByte(void)
+{
+  CHECK(Packet_Init(0, 0));
+  OldNb = 0;
+  TCount count = {0}, old = {0};
+
+  //a byte goes missing from the middle of the 50th of 100 packets
+  for (uint16_t sequence = 0; sequence < 100; sequence++)
+  {
+    Send(sequence);
+    if (sequence == 49)
+    {
+      memmove(&UARTModel_Wire[UARTModel_WireNb - 3], &UARTModel_Wire[UARTModel_WireNb - 2], 2);
+      UARTModel_WireNb--;
+    }
+    for (uint32_t i = 0; i < UARTModel_WireNb; i++)
+      OldReceive(UARTModel_Wire[i], &old);
+    UARTModel_Feed();
+    Drain(&count);
+  }
+
+  //only the damaged packet is lost, the window slides over its four bytes onto the next
+  TPacketStats stats;
+  Packet_Get_Stats(&stats);
+  printf("one dropped byte in 100 packets: %u delivered (%u before the sliding window), %u checksum error, %u resync, %u bytes discarded\n",
+      count.Delivered, old.Delivered, stats.ChecksumErrors, stats.Resyncs, stats.DiscardedBytes);
+  CHECK(count.Delivered == 99 && count.Bogus == 0);
+  CHECK(stats.ChecksumErrors == 1 && stats.Resyncs == 1 && stats.DiscardedBytes == PACKET_NB_BYTES - 1);
+  CHECK(old.Delivered < 60);
+}
+
+static void TestNoise(const TDamage damage, const double rate)
+{
+  CHECK(Packet_Init(0, 0));
+  OldNb = 0;
+  srand(22);
+  TCount count = {0}, old = {0};
+  uint64_t cycles = 0, bytes = 0;
+  uint16_t sequence = 0;
+
+  for (uint32_t batch = 0; batch < BATCHES_NB; batch++)
+  {
+    for (uint8_t i = 0; i < BATCH_NB; i++)
+      Send(sequence++);
+    count.Sent += BATCH_NB;
+    Inject(damage, rate);
+
+    for (uint32_t i = 0; i < UARTModel_WireNb; i++)
+      OldReceive(UARTModel_Wire[i], &old);
+    bytes += UARTModel_WireNb;
+    uint64_t start = Bench_Cycles();
+    UARTModel_Feed();
+    cycles += Bench_Cycles() - start;
+    Drain(&count);
+  }
+
+  TPacketStats stats;
+  Packet_Get_Stats(&stats);
+  printf("%s %-13s %.0e: %5.1f%% delivered (%5.1f%% before), %u bogus (%u before), %u resyncs, %.1f cycles/byte\n",
+      Repeated ? "one command " : "any command ", DAMAGE_NAMES[damage], rate, 100.0 * count.Delivered / count.Sent, 100.0 * old.Delivered / count.Sent, count.Bogus, old.Bogus,
+      stats.Resyncs, (double)cycles / bytes);
+
+  CHECK(stats.DroppedPackets == 0);
+  if (Repeated)
+    return;
+  //a damaged byte loses the packet it's in and at most the one after, whatever the damage
+  CHECK(count.Delivered >= count.Sent * (1 - 2 * PACKET_NB_BYTES * rate) - 50);
+  //the XOR checksum is weak, but a framed bogus packet still needs a bad byte that happens to check out
+  CHECK(count.Bogus <= count.Sent * rate * PACKET_NB_BYTES / 10 + 5);
+}
+
+int main(void)
+{
+  TestDroppedByte();
+  for (uint8_t repeated = 0; repeated < 2; repeated++)
+  {
+    Repeated = repeated;
+    for (TDamage damage = FLIP_BIT; damage <= ADD_BYTE; damage++)
+    {
+      TestNoise(damage, 1e-3);
+      TestNoise(damage, 1e-2);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * test_pll.c
+ *
+ *  Drives the zero crossing tracker and the software PLL with a synthetic mains voltage from 47 to 53 Hz,
+ *  sampled at whatever interval the PLL gives the PIT, and reports the lock time and the one cycle window
+ *  rms error with and without the PLL.
+ */
+
+#include "Bench.h"
+#include "PLL.c"
+#include "Frequency.c"
+#include <math.h>
+
+//16 samples a cycle at 50Hz, as Measurements_Init starts out
+#define SAMPLES_PER_CYCLE 16
+#define NOMINAL_INTERVAL (20000000 / SAMPLES_PER_CYCLE)
+
+//seconds simulated at each frequency, and how much of the end the error is measured over
+#define RUN_SECONDS 10.0
+#define SETTLED_SECONDS 5.0
+
+//240V rms in raw counts
+#define AMPLITUDE (240.0 * 1.41421356 / (1000.0 / 32768.0))
+
+static uint32_t PITInterval;
+
+void PIT_Set(const uint32_t period, const bool restart)
+{
+  PITInterval = period;
+}
+
+typedef struct
+{
+  bool Locked;
+  double LockSeconds;      //simulated time when it first locked
+  uint32_t LockTime;       //as PLL_Get_Lock_Time reports it
+  double SamplesPerCycle;  //actual samples per mains cycle at the end
+  double WorstError;       //worst one cycle window rms error once settled, relative
+  double Frequency;        //the last reading
+} TRun;
+
+/*! @brief Samples a mains voltage at the PIT interval, feeding the PLL the way calculateBasic does.
+ *
+ *  @param frequency The mains frequency in Hz.
+ *  @param locking FALSE to leave the PIT at the nominal interval.
+ */
+static TRun Run(const double frequency, const bool locking)
+{
+  TRun run = {0};
+  PITInterval = NOMINAL_INTERVAL;
+  Frequency_Init(NOMINAL_INTERVAL);
+  PLL_Init(NOMINAL_INTERVAL, SAMPLES_PER_CYCLE);
+
+  double time = 0.3e-3;  //start part way into a cycle
+  double sumSquares = 0;
+  uint16_t windowNb = 0;
+  float reading = 0;
+
+  while (time < RUN_SECONDS)
+  {
+    int16_t voltage = lround(AMPLITUDE * sin(2 * M_PI * frequency * time));
+    Frequency_Track(voltage);
+    sumSquares += (double)voltage * voltage;
+
+    if (++windowNb == SAMPLES_PER_CYCLE)
+    {
+      double error = fabs(sqrt(sumSquares / SAMPLES_PER_CYCLE) / (AMPLITUDE / 1.41421356) - 1);
+      if (time > RUN_SECONDS - SETTLED_SECONDS && error > run.WorstError)
+        run.WorstError = error;
+      sumSquares = 0;
+      windowNb = 0;
+
+      if (Frequency_Get(&reading) && locking)
+        PLL_Update(Frequency_Get_Period());
+      if (!run.Locked && PLL_Get_State() == PLL_LOCKED)
+      {
+        run.Locked = true;
+        run.LockSeconds = time;
+      }
+    }
+
+    //PIT_Set only takes effect from the next period
+    time += PITInterval * 1e-9;
+  }
+
+  run.LockTime = PLL_Get_Lock_Time();
+  run.SamplesPerCycle = 1e9 / (frequency * PITInterval);
+  run.Frequency = reading;
+  return run;
+}
+
+int main(void)
+{
+  for (double frequency = 47.0; frequency <= 53.0; frequency += 0.5)
+  {
+    TRun locked = Run(frequency, true);
+    TRun fixed = Run(frequency, false);
+    printf("%.1f Hz: locked after %4.0f ms (reported %4u ms), %.4f samples/cycle, window rms error %.4f%% (fixed rate %.4f%%), reads %.4f Hz\n",
+        frequency, locked.LockSeconds * 1e3, locked.LockTime, locked.SamplesPerCycle, locked.WorstError * 100,
+        fixed.WorstError * 100, locked.Frequency);
+
+    CHECK(locked.Locked);
+    CHECK(locked.LockSeconds < 2.0);
+    //the PLL only counts the cycles the tracker averaged, not the part averages a retune threw away
+    CHECK(locked.LockTime <= locked.LockSeconds * 1e3 && locked.LockTime > locked.LockSeconds * 1e3 * 0.75);
+    CHECK(fabs(locked.SamplesPerCycle - SAMPLES_PER_CYCLE) < 0.01);
+    CHECK(fabs(locked.Frequency - frequency) < 0.01);
+    //a window within 0.01 of a sample of a whole cycle leaks next to nothing
+    CHECK(locked.WorstError < 0.001);
+    CHECK(frequency == 50.0 || locked.WorstError < fixed.WorstError);
+  }
+
+  //losing the mains drops the lock and goes back to nominal
+  PLL_Update(0);
+  CHECK(PLL_Get_State() == PLL_UNLOCKED && PLL_Get_Interval() == NOMINAL_INTERVAL);
+  return 0;
+}